@@ -0,0 +1,142 @@
+#include "adaptive.hpp"
+#include "progressive.hpp"
+#include "render.hpp"
+#include "shading.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+    // Running sums of one pixel's samples.
+    struct PixelSamples
+    {
+        float sum[3] = {0, 0, 0};
+        float luminance = 0;
+        float luminanceSquares = 0;
+        int count = 0;
+
+        void add(const unsigned char *color)
+        {
+            float value = 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+            for (int c = 0; c < 3; ++c)
+                sum[c] += color[c];
+            luminance += value;
+            luminanceSquares += value * value;
+            ++count;
+        }
+
+        float mean() const { return luminance / count; }
+
+        // of the mean luminance; 0 below two samples
+        float standardError() const
+        {
+            if (count < 2)
+                return 0;
+            float variance = (luminanceSquares - luminance * luminance / count) / (count - 1);
+            return std::sqrt(std::max(variance, 0.0f) / count);
+        }
+    };
+
+    struct Sample
+    {
+        int pixel;
+        int index;                  // in the progressive sequence
+    };
+}
+
+AdaptiveStats renderAdaptive(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                             const AdaptiveOptions &options, unsigned char *image, std::vector<int> *counts)
+{
+    const parser::Camera camera = scene.camera;
+    int width = camera.image_width, height = camera.image_height;
+    int baseSamples = std::min(options.baseSamples, options.maxSamples);
+    std::vector<parser::Camera> cameras(options.maxSamples);
+    for (int n = 0; n < options.maxSamples; ++n) {
+        float dx, dy;
+        sampleOffset(n, dx, dy);
+        cameras[n] = offsetCamera(camera, dx, dy);
+    }
+
+    AdaptiveStats stats;
+    std::vector<PixelSamples> pixels((size_t)width * height);
+    std::vector<unsigned char> frame((size_t)width * height * 3);
+    for (int n = 0; n < baseSamples; ++n) {
+        scene.camera = cameras[n];
+        renderImage(scene, compiled, pool, options.hybrid, &frame[0]);
+        for (size_t p = 0; p < pixels.size(); ++p)
+            pixels[p].add(&frame[p * 3]);
+    }
+    scene.camera = camera;
+
+    std::vector<float> luminance(pixels.size());
+    std::vector<Sample> samples;
+    std::vector<unsigned char> colors;
+    for (int round = 0;; ++round) {
+        for (size_t p = 0; p < pixels.size(); ++p)
+            luminance[p] = pixels[p].mean();
+
+        samples.clear();
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int p = y * width + x;
+                const PixelSamples &pixel = pixels[p];
+                if (pixel.count >= options.maxSamples)
+                    continue;
+                float error = pixel.standardError();
+                for (int ny = std::max(y - 1, 0); round == 0 && ny <= std::min(y + 1, height - 1); ++ny)
+                    for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx)
+                        error = std::max(error, std::fabs(luminance[ny * width + nx] - luminance[p]));
+                if (error <= options.threshold)
+                    continue;
+                if (pixel.count == baseSamples)
+                    ++stats.refined;
+                int more = std::min(options.roundSamples, options.maxSamples - pixel.count);
+                for (int n = 0; n < more; ++n)
+                    samples.push_back(Sample{p, pixel.count + n});
+            }
+        }
+        if (samples.empty())
+            break;
+        ++stats.rounds;
+
+        // samples lie in pixel order, so the rays of a batch stay close
+        colors.resize(samples.size() * 3);
+        int batches = (int)((samples.size() + KERNEL_TILE_PIXELS - 1) / KERNEL_TILE_PIXELS);
+        pool.parallelFor(batches, [&](int batch) {
+            size_t first = (size_t)batch * KERNEL_TILE_PIXELS;
+            int count = (int)std::min(samples.size() - first, (size_t)KERNEL_TILE_PIXELS);
+            Ray rays[KERNEL_TILE_PIXELS];
+            for (int i = 0; i < count; ++i) {
+                const Sample &sample = samples[first + i];
+                rays[i] = generateRay(cameras[sample.index], sample.pixel % width, sample.pixel / width);
+            }
+            TileBuffers buffers;
+            renderRays(scene, compiled, rays, count, &colors[first * 3], buffers);
+        });
+        for (size_t i = 0; i < samples.size(); ++i)
+            pixels[samples[i].pixel].add(&colors[i * 3]);
+    }
+
+    if (counts)
+        counts->resize(pixels.size());
+    for (size_t p = 0; p < pixels.size(); ++p) {
+        // rounded as Accumulator::resolve does
+        float scale = 1.0f / pixels[p].count;
+        for (int c = 0; c < 3; ++c)
+            image[p * 3 + c] = (unsigned char)(pixels[p].sum[c] * scale + 0.5f);
+        stats.samples += pixels[p].count;
+        if (counts)
+            (*counts)[p] = pixels[p].count;
+    }
+    return stats;
+}
+
+void sampleCountImage(const std::vector<int> &counts, int maxSamples, std::vector<unsigned char> &image)
+{
+    image.resize(counts.size() * 3);
+    for (size_t p = 0; p < counts.size(); ++p) {
+        unsigned char value = (unsigned char)(counts[p] * 255 / std::max(maxSamples, 1));
+        image[p * 3] = image[p * 3 + 1] = image[p * 3 + 2] = value;
+    }
+}
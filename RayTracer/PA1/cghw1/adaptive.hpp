@@ -0,0 +1,43 @@
+#ifndef ADAPTIVE_HPP
+#define ADAPTIVE_HPP
+
+#include "parser.hpp"
+#include "kernels.hpp"
+#include "threadpool.hpp"
+#include <vector>
+
+// Adaptive supersampling. Every pixel gets baseSamples samples, traced as
+// whole frames; then, round after round, the pixels whose error estimate is
+// above threshold get roundSamples more, up to maxSamples. The estimate is
+// the standard error of the pixel's mean luminance, and in the first round
+// also the largest luminance difference to its 8 neighbours, so edges are
+// found with one sample and then only refined where the samples disagree.
+// Samples follow the progressive sequence (progressive.hpp): a pixel with n
+// samples has the value it would have in an n-sample progressive render.
+struct AdaptiveOptions
+{
+    int baseSamples = 1;
+    int maxSamples = 16;
+    int roundSamples = 4;
+    float threshold = 4;            // luminance, 0 to 255
+    bool hybrid = false;            // for the base samples
+};
+
+struct AdaptiveStats
+{
+    int rounds = 0;                 // that refined any pixel
+    long refined = 0;               // pixels with more than the base samples
+    long samples = 0;               // over the whole frame
+};
+
+// Renders scene.camera into image (width * height RGB bytes); counts, if
+// given, receives the samples taken for each pixel. scene.camera is changed
+// during the render and restored afterwards.
+AdaptiveStats renderAdaptive(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                             const AdaptiveOptions &options, unsigned char *image, std::vector<int> *counts = 0);
+
+// Gray RGB image of counts in which maxSamples is white, for tuning the
+// threshold.
+void sampleCountImage(const std::vector<int> &counts, int maxSamples, std::vector<unsigned char> &image);
+
+#endif
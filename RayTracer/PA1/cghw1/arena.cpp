@@ -0,0 +1,67 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Arena::~Arena()
+{
+    release();
+}
+
+void Arena::addChunk(size_t bytes)
+{
+    bytes = std::max(bytes, ARENA_CHUNK_BYTES);
+    void *chunk = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED)
+        throw std::bad_alloc();
+    chunks.push_back(std::make_pair((char *)chunk, bytes));
+    next = (char *)chunk;
+    limit = next + bytes;
+    ++counters.chunks;
+    counters.capacity += bytes;
+}
+
+void Arena::reserve(size_t bytes)
+{
+    if ((size_t)(limit - next) < bytes)
+        addChunk(bytes);
+}
+
+void *Arena::allocate(size_t bytes, size_t alignment)
+{
+    uintptr_t start = ((uintptr_t)next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (!next || start + bytes > (uintptr_t)limit) {
+        addChunk(bytes + alignment);
+        start = ((uintptr_t)next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+    next = (char *)start + bytes;
+    ++counters.allocations;
+    counters.bytes += bytes;
+    return (void *)start;
+}
+
+void Arena::deallocate(void *block, size_t bytes)
+{
+    counters.freed += bytes;
+    char *begin = (char *)block;
+    if (begin + bytes == next) {
+        next = begin;
+        return;
+    }
+    // the pages inside the block are zero-filled again if ever touched
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)begin + page - 1) & ~(page - 1);
+    uintptr_t last = ((uintptr_t)begin + bytes) & ~(page - 1);
+    if (last > first)
+        madvise((void *)first, last - first, MADV_DONTNEED);
+}
+
+void Arena::release()
+{
+    for (const std::pair<char *, size_t> &chunk : chunks)
+        munmap(chunk.first, chunk.second);
+    chunks.clear();
+    next = limit = 0;
+}
@@ -0,0 +1,101 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Chunks are at least this large; bigger requests get a chunk of their own.
+const size_t ARENA_CHUNK_BYTES = 1 << 20;
+
+struct ArenaStats
+{
+    size_t allocations = 0;
+    size_t bytes = 0;           // handed out, including blocks freed since
+    size_t freed = 0;           // freed before release()
+    size_t chunks = 0;
+    size_t capacity = 0;        // mapped for chunks
+};
+
+// Bump allocator for the scene's storage. Memory is mapped in large chunks
+// and only unmapped all at once by release() or the destructor. Freeing
+// the most recent block makes its space available again; any other freed
+// block stays in place, with its whole pages handed back to the system.
+// Not thread-safe: the loaders allocate from one thread.
+class Arena
+{
+public:
+    Arena() {}
+    ~Arena();
+
+    // makes room for at least bytes more without another chunk
+    void reserve(size_t bytes);
+    // throws std::bad_alloc when no chunk can be mapped
+    void *allocate(size_t bytes, size_t alignment);
+    void deallocate(void *block, size_t bytes);
+    void release();
+
+    const ArenaStats &stats() const { return counters; }
+
+private:
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+    void addChunk(size_t bytes);
+
+    std::vector<std::pair<char *, size_t> > chunks;
+    char *next = 0, *limit = 0;         // free space of the current chunk
+    ArenaStats counters;
+};
+
+// Allocator for containers of scene data. It allocates from its arena, or
+// from the heap when it has none (a default-constructed container), and
+// moves along with the container's contents.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(Arena *arena = 0) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t count)
+    {
+        if (!arena)
+            return static_cast<T *>(::operator new(count * sizeof(T)));
+        return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+    void deallocate(T *block, size_t count)
+    {
+        if (!arena)
+            ::operator delete(block);
+        else
+            arena->deallocate(block, count * sizeof(T));
+    }
+
+    Arena *arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+template <typename T>
+using SceneVector = std::vector<T, ArenaAllocator<T> >;
+
+// Empties vector and moves it to arena with room for capacity elements.
+template <typename T>
+void useArena(SceneVector<T> &vector, Arena &arena, size_t capacity = 0)
+{
+    vector = SceneVector<T>(ArenaAllocator<T>(&arena));
+    vector.reserve(capacity);
+}
+
+#endif
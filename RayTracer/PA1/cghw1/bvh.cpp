@@ -0,0 +1,356 @@
+#include "bvh.hpp"
+#include "checksum.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <unistd.h>
+
+using namespace parser;
+
+namespace
+{
+    struct Box
+    {
+        float lower[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float upper[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+        void grow(const float *low, const float *high)
+        {
+            for (int a = 0; a < 3; ++a) {
+                lower[a] = std::min(lower[a], low[a]);
+                upper[a] = std::max(upper[a], high[a]);
+            }
+        }
+
+        void grow(const Box &box) { grow(box.lower, box.upper); }
+
+        // half the surface area, 0 for an empty box
+        float area() const
+        {
+            if (lower[0] > upper[0])
+                return 0;
+            float dx = upper[0] - lower[0], dy = upper[1] - lower[1], dz = upper[2] - lower[2];
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    struct BuildTask
+    {
+        int begin, end;
+        int depth;              // 1 for the root
+        int parent;             // node whose right child this is, or -1
+    };
+
+    inline int binOf(float centroid, float low, float scale)
+    {
+        int bin = (int)((centroid - low) * scale);
+        return std::min(std::max(bin, 0), BVH_SAH_BINS - 1);
+    }
+
+    // Splits [begin, end) of order in half along the widest centroid axis.
+    int splitMedian(std::vector<int> &order, const std::vector<float> &centroids, const Box &centroidBox, int begin, int end)
+    {
+        int axis = 0;
+        for (int a = 1; a < 3; ++a)
+            if (centroidBox.upper[a] - centroidBox.lower[a] > centroidBox.upper[axis] - centroidBox.lower[axis])
+                axis = a;
+        int mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+            float ca = centroids[3 * a + axis], cb = centroids[3 * b + axis];
+            return ca < cb || (ca == cb && a < b);
+        });
+        return mid;
+    }
+
+    // Where [begin, end) of order is split by the binned SAH, or begin for a
+    // leaf. Ranges too large for a leaf are always split.
+    int splitSah(std::vector<int> &order, const std::vector<float> &bounds, const std::vector<float> &centroids,
+                 const Box &box, const Box &centroidBox, int begin, int end)
+    {
+        int count = end - begin;
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            float low = centroidBox.lower[axis], width = centroidBox.upper[axis] - low;
+            if (!(width > 0))
+                continue;
+            float scale = BVH_SAH_BINS / width;
+
+            Box bins[BVH_SAH_BINS];
+            int counts[BVH_SAH_BINS] = {};
+            for (int s = begin; s < end; ++s) {
+                int triangle = order[s];
+                int bin = binOf(centroids[3 * triangle + axis], low, scale);
+                ++counts[bin];
+                bins[bin].grow(&bounds[6 * triangle], &bounds[6 * triangle + 3]);
+            }
+
+            float rightArea[BVH_SAH_BINS];
+            int rightCount[BVH_SAH_BINS];
+            Box right;
+            int inRight = 0;
+            for (int b = BVH_SAH_BINS - 1; b > 0; --b) {
+                right.grow(bins[b]);
+                inRight += counts[b];
+                rightArea[b] = right.area();
+                rightCount[b] = inRight;
+            }
+            Box left;
+            int inLeft = 0;
+            for (int b = 0; b < BVH_SAH_BINS - 1; ++b) {
+                left.grow(bins[b]);
+                inLeft += counts[b];
+                if (inLeft == 0 || rightCount[b + 1] == 0)
+                    continue;
+                float cost = inLeft * left.area() + rightCount[b + 1] * rightArea[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        if (bestAxis < 0)
+            return count > BVH_LEAF_SIZE ? splitMedian(order, centroids, centroidBox, begin, end) : begin;
+        // one box test against testing every triangle of a leaf
+        if (count <= BVH_LEAF_SIZE && box.area() + bestCost >= count * box.area())
+            return begin;
+
+        float low = centroidBox.lower[bestAxis];
+        float scale = BVH_SAH_BINS / (centroidBox.upper[bestAxis] - low);
+        return (int)(std::stable_partition(order.begin() + begin, order.begin() + end, [&](int triangle) {
+            return binOf(centroids[3 * triangle + bestAxis], low, scale) <= bestBin;
+        }) - order.begin());
+    }
+
+    /*
+     * Cache file: CacheHeader, the nodes at byte 64, then the slot order at
+     * the next multiple of 64. The checksum covers everything after the
+     * header. BVH_CACHE_VERSION changes whenever the build or the layout
+     * does, so old caches are rebuilt instead of trusted.
+     */
+    const char BVH_CACHE_MAGIC[8] = {'H', 'W', '1', 'B', 'V', 'H', 0, 0};
+    const uint32_t BVH_CACHE_VERSION = 1;
+
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t triangleCount;
+        uint64_t key;
+        uint32_t nodeCount;
+        uint32_t reserved;
+        uint64_t checksum;
+        char padding[24];
+    };
+
+    static_assert(sizeof(CacheHeader) == 64, "CacheHeader layout");
+    static_assert(sizeof(BvhNode) == 32, "BvhNode layout");
+
+    size_t orderOffset(size_t nodeCount)
+    {
+        return sizeof(CacheHeader) + (nodeCount * sizeof(BvhNode) + 63) / 64 * 64;
+    }
+
+    // Every slot in exactly one leaf, every node reached once, no deeper
+    // than the kernels can traverse, and order a permutation.
+    bool validBvh(const std::vector<BvhNode> &nodes, const std::vector<int> &order, int triangleCount)
+    {
+        if (triangleCount == 0)
+            return nodes.empty();
+        if (nodes.empty())
+            return false;
+
+        std::vector<char> seen(triangleCount, 0);
+        for (int triangle : order) {
+            if (triangle < 0 || triangle >= triangleCount || seen[triangle])
+                return false;
+            seen[triangle] = 1;
+        }
+
+        std::vector<char> covered(triangleCount, 0), visited(nodes.size(), 0);
+        std::vector<std::pair<int, int> > stack(1, std::make_pair(0, 1));
+        size_t reached = 0;
+        int slots = 0;
+        while (!stack.empty()) {
+            int index = stack.back().first, depth = stack.back().second;
+            stack.pop_back();
+            if (index < 0 || index >= (int)nodes.size() || visited[index] || depth > BVH_MAX_DEPTH)
+                return false;
+            visited[index] = 1;
+            ++reached;
+
+            const BvhNode &node = nodes[index];
+            if (node.count > 0) {
+                if (node.first < 0 || node.first > triangleCount - node.count)
+                    return false;
+                for (int s = node.first; s < node.first + node.count; ++s) {
+                    if (covered[s])
+                        return false;
+                    covered[s] = 1;
+                }
+                slots += node.count;
+            } else if (node.count == 0 && node.first > index + 1) {
+                stack.push_back(std::make_pair(node.first, depth + 1));
+                stack.push_back(std::make_pair(index + 1, depth + 1));
+            } else {
+                return false;
+            }
+        }
+        return slots == triangleCount && reached == nodes.size();
+    }
+}
+
+void buildBvh(const std::vector<float> &bounds, std::vector<BvhNode> &nodes, std::vector<int> &order)
+{
+    int count = (int)(bounds.size() / 6);
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0);
+    nodes.clear();
+    if (count == 0)
+        return;
+
+    std::vector<float> centroids((size_t)count * 3);
+    Box scene;
+    for (int i = 0; i < count; ++i) {
+        for (int a = 0; a < 3; ++a)
+            centroids[3 * i + a] = 0.5f * (bounds[6 * i + a] + bounds[6 * i + 3 + a]);
+        scene.grow(&bounds[6 * i], &bounds[6 * i + 3]);
+    }
+    // covers the rounding of the box test and of Moller-Trumbore's t
+    float extent = 0, largest = 0;
+    for (int a = 0; a < 3; ++a) {
+        extent = std::max(extent, scene.upper[a] - scene.lower[a]);
+        largest = std::max(largest, std::max(std::fabs(scene.lower[a]), std::fabs(scene.upper[a])));
+    }
+    float padding = BVH_PADDING * (extent + largest);
+
+    // depth first, so a node's left child is the next node
+    std::vector<BuildTask> tasks(1, BuildTask{0, count, 1, -1});
+    while (!tasks.empty()) {
+        BuildTask task = tasks.back();
+        tasks.pop_back();
+        int index = (int)nodes.size();
+        if (task.parent >= 0)
+            nodes[task.parent].first = index;
+
+        Box box, centroidBox;
+        for (int s = task.begin; s < task.end; ++s) {
+            int triangle = order[s];
+            box.grow(&bounds[6 * triangle], &bounds[6 * triangle + 3]);
+            centroidBox.grow(&centroids[3 * triangle], &centroids[3 * triangle]);
+        }
+        BvhNode node;
+        for (int a = 0; a < 3; ++a) {
+            node.lower[a] = box.lower[a] - padding;
+            node.upper[a] = box.upper[a] + padding;
+        }
+        node.first = task.begin;
+        node.count = task.end - task.begin;
+        nodes.push_back(node);
+
+        int mid = task.begin;
+        if (node.count > 1 && task.depth < BVH_SAH_DEPTH)
+            mid = splitSah(order, bounds, centroids, box, centroidBox, task.begin, task.end);
+        else if (node.count > BVH_LEAF_SIZE)
+            mid = splitMedian(order, centroids, centroidBox, task.begin, task.end);
+        if (mid == task.begin)
+            continue;
+
+        nodes[index].count = 0;
+        tasks.push_back(BuildTask{mid, task.end, task.depth + 1, index});
+        tasks.push_back(BuildTask{task.begin, mid, task.depth + 1, -1});
+    }
+}
+
+uint64_t geometryHash(const Scene &scene)
+{
+    Checksum hash;
+    // a compact scene is keyed by its quantized vertices, which the BVH is built from
+    if (scene.compact.active) {
+        hash.update(scene.compact.positions.data(), scene.compact.positions.size() * sizeof(uint16_t));
+        hash.update(scene.compact.blocks.data(), scene.compact.blocks.size() * sizeof(float));
+    } else {
+        hash.update(scene.vertex_data.data(), scene.vertex_data.size() * sizeof(Vec3f));
+    }
+    // faces are hashed unpacked, a chunk at a time
+    Face chunk[256];
+    for (const Mesh &mesh : scene.meshes) {
+        uint64_t faces = mesh.faces.size();
+        hash.update(&faces, sizeof(faces));
+        for (size_t first = 0; first < mesh.faces.size(); first += 256) {
+            size_t count = std::min(mesh.faces.size() - first, (size_t)256);
+            for (size_t i = 0; i < count; ++i)
+                chunk[i] = mesh.faces[first + i];
+            hash.update(chunk, count * sizeof(Face));
+        }
+    }
+    return hash.value();
+}
+
+bool loadBvhCache(const std::string &path, uint64_t key, int triangleCount, std::vector<BvhNode> &nodes, std::vector<int> &order)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(CacheHeader))
+        return false;
+    const unsigned char *data = file.data();
+    size_t size = file.size();
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == BVH_CACHE_VERSION && header.key == key &&
+                 header.triangleCount == (uint32_t)triangleCount && header.nodeCount <= size / sizeof(BvhNode) &&
+                 size == orderOffset(header.nodeCount) + (size_t)triangleCount * sizeof(int);
+    if (valid) {
+        Checksum checksum;
+        checksum.update(data + sizeof(header), size - sizeof(header));
+        valid = checksum.value() == header.checksum;
+    }
+    if (valid) {
+        const BvhNode *first = (const BvhNode *)(data + sizeof(header));
+        const int *slots = (const int *)(data + orderOffset(header.nodeCount));
+        nodes.assign(first, first + header.nodeCount);
+        order.assign(slots, slots + triangleCount);
+        valid = validBvh(nodes, order, triangleCount);
+    }
+    return valid;
+}
+
+bool saveBvhCache(const std::string &path, uint64_t key, int triangleCount, const std::vector<BvhNode> &nodes, const std::vector<int> &order)
+{
+    static const char zeros[64] = {};
+    size_t nodeBytes = nodes.size() * sizeof(BvhNode);
+    size_t padding = orderOffset(nodes.size()) - sizeof(CacheHeader) - nodeBytes;
+
+    CacheHeader header = {};
+    memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = BVH_CACHE_VERSION;
+    header.triangleCount = triangleCount;
+    header.key = key;
+    header.nodeCount = (uint32_t)nodes.size();
+    Checksum checksum;
+    checksum.update(nodes.data(), nodeBytes);
+    checksum.update(zeros, padding);
+    checksum.update(order.data(), order.size() * sizeof(int));
+    header.checksum = checksum.value();
+
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(nodes.data(), 1, nodeBytes, file) == nodeBytes &&
+                   fwrite(zeros, 1, padding, file) == padding &&
+                   fwrite(order.data(), sizeof(int), order.size(), file) == order.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
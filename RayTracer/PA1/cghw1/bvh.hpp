@@ -0,0 +1,32 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "parser.hpp"
+#include "kernels.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bounding volume hierarchy over the compiled triangles, built with a binned
+// surface area heuristic. The build is deterministic, so the same geometry
+// always gives the same hierarchy and it can be cached on disk.
+const int BVH_LEAF_SIZE = 8;        // most triangles in a leaf
+const int BVH_SAH_BINS = 16;
+const int BVH_SAH_DEPTH = 32;       // deeper nodes are split at the median, which bounds the depth
+const float BVH_PADDING = 1e-4f;    // box padding, relative to the scene extent
+
+// bounds holds lower x, y, z and upper x, y, z per triangle. order receives
+// the triangle in each slot; leaves index slots.
+void buildBvh(const std::vector<float> &bounds, std::vector<BvhNode> &nodes, std::vector<int> &order);
+
+// Key of the cache file: the vertices (quantized ones for a compact scene)
+// and every mesh's faces.
+uint64_t geometryHash(const parser::Scene &scene);
+
+// The cache file is only used when its key, triangle count, checksum and
+// structure all check out. Writing goes through a temporary file that is
+// renamed over path, so concurrent runs never see a partial file.
+bool loadBvhCache(const std::string &path, uint64_t key, int triangleCount, std::vector<BvhNode> &nodes, std::vector<int> &order);
+bool saveBvhCache(const std::string &path, uint64_t key, int triangleCount, const std::vector<BvhNode> &nodes, const std::vector<int> &order);
+
+#endif
@@ -0,0 +1,244 @@
+#include "checkpoint.hpp"
+#include "bvh.hpp"
+#include "checksum.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+using namespace parser;
+
+namespace
+{
+    /*
+     * Checkpoint file: CheckpointHeader, the tile mask (one byte per kernel
+     * tile), the frame's RGB bytes and, after the first sample, the RGB sums
+     * as floats. The checksum covers everything after the header.
+     */
+    const char CHECKPOINT_MAGIC[8] = {'H', 'W', '1', 'C', 'K', 'P', 'T', 0};
+    const uint32_t CHECKPOINT_VERSION = 1;
+
+    struct CheckpointHeader
+    {
+        char magic[8];
+        uint32_t version;
+        int32_t width, height;
+        int32_t samples;
+        uint32_t tileCount;
+        uint32_t reserved;
+        uint64_t sceneKey;
+        uint64_t cameraKey;
+        uint64_t checksum;
+        char padding[8];
+    };
+
+    static_assert(sizeof(CheckpointHeader) == 64, "CheckpointHeader layout");
+
+    size_t tileCount(int width, int height)
+    {
+        return (size_t)((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+    }
+
+    void hashVec(Checksum &hash, const Vec3f &v)
+    {
+        hash.update(&v.x, sizeof(float));
+        hash.update(&v.y, sizeof(float));
+        hash.update(&v.z, sizeof(float));
+    }
+}
+
+uint64_t sceneHash(const Scene &scene)
+{
+    Checksum hash;
+    uint64_t geometry = geometryHash(scene);
+    hash.update(&geometry, sizeof(geometry));
+    if (scene.compact.active) {
+        hash.update(scene.compact.texcoords.data(), scene.compact.texcoords.size() * sizeof(scene.compact.texcoords[0]));
+        hash.update(scene.compact.normals.data(), scene.compact.normals.size() * sizeof(scene.compact.normals[0]));
+    } else {
+        hash.update(scene.texture_data.data(), scene.texture_data.size() * sizeof(Vec3f));
+        hash.update(scene.normal_data.data(), scene.normal_data.size() * sizeof(Vec3f));
+    }
+    for (const Mesh &mesh : scene.meshes)
+        hash.update(&mesh.material_id, sizeof(mesh.material_id));
+    for (const Material &material : scene.materials) {
+        hashVec(hash, material.ambient);
+        hashVec(hash, material.diffuse);
+        hashVec(hash, material.specular);
+        hashVec(hash, material.mirror_reflactance);
+        hash.update(&material.phong_exponent, sizeof(float));
+        hash.update(&material.texture_factor, sizeof(float));
+    }
+    for (const PointLight &light : scene.point_lights) {
+        hashVec(hash, light.position);
+        hashVec(hash, light.intensity);
+    }
+    for (const TriangularLight &light : scene.triangular_lights) {
+        hashVec(hash, light.vertex1);
+        hashVec(hash, light.vertex2);
+        hashVec(hash, light.vertex3);
+        hashVec(hash, light.intensity);
+    }
+    int settings[4] = {scene.background_color.x, scene.background_color.y, scene.background_color.z, scene.maxraytracedepth};
+    hash.update(settings, sizeof(settings));
+    hashVec(hash, scene.ambient_light);
+    return hash.value();
+}
+
+uint64_t cameraHash(const Camera &camera)
+{
+    Checksum hash;
+    hashVec(hash, camera.position);
+    hashVec(hash, camera.gaze);
+    hashVec(hash, camera.up);
+    float plane[5] = {camera.near_plane.x, camera.near_plane.y, camera.near_plane.z, camera.near_plane.w, camera.near_distance};
+    hash.update(plane, sizeof(plane));
+    int size[2] = {camera.image_width, camera.image_height};
+    hash.update(size, sizeof(size));
+    return hash.value();
+}
+
+void captureFrame(const TileProgress &progress, const unsigned char *frame, int width, int height, Checkpoint &checkpoint)
+{
+    checkpoint.tiles = progress.finished();
+    checkpoint.image.assign((size_t)width * height * 3, 0);
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    for (size_t tile = 0; tile < checkpoint.tiles.size(); ++tile) {
+        if (!checkpoint.tiles[tile])
+            continue;
+        int x0 = (int)(tile % tilesX) * TILE_SIZE, y0 = (int)(tile / tilesX) * TILE_SIZE;
+        int x1 = std::min(x0 + TILE_SIZE, width), y1 = std::min(y0 + TILE_SIZE, height);
+        for (int y = y0; y < y1; ++y) {
+            size_t offset = ((size_t)y * width + x0) * 3;
+            std::memcpy(&checkpoint.image[offset], frame + offset, (size_t)(x1 - x0) * 3);
+        }
+    }
+}
+
+bool saveCheckpoint(const std::string &path, const Checkpoint &checkpoint)
+{
+    size_t sumCount = checkpoint.samples > 0 ? checkpoint.sum.size() : 0;
+
+    CheckpointHeader header = {};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.width = checkpoint.width;
+    header.height = checkpoint.height;
+    header.samples = checkpoint.samples;
+    header.tileCount = (uint32_t)checkpoint.tiles.size();
+    header.sceneKey = checkpoint.sceneKey;
+    header.cameraKey = checkpoint.cameraKey;
+    Checksum checksum;
+    checksum.update(checkpoint.tiles.data(), checkpoint.tiles.size());
+    checksum.update(checkpoint.image.data(), checkpoint.image.size());
+    checksum.update(checkpoint.sum.data(), sumCount * sizeof(float));
+    header.checksum = checksum.value();
+
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(checkpoint.tiles.data(), 1, checkpoint.tiles.size(), file) == checkpoint.tiles.size() &&
+                   fwrite(checkpoint.image.data(), 1, checkpoint.image.size(), file) == checkpoint.image.size() &&
+                   fwrite(checkpoint.sum.data(), sizeof(float), sumCount, file) == sumCount;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool loadCheckpoint(const std::string &path, uint64_t sceneKey, uint64_t cameraKey, Checkpoint &checkpoint, std::string &error)
+{
+    MappedFile file;
+    CheckpointHeader header;
+    if (!file.open(path) || file.size() < sizeof(header) ||
+        memcmp(file.data(), CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.version != CHECKPOINT_VERSION) {
+        error = path + " was written by another version";
+        return false;
+    }
+    if (header.sceneKey != sceneKey) {
+        error = path + " was written for a different scene";
+        return false;
+    }
+    if (header.cameraKey != cameraKey) {
+        error = path + " was written for a different camera";
+        return false;
+    }
+
+    // the camera key covers the resolution
+    size_t pixels = (size_t)header.width * header.height * 3;
+    size_t sums = header.samples > 0 ? pixels : 0;
+    bool valid = header.width > 0 && header.height > 0 && header.samples >= 0 &&
+                 (header.tileCount == 0 || header.tileCount == tileCount(header.width, header.height)) &&
+                 file.size() == sizeof(header) + header.tileCount + pixels + sums * sizeof(float);
+    if (valid) {
+        Checksum checksum;
+        checksum.update(file.data() + sizeof(header), file.size() - sizeof(header));
+        valid = checksum.value() == header.checksum;
+    }
+    if (!valid) {
+        error = path + " is damaged";
+        return false;
+    }
+
+    const unsigned char *next = file.data() + sizeof(header);
+    checkpoint.sceneKey = sceneKey;
+    checkpoint.cameraKey = cameraKey;
+    checkpoint.width = header.width;
+    checkpoint.height = header.height;
+    checkpoint.samples = header.samples;
+    checkpoint.tiles.assign(next, next + header.tileCount);
+    next += header.tileCount;
+    checkpoint.image.assign(next, next + pixels);
+    next += pixels;
+    checkpoint.sum.resize(sums);
+    memcpy(checkpoint.sum.data(), next, sums * sizeof(float));
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string &path, double interval, const Checkpoint &keys)
+    : path(path), interval(interval), checkpoint(keys), last(std::chrono::steady_clock::now())
+{
+}
+
+void CheckpointWriter::tick()
+{
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (lock.owns_lock() && std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count() >= interval)
+        write();
+}
+
+bool CheckpointWriter::save()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return write();
+}
+
+void CheckpointWriter::discard()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    remove(path.c_str());
+}
+
+bool CheckpointWriter::write()
+{
+    if (capture)
+        capture(checkpoint);
+    last = std::chrono::steady_clock::now();
+    if (!saveCheckpoint(path, checkpoint)) {
+        std::cerr << "Warning: cannot write checkpoint " << path << std::endl;
+        return false;
+    }
+    ++count;
+    return true;
+}
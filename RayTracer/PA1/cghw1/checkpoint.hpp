@@ -0,0 +1,77 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "parser.hpp"
+#include "render.hpp"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// State of a whole-frame render that was interrupted: the frames a
+// progressive render has accumulated and the finished tiles of the frame it
+// was rendering (for a plain render, the only frame). Keyed by hashes of the
+// scene and the camera, so it is never resumed into a different image.
+struct Checkpoint
+{
+    uint64_t sceneKey = 0;
+    uint64_t cameraKey = 0;
+    int width = 0, height = 0;
+    int samples = 0;                    // whole frames summed in sum
+    std::vector<float> sum;             // RGB per pixel, empty without samples
+    std::vector<unsigned char> tiles;   // finished kernel tiles of the frame in flight
+    std::vector<unsigned char> image;   // that frame; pixels of other tiles are black
+};
+
+// Everything apart from the camera that the image depends on: geometry
+// (quantized when compact), texture coordinates, normals, materials,
+// lights, background, ambient light and recursion depth.
+uint64_t sceneHash(const parser::Scene &scene);
+// Position, orientation, image plane and resolution.
+uint64_t cameraHash(const parser::Camera &camera);
+
+// Copies the finished tiles of frame (width * height RGB bytes) and their
+// mask into checkpoint.
+void captureFrame(const TileProgress &progress, const unsigned char *frame, int width, int height, Checkpoint &checkpoint);
+
+// Writing goes through a temporary file renamed over path, so an interrupted
+// write leaves the previous checkpoint intact.
+bool saveCheckpoint(const std::string &path, const Checkpoint &checkpoint);
+// false, with the reason in error, unless path holds an intact checkpoint
+// for this scene and camera.
+bool loadCheckpoint(const std::string &path, uint64_t sceneKey, uint64_t cameraKey, Checkpoint &checkpoint, std::string &error);
+
+// Saves checkpoints of a running render. tick() is meant for
+// TileProgress::onTile: once interval seconds have passed since the last
+// save, the thread that gets there first writes one while the others keep
+// rendering. capture fills in the render's state; the keys and the frame
+// size are set by the caller.
+class CheckpointWriter
+{
+public:
+    CheckpointWriter(const std::string &path, double interval, const Checkpoint &keys);
+
+    std::function<void(Checkpoint &)> capture;
+
+    void tick();
+    bool save();
+    // removes the file once the render is complete
+    void discard();
+
+    int saves() const { return count; }
+    const std::string &file() const { return path; }
+
+private:
+    bool write();
+
+    std::string path;
+    double interval;
+    Checkpoint checkpoint;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point last;
+    int count = 0;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// FNV-1a over 8-byte words, fast enough for multi-GB files. Bytes may
+// arrive in pieces of any size; the value only depends on their sequence.
+class Checksum
+{
+public:
+    void update(const void *bytes, size_t size)
+    {
+        const unsigned char *data = (const unsigned char *)bytes;
+        while (size > 0 && (pending > 0 || size < 8)) {
+            tail[pending++] = *data++;
+            --size;
+            if (pending == 8) {
+                mix(tail);
+                pending = 0;
+            }
+        }
+        for (; size >= 8; data += 8, size -= 8)
+            mix(data);
+        for (; size > 0; --size)
+            tail[pending++] = *data++;
+    }
+
+    uint64_t value() const
+    {
+        uint64_t result = hash;
+        for (size_t i = 0; i < pending; ++i)
+            result = (result ^ tail[i]) * 0x100000001b3ULL;
+        return result;
+    }
+
+private:
+    void mix(const unsigned char *bytes)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 32;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    unsigned char tail[8];
+    size_t pending = 0;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include "parser.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace parser;
+
+
+static float signOf(float value)
+{
+    return value >= 0 ? 1.0f : -1.0f;
+}
+
+// Nearest half float, ties to even; too large values become infinity.
+static uint16_t encodeHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+    if (magnitude > 0x7f800000)
+        return sign | 0x7e00;
+    if (magnitude >= 0x477ff000)     // 65520 rounds past the largest half
+        return sign | 0x7c00;
+    if (magnitude < 0x38800000)      // below 2^-14 the half is subnormal
+        return sign | (uint16_t)std::lrint(std::fabs(value) * 16777216.0f);
+    magnitude += 0xfff + ((magnitude >> 13) & 1);
+    return sign | (uint16_t)((magnitude - 0x38000000) >> 13);
+}
+
+static float decodeHalf(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff;
+    if (exponent == 0) {
+        float value = mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    uint32_t bits = sign | (exponent == 31 ? 0x7f800000 | mantissa << 13 : (exponent + 112) << 23 | mantissa << 13);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Octahedral map: the direction is projected onto |x| + |y| + |z| = 1 and
+// the lower half folded over the diagonals, giving two coordinates in [-1, 1].
+static uint32_t encodeNormal(const Vec3f &normal)
+{
+    float sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (!(sum > 0) || !std::isfinite(sum))
+        return COMPACT_ZERO_NORMAL;
+    float x = normal.x / sum, y = normal.y / sum;
+    if (normal.z < 0) {
+        float folded = (1 - std::fabs(y)) * signOf(x);
+        y = (1 - std::fabs(x)) * signOf(y);
+        x = folded;
+    }
+    uint16_t qx = (uint16_t)(int16_t)std::lrint(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f);
+    uint16_t qy = (uint16_t)(int16_t)std::lrint(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f);
+    return qx | (uint32_t)qy << 16;
+}
+
+vecmath::Vec3<float> decodeNormal(uint32_t code)
+{
+    if (code == COMPACT_ZERO_NORMAL)
+        return Vec3f{0, 0, 0};
+    float x = (int16_t)(code & 0xffff) / 32767.0f;
+    float y = (int16_t)(code >> 16) / 32767.0f;
+    float z = 1 - std::fabs(x) - std::fabs(y);
+    if (z < 0) {
+        float unfolded = (1 - std::fabs(y)) * signOf(x);
+        y = (1 - std::fabs(x)) * signOf(y);
+        x = unfolded;
+    }
+    return normalize(Vec3f{x, y, z});
+}
+
+vecmath::Vec3<float> decodeTexcoord(uint32_t code)
+{
+    return Vec3f{decodeHalf(code & 0xffff), decodeHalf(code >> 16), 0};
+}
+
+static float axis(const Vec3f &v, int a)
+{
+    return a == 0 ? v.x : a == 1 ? v.y : v.z;
+}
+
+// Each block stores its lower corner and the step between quantization
+// levels; a flat axis has step 0 and every coordinate decodes to the corner.
+static void quantizePositions(const SceneVector<Vec3f> &vertices, CompactGeometry &compact)
+{
+    size_t count = vertices.size();
+    compact.positions.resize(count * 3);
+    compact.blocks.resize((count + COMPACT_BLOCK_SIZE - 1) / COMPACT_BLOCK_SIZE * 6);
+    for (size_t begin = 0; begin < count; begin += COMPACT_BLOCK_SIZE) {
+        size_t end = std::min(begin + COMPACT_BLOCK_SIZE, count);
+        float *block = &compact.blocks[begin / COMPACT_BLOCK_SIZE * 6];
+        for (int a = 0; a < 3; ++a) {
+            float lower = axis(vertices[begin], a), upper = lower;
+            for (size_t i = begin; i < end; ++i) {
+                lower = std::min(lower, axis(vertices[i], a));
+                upper = std::max(upper, axis(vertices[i], a));
+            }
+            float step = (upper - lower) / 65535.0f;
+            block[a] = lower;
+            block[3 + a] = std::isfinite(step) ? step : 0;
+            for (size_t i = begin; i < end; ++i) {
+                float level = block[3 + a] > 0 ? (axis(vertices[i], a) - lower) / block[3 + a] : 0;
+                compact.positions[i * 3 + a] = (uint16_t)std::lrint(std::isfinite(level) ? std::min(std::max(level, 0.0f), 65535.0f) : 0.0f);
+            }
+        }
+    }
+}
+
+void Scene::compactGeometry()
+{
+    if (compact.active)
+        return;
+    useArena(compact.positions, arena, vertex_data.size() * 3);
+    useArena(compact.blocks, arena, (vertex_data.size() + COMPACT_BLOCK_SIZE - 1) / COMPACT_BLOCK_SIZE * 6);
+    useArena(compact.normals, arena, normal_data.size());
+    useArena(compact.texcoords, arena, texture_data.size());
+    quantizePositions(vertex_data, compact);
+    compact.normals.resize(normal_data.size());
+    for (size_t i = 0; i < normal_data.size(); ++i)
+        compact.normals[i] = encodeNormal(normal_data[i]);
+    compact.texcoords.resize(texture_data.size());
+    for (size_t i = 0; i < texture_data.size(); ++i)
+        compact.texcoords[i] = encodeHalf(texture_data[i].x) | (uint32_t)encodeHalf(texture_data[i].y) << 16;
+    compact.active = true;
+
+    // the arena hands the pages of the float arrays back to the system
+    SceneVector<Vec3f>().swap(vertex_data);
+    SceneVector<Vec3f>().swap(texture_data);
+    SceneVector<Vec3f>().swap(normal_data);
+}
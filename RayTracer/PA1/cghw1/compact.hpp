@@ -0,0 +1,44 @@
+#ifndef COMPACT_HPP
+#define COMPACT_HPP
+
+#include "vecmath.hpp"
+#include "arena.hpp"
+#include <cstdint>
+
+// Opt-in compact storage of the vertex, normal and texture arrays (see
+// Scene::compactGeometry()). Positions are quantized to 16 bits per axis within
+// blocks of COMPACT_BLOCK_SIZE consecutive vertices, so every vertex has one
+// encoding and triangles sharing it stay watertight.
+const int COMPACT_BLOCK_SIZE = 256;
+const uint32_t COMPACT_ZERO_NORMAL = 0x80008000u;  // code of the zero normal
+
+struct CompactGeometry
+{
+    bool active = false;
+    SceneVector<uint16_t> positions;    // x, y, z per vertex, relative to its block
+    SceneVector<float> blocks;          // lower x, y, z and step x, y, z per block
+    SceneVector<uint32_t> normals;      // octahedral, 16 bits per coordinate
+    SceneVector<uint32_t> texcoords;    // u and v as half floats
+
+    size_t bytes() const
+    {
+        return positions.size() * sizeof(uint16_t) + blocks.size() * sizeof(float) +
+               (normals.size() + texcoords.size()) * sizeof(uint32_t);
+    }
+};
+
+// Force-inlined so kernels.cpp can decode with its own instruction set (see
+// the note at the top of that file); index is 0-based.
+VECMATH_INLINE vecmath::Vec3<float> decodePosition(const uint16_t *positions, const float *blocks, int index)
+{
+    const uint16_t *q = positions + (size_t)index * 3;
+    const float *block = blocks + (size_t)(index / COMPACT_BLOCK_SIZE) * 6;
+    return vecmath::Vec3<float>{block[0] + q[0] * block[3], block[1] + q[1] * block[4], block[2] + q[2] * block[5]};
+}
+
+// unit vector, or zero for COMPACT_ZERO_NORMAL
+vecmath::Vec3<float> decodeNormal(uint32_t code);
+// u, v and a zero z, as in the scene's texture array
+vecmath::Vec3<float> decodeTexcoord(uint32_t code);
+
+#endif
@@ -0,0 +1,205 @@
+#include "kernels.hpp"
+#include "bvh.hpp"
+#include <algorithm>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_X86_KERNELS
+#endif
+
+using namespace parser;
+
+
+KernelScene CompiledScene::view() const
+{
+    KernelScene view;
+    view.triangleCount = (int)triangleOrder.size();
+    view.triangles = triangles.empty() ? 0 : &triangles[0];
+    view.corners = corners.empty() ? 0 : &corners[0];
+    view.positions = compact && !compact->positions.empty() ? &compact->positions[0] : 0;
+    view.blocks = compact && !compact->blocks.empty() ? &compact->blocks[0] : 0;
+    view.triangleIndex = triangleOrder.empty() ? 0 : &triangleOrder[0];
+    view.nodeCount = (int)nodes.size();
+    view.nodes = nodes.empty() ? 0 : &nodes[0];
+    view.lightCount = (int)lights.size();
+    view.lights = lights.empty() ? 0 : &lights[0];
+    return view;
+}
+
+int classifyMaterial(const Material &material)
+{
+    int features = 0;
+    if (material.texture_factor != 0)
+        features |= MATERIAL_TEXTURED;
+    if (material.specular.x != 0 || material.specular.y != 0 || material.specular.z != 0)
+        features |= MATERIAL_SPECULAR;
+    if (material.mirror_reflactance.x > 0 || material.mirror_reflactance.y > 0 ||
+        material.mirror_reflactance.z > 0)
+        features |= MATERIAL_MIRROR;
+    return features;
+}
+
+void compileScene(const Scene &scene, CompiledScene &compiled, const std::string &bvhCache)
+{
+    int count = 0;
+    for (const Mesh &mesh : scene.meshes)
+        count += (int)mesh.faces.size();
+    int padded = (count + 2 * KERNEL_TRIANGLE_PAD - 1) / KERNEL_TRIANGLE_PAD * KERNEL_TRIANGLE_PAD;
+
+    compiled.triangleCount = count;
+    compiled.triangleMesh.resize(count);
+    compiled.triangleFace.resize(count);
+    // a compact scene keeps only the corner indices, decoded in the kernels
+    compiled.compact = scene.compact.active ? &scene.compact : 0;
+    std::vector<float> values(compiled.compact ? 0 : (size_t)count * 9), bounds((size_t)count * 6);
+    int i = 0;
+    for (int m = 0; m < (int)scene.meshes.size(); ++m) {
+        const Mesh &mesh = scene.meshes[m];
+        for (int f = 0; f < (int)mesh.faces.size(); ++f, ++i) {
+            Face face = mesh.faces[f];
+            Vec3f v0 = scene.vertex(face.v1_id);
+            Vec3f edge1 = scene.vertex(face.v2_id) - v0;
+            Vec3f edge2 = scene.vertex(face.v3_id) - v0;
+            float triangle[9] = {v0.x, v0.y, v0.z, edge1.x, edge1.y, edge1.z, edge2.x, edge2.y, edge2.z};
+            if (!compiled.compact)
+                std::copy(triangle, triangle + 9, &values[(size_t)i * 9]);
+            // bounds of the corners as the kernels see them
+            for (int a = 0; a < 3; ++a) {
+                float corners[3] = {triangle[a], triangle[a] + triangle[3 + a], triangle[a] + triangle[6 + a]};
+                bounds[(size_t)i * 6 + a] = *std::min_element(corners, corners + 3);
+                bounds[(size_t)i * 6 + 3 + a] = *std::max_element(corners, corners + 3);
+            }
+            compiled.triangleMesh[i] = m;
+            compiled.triangleFace[i] = f;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> order;
+    BvhCacheInfo &info = compiled.bvhCache;
+    info = BvhCacheInfo();
+    info.path = bvhCache;
+    uint64_t key = bvhCache.empty() ? 0 : geometryHash(scene);
+    info.hit = !bvhCache.empty() && loadBvhCache(bvhCache, key, count, compiled.nodes, order);
+    if (!info.hit) {
+        buildBvh(bounds, compiled.nodes, order);
+        info.written = !bvhCache.empty() && saveBvhCache(bvhCache, key, count, compiled.nodes, order);
+    }
+    info.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // padding triangles are all zero (all corners on vertex 0 when compact) and never hit
+    compiled.triangles.assign(compiled.compact ? 0 : (size_t)padded * 9, 0.0f);
+    compiled.corners.assign(compiled.compact ? (size_t)padded * 3 : 0, 0);
+    compiled.triangleOrder.assign(padded, -1);
+    for (int slot = 0; slot < count; ++slot) {
+        int triangle = order[slot];
+        if (compiled.compact) {
+            Face face = scene.meshes[compiled.triangleMesh[triangle]].faces[compiled.triangleFace[triangle]];
+            compiled.corners[slot] = face.v1_id - 1;
+            compiled.corners[(size_t)padded + slot] = face.v2_id - 1;
+            compiled.corners[(size_t)2 * padded + slot] = face.v3_id - 1;
+        } else {
+            for (int c = 0; c < 9; ++c)
+                compiled.triangles[(size_t)c * padded + slot] = values[(size_t)triangle * 9 + c];
+        }
+        compiled.triangleOrder[slot] = triangle;
+    }
+
+    compileLights(scene, compiled);
+
+    compiled.materialClass.clear();
+    for (const Material &material : scene.materials)
+        compiled.materialClass.push_back(classifyMaterial(material));
+}
+
+void compileLights(const Scene &scene, CompiledScene &compiled)
+{
+    compiled.lights.clear();
+    for (const PointLight &pointLight : scene.point_lights) {
+        KernelLight light;
+        light.position = pointLight.position;
+        light.intensity = pointLight.intensity;
+        compiled.lights.push_back(light);
+    }
+}
+
+
+struct KernelVariant
+{
+    const char *alias;
+    const RenderKernels *kernels;
+    bool (*supported)();
+};
+
+#ifdef RT_X86_KERNELS
+static bool cpuHasSse2() { return true; }
+static bool cpuHasSse42()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+}
+static bool cpuHasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+static bool cpuHasAvx512()
+{
+    __builtin_cpu_init();
+    return cpuHasAvx2() && __builtin_cpu_supports("avx512f");
+}
+
+// best first
+static const KernelVariant variants[] = {
+    {"avx512", &kernels_avx512, cpuHasAvx512},
+    {"avx2", &kernels_avx2, cpuHasAvx2},
+    {"sse4.2", &kernels_sse42, cpuHasSse42},
+    {"sse2", &kernels_sse2, cpuHasSse2},
+};
+#else
+static bool cpuHasGeneric() { return true; }
+
+static const KernelVariant variants[] = {
+    {"generic", &kernels_generic, cpuHasGeneric},
+};
+#endif
+
+static const RenderKernels *selected = 0;
+
+static const RenderKernels *bestKernels()
+{
+    for (const KernelVariant &variant : variants)
+        if (variant.supported())
+            return variant.kernels;
+    return variants[sizeof(variants) / sizeof(variants[0]) - 1].kernels;
+}
+
+const RenderKernels &activeKernels()
+{
+    if (!selected)
+        selected = bestKernels();
+    return *selected;
+}
+
+bool selectKernels(const std::string &isa, std::string &error)
+{
+    if (isa.empty() || isa == "auto") {
+        selected = bestKernels();
+        return true;
+    }
+    for (const KernelVariant &variant : variants) {
+        if (isa == variant.alias || isa == variant.kernels->name) {
+            if (!variant.supported()) {
+                error = "this CPU does not support " + isa;
+                return false;
+            }
+            selected = variant.kernels;
+            return true;
+        }
+    }
+
+    error = "unknown instruction set '" + isa + "', expected auto";
+    for (const KernelVariant &variant : variants)
+        error += std::string(", ") + variant.alias;
+    return false;
+}
@@ -0,0 +1,482 @@
+#include "distributed.hpp"
+#include "net.hpp"
+#include "render.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace parser;
+
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct Tile
+    {
+        int x0, y0, x1, y1;
+        bool done = false;
+        int copies = 0;             // workers it is out with
+    };
+
+    struct Issue
+    {
+        int tile;
+        Clock::time_point start;
+    };
+
+    struct Remote
+    {
+        int id;
+        int fd;
+        std::string input;          // received and not handled yet
+        bool ready = false;
+        bool broken = false;
+        int payloadTile = -1;       // tile whose pixels are arriving
+        size_t payload = 0;
+        std::vector<Issue> issued;
+        int tilesDone = 0;
+    };
+
+    class Coordinator
+    {
+    public:
+        explicit Coordinator(const CoordinatorOptions &options) : options(options) {}
+        int run(const std::string &scenePath);
+
+    private:
+        void accept();
+        bool receive(Remote &remote);
+        bool startFrame(Remote &remote, int width, int height, const std::string &output);
+        void storeTile(Remote &remote, int tile, const char *pixels);
+        void drop(Remote &remote);
+        void assign();
+        int nextTile(const Remote &remote);
+        int runningChildren();
+        void stopChildren();
+
+        CoordinatorOptions options;
+        int listener = -1;
+        std::string scenePath;
+        std::vector<pid_t> children;
+        std::vector<Remote> remotes;
+        int nextRemote = 1;
+
+        int width = 0, height = 0;
+        std::string output;
+        std::vector<unsigned char> image;
+        std::vector<Tile> tiles;
+        std::deque<int> pending;
+        int remaining = -1;         // tiles not done yet, -1 before the first worker is ready
+        double tileSeconds = 0;     // summed over the tiles done
+        int reissued = 0, speculative = 0;
+    };
+}
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static pid_t spawnWorker(const std::string &address, const CoordinatorOptions &options)
+{
+    int threads = options.threads;
+    if (threads <= 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency() / options.spawn);
+    std::string threadArg = "--threads=" + std::to_string(threads), isaArg = "--isa=" + options.isa;
+    pid_t pid = fork();
+    if (pid == 0) {
+        const char *args[] = {"program", "worker", address.c_str(), threadArg.c_str(), isaArg.c_str(), 0};
+        execv("/proc/self/exe", (char *const *)args);
+        _exit(127);
+    }
+    return pid;
+}
+
+int Coordinator::run(const std::string &path)
+{
+    std::string address = options.listen.empty() ? "/tmp/raytracer-coordinator-" + std::to_string(getpid()) + ".sock" : options.listen;
+    std::string bound, error;
+    listener = listenOn(address, bound, error);
+    if (listener < 0) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    // workers resolve the scene on their own, so give them an absolute path
+    char *absolute = realpath(path.c_str(), 0);
+    scenePath = absolute ? absolute : path;
+    free(absolute);
+
+    // spawned workers reach a wildcard TCP address through the loopback
+    std::string local = bound;
+    if (bound[0] == ':' || bound.compare(0, 8, "0.0.0.0:") == 0 || bound.compare(0, 5, "[::]:") == 0)
+        local = "localhost" + bound.substr(bound.rfind(':'));
+    for (int i = 0; i < options.spawn; ++i) {
+        pid_t pid = spawnWorker(local, options);
+        if (pid > 0)
+            children.push_back(pid);
+        else
+            perror("Error: cannot start a worker");
+    }
+    std::cout << "Coordinator listening on " << bound << ", " << children.size() << " local workers started" << std::endl;
+
+    auto start = Clock::now();
+    int status = 0, reported = 0;
+    while (remaining != 0) {
+        std::vector<pollfd> fds(1, pollfd{listener, POLLIN, 0});
+        for (const Remote &remote : remotes)
+            fds.push_back(pollfd{remote.fd, POLLIN, 0});
+        // wakes up regularly to look for slow tiles
+        if (poll(&fds[0], fds.size(), 100) < 0 && errno != EINTR) {
+            perror("Error: poll failed");
+            status = 1;
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+            accept();
+        for (size_t i = 1; i < fds.size(); ++i) {
+            Remote &remote = remotes[i - 1];
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            char buffer[65536];
+            ssize_t count = recv(remote.fd, buffer, sizeof(buffer), 0);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0) {
+                remote.broken = true;
+                continue;
+            }
+            remote.input.append(buffer, count);
+            if (!receive(remote))
+                remote.broken = true;
+        }
+        for (size_t i = 0; i < remotes.size();) {
+            if (remotes[i].broken) {
+                drop(remotes[i]);
+                remotes.erase(remotes.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+        if (remotes.empty() && !children.empty() && runningChildren() == 0) {
+            std::cerr << "Error: every local worker has exited" << std::endl;
+            status = 1;
+            break;
+        }
+        assign();
+
+        if (remaining >= 0 && !tiles.empty() && (tiles.size() - remaining) * 10 / tiles.size() > (size_t)reported) {
+            reported = (int)((tiles.size() - remaining) * 10 / tiles.size());
+            std::cout << "Tiles: " << tiles.size() - remaining << " of " << tiles.size() << " done on " << remotes.size() << " workers" << std::endl;
+        }
+    }
+
+    for (Remote &remote : remotes) {
+        sendLine(remote.fd, "finish");
+        close(remote.fd);
+    }
+    stopChildren();
+    closeListener(listener, address);
+    if (status != 0)
+        return status;
+
+    std::cout << "Rendered " << width << "x" << height << " in " << tiles.size() << " tiles in " << secondsSince(start) << " s ("
+              << reissued << " re-issued from lost workers, " << speculative << " copies of slow tiles)" << std::endl;
+    writePpm(output, image.data(), width, height);
+    return 0;
+}
+
+void Coordinator::accept()
+{
+    int fd = ::accept(listener, 0, 0);
+    if (fd < 0)
+        return;
+    Remote remote;
+    remote.id = nextRemote++;
+    remote.fd = fd;
+    std::ostringstream scene;
+    scene << "scene " << options.hybrid << " " << options.compact << " " << options.bvhCache << " " << scenePath;
+    if (!sendLine(fd, scene.str())) {
+        close(fd);
+        return;
+    }
+    remotes.push_back(remote);
+}
+
+// Handles every complete message in the input; false when the worker failed
+// or broke the protocol.
+bool Coordinator::receive(Remote &remote)
+{
+    while (true) {
+        if (remote.payloadTile >= 0) {
+            if (remote.input.size() < remote.payload)
+                return true;
+            storeTile(remote, remote.payloadTile, remote.input.data());
+            remote.input.erase(0, remote.payload);
+            remote.payloadTile = -1;
+            continue;
+        }
+
+        size_t newline = remote.input.find('\n');
+        if (newline == std::string::npos)
+            return remote.input.size() <= (1 << 16);
+        std::istringstream line(remote.input.substr(0, newline));
+        remote.input.erase(0, newline + 1);
+        std::string kind;
+        line >> kind;
+        if (kind == "ready") {
+            int frameWidth = 0, frameHeight = 0;
+            std::string name;
+            line >> frameWidth >> frameHeight;
+            std::getline(line >> std::ws, name);
+            if (!startFrame(remote, frameWidth, frameHeight, name))
+                return false;
+        } else if (kind == "pixels") {
+            int tile = -1;
+            size_t bytes = 0;
+            line >> tile >> bytes;
+            bool issued = false;
+            for (const Issue &issue : remote.issued)
+                issued = issued || issue.tile == tile;
+            if (!issued || bytes != (size_t)(tiles[tile].x1 - tiles[tile].x0) * (tiles[tile].y1 - tiles[tile].y0) * 3) {
+                std::cerr << "Worker " << remote.id << " sent pixels for a tile it was not given" << std::endl;
+                return false;
+            }
+            remote.payloadTile = tile;
+            remote.payload = bytes;
+        } else {
+            std::string message;
+            std::getline(line >> std::ws, message);
+            std::cerr << "Worker " << remote.id << " failed: " << (kind == "error" ? message : "unexpected reply '" + kind + "'") << std::endl;
+            return false;
+        }
+    }
+}
+
+// The first worker to load the scene decides the frame; the others must agree.
+bool Coordinator::startFrame(Remote &remote, int frameWidth, int frameHeight, const std::string &name)
+{
+    if (remaining < 0) {
+        width = frameWidth;
+        height = frameHeight;
+        output = options.output.empty() ? name : options.output;
+        image.assign((size_t)width * height * 3, 0);
+        int size = (std::max(options.tileSize, 1) + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+        for (int y = 0; y < height; y += size) {
+            for (int x = 0; x < width; x += size) {
+                Tile tile;
+                tile.x0 = x;
+                tile.y0 = y;
+                tile.x1 = std::min(x + size, width);
+                tile.y1 = std::min(y + size, height);
+                pending.push_back((int)tiles.size());
+                tiles.push_back(tile);
+            }
+        }
+        remaining = (int)tiles.size();
+        std::cout << "Frame " << width << "x" << height << " split into " << tiles.size() << " tiles of " << size << " pixels" << std::endl;
+    } else if (frameWidth != width || frameHeight != height) {
+        std::cerr << "Worker " << remote.id << " sees a " << frameWidth << "x" << frameHeight << " frame instead of "
+                  << width << "x" << height << std::endl;
+        return false;
+    }
+    remote.ready = true;
+    std::cout << "Worker " << remote.id << " ready" << std::endl;
+    return true;
+}
+
+void Coordinator::storeTile(Remote &remote, int index, const char *pixels)
+{
+    for (size_t i = 0; i < remote.issued.size(); ++i) {
+        if (remote.issued[i].tile == index) {
+            tileSeconds += secondsSince(remote.issued[i].start);
+            remote.issued.erase(remote.issued.begin() + i);
+            break;
+        }
+    }
+    Tile &tile = tiles[index];
+    --tile.copies;
+    if (tile.done)
+        return;
+    size_t row = (size_t)(tile.x1 - tile.x0) * 3;
+    for (int y = tile.y0; y < tile.y1; ++y)
+        std::memcpy(&image[((size_t)y * width + tile.x0) * 3], pixels + (y - tile.y0) * row, row);
+    tile.done = true;
+    --remaining;
+    ++remote.tilesDone;
+}
+
+void Coordinator::drop(Remote &remote)
+{
+    int lost = 0;
+    for (const Issue &issue : remote.issued) {
+        Tile &tile = tiles[issue.tile];
+        if (--tile.copies == 0 && !tile.done) {
+            pending.push_front(issue.tile);
+            ++lost;
+        }
+    }
+    reissued += lost;
+    close(remote.fd);
+    if (remote.ready)
+        std::cout << "Worker " << remote.id << " lost after " << remote.tilesDone << " tiles, " << lost << " tiles re-issued" << std::endl;
+}
+
+void Coordinator::assign()
+{
+    for (Remote &remote : remotes) {
+        while (remote.ready && !remote.broken && remote.issued.size() < (size_t)DISTRIBUTED_PIPELINE) {
+            int index = nextTile(remote);
+            if (index < 0)
+                break;
+            const Tile &tile = tiles[index];
+            std::ostringstream request;
+            request << "tile " << index << " " << tile.x0 << " " << tile.y0 << " " << tile.x1 << " " << tile.y1;
+            remote.issued.push_back(Issue{index, Clock::now()});
+            ++tiles[index].copies;
+            if (!sendLine(remote.fd, request.str()))
+                remote.broken = true;
+        }
+    }
+}
+
+// A pending tile, or for an idle worker a copy of the tile that has been
+// out longest, if that is already much longer than the average.
+int Coordinator::nextTile(const Remote &remote)
+{
+    while (!pending.empty()) {
+        int index = pending.front();
+        pending.pop_front();
+        if (!tiles[index].done)
+            return index;
+    }
+    int done = (int)tiles.size() - remaining;
+    if (!remote.issued.empty() || done == 0)
+        return -1;
+    double slow = DISTRIBUTED_SLOW_FACTOR * tileSeconds / done;
+    int oldest = -1;
+    double longest = slow;
+    for (const Remote &other : remotes) {
+        for (const Issue &issue : other.issued) {
+            double seconds = secondsSince(issue.start);
+            if (tiles[issue.tile].copies == 1 && !tiles[issue.tile].done && seconds > longest) {
+                longest = seconds;
+                oldest = issue.tile;
+            }
+        }
+    }
+    if (oldest >= 0)
+        ++speculative;
+    return oldest;
+}
+
+int Coordinator::runningChildren()
+{
+    int running = 0;
+    for (pid_t &pid : children) {
+        if (pid > 0 && waitpid(pid, 0, WNOHANG) == pid)
+            pid = 0;
+        running += pid > 0;
+    }
+    return running;
+}
+
+// Finished workers exit by themselves; hung ones are killed after a grace period.
+void Coordinator::stopChildren()
+{
+    auto start = Clock::now();
+    while (runningChildren() > 0 && secondsSince(start) < 2)
+        usleep(10000);
+    for (pid_t pid : children) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, 0, 0);
+        }
+    }
+}
+
+int runCoordinator(const std::string &scenePath, const CoordinatorOptions &options)
+{
+    Coordinator coordinator(options);
+    return coordinator.run(scenePath);
+}
+
+int runWorker(const std::string &address, ThreadPool &pool)
+{
+    std::string error, line;
+    int fd = connectTo(address, error);
+    if (fd < 0) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    SocketReader reader(fd);
+    int hybrid = 0, compact = 0, bvhCache = 1;
+    std::string path;
+    if (reader.readLine(line) && line.compare(0, 6, "scene ") == 0) {
+        std::istringstream header(line.substr(6));
+        header >> hybrid >> compact >> bvhCache;
+        std::getline(header >> std::ws, path);
+    }
+    if (path.empty()) {
+        std::cerr << "Error: the coordinator sent no scene" << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    Scene scene;
+    CompiledScene compiled;
+    RasterScene raster;
+    try {
+        if (isBinaryScene(path))
+            scene.loadFromBinary(path);
+        else
+            scene.loadFromXml(path, &pool);
+        if (compact)
+            scene.compactGeometry();
+        compileScene(scene, compiled, bvhCache ? path + ".bvh" : "");
+        if (hybrid)
+            buildRasterScene(scene, compiled, pool, raster);
+    } catch (const std::exception &e) {
+        sendLine(fd, std::string("error ") + e.what());
+        close(fd);
+        return 1;
+    }
+
+    int width = scene.camera.image_width, height = scene.camera.image_height;
+    sendLine(fd, "ready " + std::to_string(width) + " " + std::to_string(height) + " " + scene.texture_image);
+    std::vector<unsigned char> pixels;
+    while (reader.readLine(line)) {
+        if (line == "finish") {
+            close(fd);
+            return 0;
+        }
+        std::istringstream request(line);
+        std::string kind;
+        int tile, x0, y0, x1, y1;
+        if (!(request >> kind >> tile >> x0 >> y0 >> x1 >> y1) || kind != "tile" || x0 < 0 || y0 < 0 || x1 > width || y1 > height ||
+            x0 >= x1 || y0 >= y1) {
+            std::cerr << "Error: unexpected request from the coordinator: " << line << std::endl;
+            break;
+        }
+        pixels.resize((size_t)(x1 - x0) * (y1 - y0) * 3);
+        ImageWindow window = {&pixels[0], x0, y0, x1, y1};
+        renderWindow(scene, compiled, pool, hybrid ? &raster : 0, window);
+        if (!sendLine(fd, "pixels " + std::to_string(tile) + " " + std::to_string(pixels.size())) ||
+            !sendAll(fd, &pixels[0], pixels.size()))
+            break;
+    }
+    close(fd);
+    return 1;
+}
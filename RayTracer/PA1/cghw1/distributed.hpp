@@ -0,0 +1,45 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "threadpool.hpp"
+#include <string>
+
+// Distributed rendering. "program coordinate" splits the frame into tiles
+// and hands them to "program worker" processes connected over sockets (see
+// net.hpp for addresses); each worker loads the scene file itself, so
+// remote nodes need it at the same path. One line each way, plus pixels:
+//
+//   coordinator: scene <hybrid> <compact> <bvh cache> <path>
+//   worker:      ready <width> <height> <output>  or  error <message>
+//   coordinator: tile <id> <x0> <y0> <x1> <y1>
+//   worker:      pixels <id> <bytes>, followed by the tile's RGB bytes
+//   coordinator: finish
+//
+// Workers keep DISTRIBUTED_PIPELINE tiles each so they never wait for the
+// next one. Tiles of a worker that disconnects are issued again. Once no
+// tile is left to hand out, a tile that has been out DISTRIBUTED_SLOW_FACTOR
+// times longer than tiles take on average also goes to an idle worker, and
+// whichever copy comes back first is used.
+const int DISTRIBUTED_PIPELINE = 2;
+const int DISTRIBUTED_SLOW_FACTOR = 4;
+
+struct CoordinatorOptions
+{
+    std::string listen;         // address for workers; a socket in /tmp when empty
+    int spawn = 0;              // local worker processes to start
+    int tileSize = 128;         // rounded up to whole kernel tiles
+    std::string output;         // the scene's image name when empty
+    bool hybrid = false;
+    bool compact = false;
+    bool bvhCache = true;
+    std::string isa = "auto";   // for spawned workers
+    int threads = 0;            // per spawned worker
+};
+
+// Renders the frame and writes it; returns the exit status.
+int runCoordinator(const std::string &scenePath, const CoordinatorOptions &options);
+
+// Renders tiles for the coordinator at address until told to finish.
+int runWorker(const std::string &address, ThreadPool &pool);
+
+#endif
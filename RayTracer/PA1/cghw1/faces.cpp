@@ -0,0 +1,77 @@
+#include "parser.hpp"
+#include <algorithm>
+#include <climits>
+using namespace parser;
+
+
+// ids of a face corner by corner: vertex, texture, normal
+static void faceIds(const Face &face, int ids[9])
+{
+    const int values[9] = {face.v1_id, face.t1_id, face.n1_id, face.v2_id, face.t2_id, face.n2_id, face.v3_id, face.t3_id, face.n3_id};
+    std::copy(values, values + 9, ids);
+}
+
+template <typename T>
+static void packIds(const std::vector<Face> &faces, const int base[3], bool shared, SceneVector<T> &out)
+{
+    out.resize(faces.size() * (shared ? 3 : 9));
+    size_t next = 0;
+    int ids[9];
+    for (const Face &face : faces) {
+        faceIds(face, ids);
+        for (int k = 0; k < 9; k += shared ? 3 : 1)
+            out[next++] = (T)((uint32_t)ids[k] - (uint32_t)base[k % 3]);
+    }
+}
+
+void FaceList::assign(std::vector<Face> faces, Arena *arena)
+{
+    count = faces.size();
+    int lower[3] = {INT_MAX, INT_MAX, INT_MAX}, upper[3] = {INT_MIN, INT_MIN, INT_MIN};
+    int ids[9];
+    for (const Face &face : faces) {
+        faceIds(face, ids);
+        for (int k = 0; k < 9; ++k) {
+            lower[k % 3] = std::min(lower[k % 3], ids[k]);
+            upper[k % 3] = std::max(upper[k % 3], ids[k]);
+        }
+    }
+    uint32_t span = 0;
+    for (int a = 0; a < 3; ++a) {
+        base[a] = count ? lower[a] : 0;
+        if (count)
+            span = std::max(span, (uint32_t)upper[a] - (uint32_t)lower[a]);
+    }
+
+    shared = true;
+    for (size_t i = 0; i < count && shared; ++i) {
+        faceIds(faces[i], ids);
+        for (int c = 0; c < 9; c += 3) {
+            uint32_t vertex = (uint32_t)ids[c] - (uint32_t)base[0];
+            if ((uint32_t)ids[c + 1] - (uint32_t)base[1] != vertex || (uint32_t)ids[c + 2] - (uint32_t)base[2] != vertex)
+                shared = false;
+        }
+    }
+
+    narrow = SceneVector<uint16_t>(ArenaAllocator<uint16_t>(arena));
+    wide = SceneVector<uint32_t>(ArenaAllocator<uint32_t>(arena));
+    if (span <= 0xffff)
+        packIds(faces, base, shared, narrow);
+    else
+        packIds(faces, base, shared, wide);
+}
+
+void FaceList::append(const std::vector<Face> &faces)
+{
+    std::vector<Face> all = unpack();
+    all.insert(all.end(), faces.begin(), faces.end());
+    assign(std::move(all), narrow.get_allocator().arena);
+}
+
+std::vector<Face> FaceList::unpack() const
+{
+    std::vector<Face> faces(count);
+    for (size_t i = 0; i < count; ++i)
+        faces[i] = (*this)[i];
+    return faces;
+}
@@ -0,0 +1,306 @@
+#include "incremental.hpp"
+#include "checkpoint.hpp"
+#include "raster.hpp"
+#include "raytracer.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace parser;
+
+namespace
+{
+    const float DIRTY_PADDING = 1e-4f;      // box padding relative to the scene extent, on top of the shadow ray offset
+    const double DIRTY_NEAR_DEPTH = 1e-3;   // boxes are clipped at this camera depth, relative to the scene extent
+    const int DIRTY_MARGIN = 1;             // pixels around the projected bounds
+
+    struct Box
+    {
+        Vec3f lower = {FLT_MAX, FLT_MAX, FLT_MAX};
+        Vec3f upper = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+        bool empty() const { return lower.x > upper.x || lower.y > upper.y || lower.z > upper.z; }
+
+        void add(const Vec3f &p)
+        {
+            lower = Vec3f{std::min(lower.x, p.x), std::min(lower.y, p.y), std::min(lower.z, p.z)};
+            upper = Vec3f{std::max(upper.x, p.x), std::max(upper.y, p.y), std::max(upper.z, p.z)};
+        }
+
+        void add(const Box &box)
+        {
+            if (!box.empty()) {
+                add(box.lower);
+                add(box.upper);
+            }
+        }
+
+        Vec3f corner(int i) const
+        {
+            return Vec3f{i & 1 ? upper.x : lower.x, i & 2 ? upper.y : lower.y, i & 4 ? upper.z : lower.z};
+        }
+
+        Box padded(float amount) const
+        {
+            Box box = *this;
+            if (!empty()) {
+                box.lower = lower - Vec3f{amount, amount, amount};
+                box.upper = upper + Vec3f{amount, amount, amount};
+            }
+            return box;
+        }
+
+        Box intersection(const Box &other) const
+        {
+            Box box;
+            box.lower = Vec3f{std::max(lower.x, other.lower.x), std::max(lower.y, other.lower.y), std::max(lower.z, other.lower.z)};
+            box.upper = Vec3f{std::min(upper.x, other.upper.x), std::min(upper.y, other.upper.y), std::min(upper.z, other.upper.z)};
+            return box;
+        }
+
+        // 0 inside
+        double distance(const Vec3f &p) const
+        {
+            double dx = std::max({(double)lower.x - p.x, (double)p.x - upper.x, 0.0});
+            double dy = std::max({(double)lower.y - p.y, (double)p.y - upper.y, 0.0});
+            double dz = std::max({(double)lower.z - p.z, (double)p.z - upper.z, 0.0});
+            return std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    };
+
+    Box meshBox(const Scene &scene, const Mesh &mesh)
+    {
+        Box box;
+        for (const Face &face : mesh.faces) {
+            box.add(scene.vertex(face.v1_id));
+            box.add(scene.vertex(face.v2_id));
+            box.add(scene.vertex(face.v3_id));
+        }
+        return box;
+    }
+
+    bool same(const Vec3f &a, const Vec3f &b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+
+    // Corner data by id, or the ids themselves where a scene has no entry
+    // for them.
+    bool sameCorner(const Scene &a, int idA, const Scene &b, int idB, int kind)
+    {
+        int countA = kind == 0 ? a.vertexCount() : kind == 1 ? a.texcoordCount() : a.normalCount();
+        int countB = kind == 0 ? b.vertexCount() : kind == 1 ? b.texcoordCount() : b.normalCount();
+        if (idA < 1 || idA > countA || idB < 1 || idB > countB)
+            return idA == idB;
+        if (kind == 0)
+            return same(a.vertex(idA), b.vertex(idB));
+        if (kind == 1)
+            return same(a.texcoord(idA), b.texcoord(idB));
+        return same(a.normal(idA), b.normal(idB));
+    }
+
+    // The same material and, face by face, the same corners; the ids may
+    // differ as long as they refer to the same data.
+    bool sameMesh(const Scene &a, const Mesh &meshA, const Scene &b, const Mesh &meshB)
+    {
+        if (meshA.material_id != meshB.material_id || meshA.faces.size() != meshB.faces.size())
+            return false;
+        for (size_t i = 0; i < meshA.faces.size(); ++i) {
+            Face fa = meshA.faces[i], fb = meshB.faces[i];
+            const int idsA[9] = {fa.v1_id, fa.t1_id, fa.n1_id, fa.v2_id, fa.t2_id, fa.n2_id, fa.v3_id, fa.t3_id, fa.n3_id};
+            const int idsB[9] = {fb.v1_id, fb.t1_id, fb.n1_id, fb.v2_id, fb.t2_id, fb.n2_id, fb.v3_id, fb.t3_id, fb.n3_id};
+            for (int k = 0; k < 9; ++k)
+                if (!sameCorner(a, idsA[k], b, idsB[k], k % 3))
+                    return false;
+        }
+        return true;
+    }
+
+    // What, other than meshes, differs between the scenes; empty if nothing.
+    std::string otherChanges(const Scene &a, const Scene &b)
+    {
+        if (cameraHash(a.camera) != cameraHash(b.camera))
+            return "the camera changed";
+        if (a.point_lights.size() != b.point_lights.size() || a.triangular_lights.size() != b.triangular_lights.size())
+            return "the lights changed";
+        for (size_t i = 0; i < a.point_lights.size(); ++i)
+            if (!same(a.point_lights[i].position, b.point_lights[i].position) || !same(a.point_lights[i].intensity, b.point_lights[i].intensity))
+                return "the lights changed";
+        for (size_t i = 0; i < a.triangular_lights.size(); ++i) {
+            const TriangularLight &la = a.triangular_lights[i], &lb = b.triangular_lights[i];
+            if (!same(la.vertex1, lb.vertex1) || !same(la.vertex2, lb.vertex2) || !same(la.vertex3, lb.vertex3) || !same(la.intensity, lb.intensity))
+                return "the lights changed";
+        }
+        if (a.materials.size() != b.materials.size())
+            return "the materials changed";
+        for (size_t i = 0; i < a.materials.size(); ++i) {
+            const Material &ma = a.materials[i], &mb = b.materials[i];
+            if (!same(ma.ambient, mb.ambient) || !same(ma.diffuse, mb.diffuse) || !same(ma.specular, mb.specular) ||
+                !same(ma.mirror_reflactance, mb.mirror_reflactance) || ma.phong_exponent != mb.phong_exponent ||
+                ma.texture_factor != mb.texture_factor)
+                return "the materials changed";
+        }
+        if (a.background_color.x != b.background_color.x || a.background_color.y != b.background_color.y ||
+            a.background_color.z != b.background_color.z || a.maxraytracedepth != b.maxraytracedepth ||
+            !same(a.ambient_light, b.ambient_light))
+            return "the scene settings changed";
+        return "";
+    }
+
+    // Where a shadow of box cast by a point light at light can fall within
+    // bounds: the cone of rays from the light through the box, beyond it.
+    // Every cross-section of the cone is a scaled copy of the box, so the
+    // part up to scale times the box's distance is the hull of the box and
+    // its copy at that scale.
+    Box shadowBox(const Box &box, const Vec3f &light, const Box &bounds)
+    {
+        double nearest = box.distance(light);
+        if (nearest <= 0)
+            return bounds;
+        double farthest = 0;
+        for (int i = 0; i < 8; ++i) {
+            Vec3f d = bounds.corner(i) - light;
+            farthest = std::max(farthest, std::sqrt((double)dot(d, d)));
+        }
+        float scale = (float)(farthest / nearest);
+        Box shadow = box;
+        for (int i = 0; i < 8; ++i)
+            shadow.add(light + (box.corner(i) - light) * scale);
+        return shadow.intersection(bounds);
+    }
+
+    // Marks the tiles with pixels whose camera rays can enter box. The part
+    // of the box nearer to the image plane's depth than nearDepth is clipped
+    // off; it can only be seen within nearReach of the camera, so a box that
+    // comes that close is not bounded and false is returned.
+    bool markBox(const Box &box, const RasterCamera &camera, double nearDepth, double nearReach, int width, int height,
+                 std::vector<unsigned char> &dirty)
+    {
+        if (box.empty())
+            return true;
+        Vec3f eye = {(float)camera.position.x, (float)camera.position.y, (float)camera.position.z};
+        if (box.distance(eye) <= nearReach)
+            return false;
+
+        double depth[8], x, y, z;
+        for (int i = 0; i < 8; ++i)
+            camera.project(box.corner(i), x, y, depth[i]);
+        double x0 = DBL_MAX, y0 = DBL_MAX, x1 = -DBL_MAX, y1 = -DBL_MAX;
+        auto add = [&](const Vec3f &p) {
+            camera.project(p, x, y, z);
+            x0 = std::min(x0, x);
+            y0 = std::min(y0, y);
+            x1 = std::max(x1, x);
+            y1 = std::max(y1, y);
+        };
+        for (int i = 0; i < 8; ++i) {
+            if (depth[i] >= nearDepth)
+                add(box.corner(i));
+            // the edges to the corners that differ in one more axis
+            for (int axis = 1; axis < 8; axis <<= 1) {
+                int j = i | axis;
+                if (j == i || (depth[i] >= nearDepth) == (depth[j] >= nearDepth))
+                    continue;
+                float t = (float)((nearDepth - depth[i]) / (depth[j] - depth[i]));
+                add(box.corner(i) + (box.corner(j) - box.corner(i)) * t);
+            }
+        }
+        if (x0 > x1)
+            return true;
+
+        // pixel centers are at integers
+        int px0 = (int)std::max(std::floor(x0) - DIRTY_MARGIN, 0.0);
+        int py0 = (int)std::max(std::floor(y0) - DIRTY_MARGIN, 0.0);
+        int px1 = (int)std::min(std::ceil(x1) + DIRTY_MARGIN, width - 1.0);
+        int py1 = (int)std::min(std::ceil(y1) + DIRTY_MARGIN, height - 1.0);
+        int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        for (int ty = py0 / TILE_SIZE; py0 <= py1 && ty <= py1 / TILE_SIZE; ++ty)
+            for (int tx = px0 / TILE_SIZE; px0 <= px1 && tx <= px1 / TILE_SIZE; ++tx)
+                dirty[ty * tilesX + tx] = 1;
+        return true;
+    }
+}
+
+DirtyTiles findDirtyTiles(const Scene &before, const Scene &after)
+{
+    const Camera &cam = after.camera;
+    int width = cam.image_width, height = cam.image_height;
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    DirtyTiles result;
+    result.totalTiles = tilesX * tilesY;
+    result.everything = otherChanges(before, after);
+
+    // old and new bounds of the changed meshes; shadows fall on the new
+    // scene's geometry, which bounds holds
+    std::vector<Box> changed;
+    Box bounds;
+    size_t meshes = std::max(before.meshes.size(), after.meshes.size());
+    for (size_t i = 0; i < meshes && result.everything.empty(); ++i) {
+        bool inBefore = i < before.meshes.size(), inAfter = i < after.meshes.size();
+        Box box = inAfter ? meshBox(after, after.meshes[i]) : Box();
+        bounds.add(box);
+        if (inBefore && inAfter && sameMesh(before, before.meshes[i], after, after.meshes[i]))
+            continue;
+        ++result.changedMeshes;
+        changed.push_back(box);
+        if (inBefore)
+            changed.push_back(meshBox(before, before.meshes[i]));
+    }
+
+    std::vector<unsigned char> dirty(result.totalTiles, 0);
+    if (result.everything.empty() && !changed.empty()) {
+        Box extent = bounds;
+        for (const Box &box : changed)
+            extent.add(box);
+        Vec3f diagonal = extent.upper - extent.lower;
+        float size = std::sqrt(dot(diagonal, diagonal));
+        float padding = SHADOW_RAY_EPSILON + DIRTY_PADDING * size;
+        bounds = bounds.padded(padding);
+
+        // a point nearer than nearDepth that shows in the frame is within
+        // nearReach of the camera
+        RasterCamera camera(cam);
+        double halfX = std::max(std::fabs(cam.near_plane.x), std::fabs(cam.near_plane.y));
+        double halfY = std::max(std::fabs(cam.near_plane.z), std::fabs(cam.near_plane.w));
+        double nearDepth = DIRTY_NEAR_DEPTH * size;
+        double nearReach = nearDepth * std::sqrt(1 + (halfX * halfX + halfY * halfY) / (camera.distance * camera.distance));
+        for (const Box &mesh : changed) {
+            Box box = mesh.padded(padding);
+            if (!markBox(box, camera, nearDepth, nearReach, width, height, dirty)) {
+                result.everything = "a changed mesh reaches the camera";
+                break;
+            }
+            for (const PointLight &light : after.point_lights) {
+                if (!markBox(shadowBox(box, light.position, bounds), camera, nearDepth, nearReach, width, height, dirty)) {
+                    result.everything = "a shadow of a changed mesh reaches the camera";
+                    break;
+                }
+            }
+            if (!result.everything.empty())
+                break;
+        }
+    }
+
+    if (!result.everything.empty()) {
+        result.regions.assign(1, Region{0, 0, width, height});
+        result.tiles = result.totalTiles;
+        result.pixels = (long)width * height;
+        return result;
+    }
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            if (!dirty[ty * tilesX + tx])
+                continue;
+            int run = tx;
+            while (run + 1 < tilesX && dirty[ty * tilesX + run + 1])
+                ++run;
+            Region region = {tx * TILE_SIZE, ty * TILE_SIZE, std::min((run + 1) * TILE_SIZE, width), std::min((ty + 1) * TILE_SIZE, height)};
+            result.regions.push_back(region);
+            result.tiles += run - tx + 1;
+            result.pixels += (long)(region.x1 - region.x0) * (region.y1 - region.y0);
+            tx = run;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include "parser.hpp"
+#include "render.hpp"
+#include <string>
+#include <vector>
+
+// Incremental rendering after meshes changed. The meshes of two versions of
+// a scene are compared corner by corner; a mesh that moved, was deformed or
+// got other texture coordinates, normals or material can only change the
+// pixels that see into its old or new bounds, or into the shadows those
+// bounds cast from each point light. Those pixels, rounded out to tiles, are
+// rendered again and the rest of the previous image is kept. Reflections
+// need no bounds of their own: primary hits are shaded without mirror
+// bounces (see finishTile) and triangular lights are not rendered.
+struct DirtyTiles
+{
+    std::string everything;         // why the whole frame is dirty, empty if it is not
+    int changedMeshes = 0;
+    int tiles = 0, totalTiles = 0;
+    long pixels = 0;                // in the dirty tiles
+    std::vector<Region> regions;    // the dirty tiles, merged along tile rows
+};
+
+// Tiles of after.camera's frame that differ between renders of before and
+// after. Both scenes must be loaded the same way (compact or not).
+DirtyTiles findDirtyTiles(const parser::Scene &before, const parser::Scene &after);
+
+#endif
@@ -0,0 +1,324 @@
+// Hot loops of the renderer. This file is compiled once per instruction set
+// (see KERNEL_ISAS in the Makefile) with RT_KERNEL_ISA naming the variant;
+// each build exports kernels_<isa> and dispatch.cpp picks one at startup.
+//
+// Everything except the exported table has internal linkage, and only the
+// force-inlined vecmath.hpp and decodePosition() are used from headers, so
+// no out-of-line code built for a newer ISA can leak into the rest of the
+// program.
+#include "kernels.hpp"
+#include <cfloat>
+
+#ifndef RT_KERNEL_ISA
+#define RT_KERNEL_ISA generic
+#endif
+#define RT_KERNEL_CONCAT2(a, b) a##b
+#define RT_KERNEL_CONCAT(a, b) RT_KERNEL_CONCAT2(a, b)
+#define RT_KERNEL_STRING2(a) #a
+#define RT_KERNEL_STRING(a) RT_KERNEL_STRING2(a)
+
+using namespace parser;
+using vecmath::Vec3;
+
+namespace
+{
+    typedef vecmath::NativeFloat Lane;
+
+    // Moller-Trumbore against Lane::Width triangles, with the same operations
+    // and rejection tests as intersectionTriangle() so results are identical.
+    template <typename F>
+    inline F intersectLanes(const float *tri, int stride, int i, const Vec3<F> &origin, const Vec3<F> &direction)
+    {
+        const F EPSILON(1e-6f);
+
+        Vec3<F> v0 = vecmath::load3<F>(tri + i, tri + stride + i, tri + 2 * stride + i);
+        Vec3<F> edge1 = vecmath::load3<F>(tri + 3 * stride + i, tri + 4 * stride + i, tri + 5 * stride + i);
+        Vec3<F> edge2 = vecmath::load3<F>(tri + 6 * stride + i, tri + 7 * stride + i, tri + 8 * stride + i);
+
+        Vec3<F> h = cross(direction, edge2);
+        F a = dot(edge1, h);
+        F f = F(1.0f) / a;
+        Vec3<F> s = origin - v0;
+        F u = f * dot(s, h);
+        Vec3<F> q = cross(s, edge1);
+        F v = f * dot(direction, q);
+        F t = f * dot(edge2, q);
+
+        return select((abs(a) < EPSILON) | (u < F(0.0f)) | (u > F(1.0f)) |
+                      (v < F(0.0f)) | ((u + v) > F(1.0f)) | (t <= EPSILON),
+                      F(-1.0f), t);
+    }
+
+    // Lane group of slots starting at i. Compact scenes are decoded into a
+    // small array first, with the same arithmetic compileScene() uses for
+    // the float layout, so both give identical hits on the decoded geometry.
+    template <typename F>
+    inline F intersectSlots(const KernelScene &scene, int i, const Vec3<F> &origin, const Vec3<F> &direction)
+    {
+        if (scene.triangles)
+            return intersectLanes(scene.triangles, scene.triangleCount, i, origin, direction);
+
+        float decoded[9 * F::Width];
+        const int *corners = scene.corners + i;
+        for (int k = 0; k < F::Width; ++k) {
+            Vec3f v0 = decodePosition(scene.positions, scene.blocks, corners[k]);
+            Vec3f edge1 = decodePosition(scene.positions, scene.blocks, corners[scene.triangleCount + k]) - v0;
+            Vec3f edge2 = decodePosition(scene.positions, scene.blocks, corners[2 * scene.triangleCount + k]) - v0;
+            const float triangle[9] = {v0.x, v0.y, v0.z, edge1.x, edge1.y, edge1.z, edge2.x, edge2.y, edge2.z};
+            for (int c = 0; c < 9; ++c)
+                decoded[c * F::Width + k] = triangle[c];
+        }
+        return intersectLanes(decoded, F::Width, 0, origin, direction);
+    }
+
+    // Ray against a node box, clipped to [0, tMax]. A NaN from a ray lying in
+    // a slab plane never narrows the interval, so the test stays conservative.
+    inline bool hitBox(const BvhNode &node, const Ray &ray, const float inverse[3], float tMax, float &tNear)
+    {
+        const float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+        float t0 = 0, t1 = tMax;
+        for (int a = 0; a < 3; ++a) {
+            float near = (node.lower[a] - origin[a]) * inverse[a];
+            float far = (node.upper[a] - origin[a]) * inverse[a];
+            if (near > far) {
+                float swap = near;
+                near = far;
+                far = swap;
+            }
+            if (near > t0)
+                t0 = near;
+            if (far < t1)
+                t1 = far;
+        }
+        tNear = t0;
+        return t0 <= t1;
+    }
+
+    struct BvhEntry
+    {
+        int node;
+        float tNear;
+    };
+
+    // Leaves are tested a lane group at a time from their first slot; lanes
+    // past the leaf hold other real triangles or padding, which is harmless.
+    template <typename F>
+    float closestHitLanes(const KernelScene &scene, const Ray &ray, int &triangle)
+    {
+        Vec3<F> origin = vecmath::broadcast<F>(ray.origin);
+        Vec3<F> direction = vecmath::broadcast<F>(ray.direction);
+        const float inverse[3] = {1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z};
+        float t = -1;
+        float lanes[F::Width];
+        triangle = -1;
+
+        BvhEntry stack[BVH_MAX_DEPTH + 1];
+        int top = 0;
+        float tNear;
+        if (scene.nodeCount > 0 && hitBox(scene.nodes[0], ray, inverse, FLT_MAX, tNear))
+            stack[top++] = {0, tNear};
+
+        while (top > 0) {
+            BvhEntry entry = stack[--top];
+            // boxes touching the current hit are kept, so ties still resolve
+            if (t >= 0 && entry.tNear > t)
+                continue;
+            const BvhNode &node = scene.nodes[entry.node];
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i += F::Width) {
+                    F laneT = intersectSlots(scene, i, origin, direction);
+                    if (!anyTrue(laneT > F(0.0f)))
+                        continue;
+                    // the lowest triangle index wins ties, as in a loop over all triangles
+                    laneT.store(lanes);
+                    for (int k = 0; k < F::Width; ++k) {
+                        int index = scene.triangleIndex[i + k];
+                        if (lanes[k] > 0 && (t < 0 || lanes[k] < t || (lanes[k] == t && index < triangle))) {
+                            t = lanes[k];
+                            triangle = index;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // the nearer child goes on top
+            float tMax = t < 0 ? FLT_MAX : t, tLeft, tRight;
+            bool left = hitBox(scene.nodes[entry.node + 1], ray, inverse, tMax, tLeft);
+            bool right = hitBox(scene.nodes[node.first], ray, inverse, tMax, tRight);
+            if (left && right && tLeft <= tRight) {
+                stack[top++] = {node.first, tRight};
+                stack[top++] = {entry.node + 1, tLeft};
+            } else if (left && right) {
+                stack[top++] = {entry.node + 1, tLeft};
+                stack[top++] = {node.first, tRight};
+            } else if (left) {
+                stack[top++] = {entry.node + 1, tLeft};
+            } else if (right) {
+                stack[top++] = {node.first, tRight};
+            }
+        }
+        return t;
+    }
+
+    template <typename F>
+    bool occludedLanes(const KernelScene &scene, const Ray &ray, float maxDistance)
+    {
+        Vec3<F> origin = vecmath::broadcast<F>(ray.origin);
+        Vec3<F> direction = vecmath::broadcast<F>(ray.direction);
+        const float inverse[3] = {1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z};
+
+        int stack[BVH_MAX_DEPTH + 1];
+        int top = 0;
+        if (scene.nodeCount > 0)
+            stack[top++] = 0;
+
+        while (top > 0) {
+            int index = stack[--top];
+            const BvhNode &node = scene.nodes[index];
+            float tNear;
+            if (!hitBox(node, ray, inverse, maxDistance, tNear))
+                continue;
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i += F::Width) {
+                    F laneT = intersectSlots(scene, i, origin, direction);
+                    if (anyTrue((laneT >= F(0.0f)) & (laneT <= F(maxDistance))))
+                        return true;
+                }
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = index + 1;
+            }
+        }
+        return false;
+    }
+
+    // Blinn-Phong for Lane::Width hits starting at index i. Written against
+    // Vec3<F> so it is the same code as the scalar path with F = float.
+    // Classes without MATERIAL_SPECULAR skip the half vector and the pow.
+    template <typename F, int Features>
+    inline void shadeLanes(float *channels, int capacity, int i, const float *lit, const KernelLight &light)
+    {
+        typedef Vec3<F> Vec3F;
+        const float *c = channels + i;
+        Vec3F p = vecmath::load3<F>(c + GB_PX * capacity, c + GB_PY * capacity, c + GB_PZ * capacity);
+        Vec3F n = vecmath::load3<F>(c + GB_NX * capacity, c + GB_NY * capacity, c + GB_NZ * capacity);
+
+        // irradiance = I / d^2
+        Vec3F L = vecmath::broadcast<F>(light.position) - p;
+        F d2 = dot(L, L);
+        F inv_d2 = select(d2 != F(0.0f), F(1.0f) / select(d2 != F(0.0f), d2, F(1.0f)), F(0.0f));
+        Vec3F irradiance = vecmath::broadcast<F>(light.intensity) * inv_d2;
+
+        L = normalize(L);
+        F cosTheta = max(dot(n, L), F(0.0f));
+
+        float *r = channels + GB_R * capacity + i;
+        float *g = channels + GB_G * capacity + i;
+        float *b = channels + GB_B * capacity + i;
+        Vec3F color = vecmath::load3<F>(r, g, b);
+        Vec3F diffuse = vecmath::load3<F>(c + GB_DR * capacity, c + GB_DG * capacity, c + GB_DB * capacity) * (irradiance * cosTheta);
+        Vec3F lit_color = color + diffuse;
+
+        if (Features & MATERIAL_SPECULAR) {
+            Vec3F o = vecmath::load3<F>(c + GB_OX * capacity, c + GB_OY * capacity, c + GB_OZ * capacity);
+            Vec3F V = normalize(o - p);
+            Vec3F H = normalize(L + V);
+            F cosAlpha = max(dot(n, H), F(0.0f));
+            F specFactor = vecmath::fastPow(cosAlpha, F::load(c + GB_PHONG * capacity));
+            Vec3F specular = vecmath::load3<F>(c + GB_SR * capacity, c + GB_SG * capacity, c + GB_SB * capacity) * (irradiance * specFactor);
+            lit_color = lit_color + specular;
+        }
+
+        F mask = F::load(lit + i);
+        select(mask != F(0.0f), lit_color.x, color.x).store(r);
+        select(mask != F(0.0f), lit_color.y, color.y).store(g);
+        select(mask != F(0.0f), lit_color.z, color.z).store(b);
+    }
+
+    // capacity is a multiple of the batch size, so lanes past count only touch padding
+    template <int Features>
+    void shadeHits(const KernelScene &scene, float *channels, int capacity, int count)
+    {
+        for (int l = 0; l < scene.lightCount; ++l) {
+            const float *lit = channels + (GB_LIT + l) * capacity;
+            for (int i = 0; i < count; i += Lane::Width)
+                shadeLanes<Lane, Features>(channels, capacity, i, lit, scene.lights[l]);
+        }
+    }
+
+    // Edge functions are evaluated relative to the tile origin in float,
+    // which keeps the rounding error far below the triangle margins.
+    template <typename F>
+    void rasterTileLanes(const RasterTriangle *triangles, const int *list, int count, int x0, int y0, RasterTile &tile)
+    {
+        static const float laneOffsets[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+        float closer[F::Width];
+
+        for (int k = 0; k < KERNEL_TILE_PIXELS; ++k) {
+            tile.nearest[k] = -FLT_MAX;
+            tile.second[k] = -FLT_MAX;
+            tile.edge[k] = -FLT_MAX;
+            tile.triangle[k] = -1;
+        }
+
+        for (int n = 0; n < count; ++n) {
+            const RasterTriangle &tri = triangles[list[n]];
+            F a[3], b[3], c[3];
+            for (int e = 0; e < 3; ++e) {
+                a[e] = F(tri.a[e]);
+                b[e] = F(tri.b[e]);
+                c[e] = F((float)(tri.c[e] + tri.a[e] * (double)x0 + tri.b[e] * (double)y0));
+            }
+            F za(tri.za), zb(tri.zb);
+            F zc((float)(tri.zc + tri.za * (double)x0 + tri.zb * (double)y0));
+            F margin(tri.margin), negMargin(-tri.margin);
+
+            for (int y = 0; y < KERNEL_TILE_SIZE; ++y) {
+                F dy((float)y);
+                for (int x = 0; x < KERNEL_TILE_SIZE; x += F::Width) {
+                    F dx = F::load(laneOffsets + x);
+                    F d0 = c[0] + a[0] * dx + b[0] * dy;
+                    F d1 = c[1] + a[1] * dx + b[1] * dy;
+                    F d2 = c[2] + a[2] * dx + b[2] * dy;
+                    typename F::Mask near = (d0 > negMargin) & (d1 > negMargin) & (d2 > negMargin);
+                    if (!anyTrue(near))
+                        continue;
+
+                    int k = y * KERNEL_TILE_SIZE + x;
+                    F depth = zc + za * dx + zb * dy;
+                    typename F::Mask onEdge = near & ((d0 <= margin) | (d1 <= margin) | (d2 <= margin));
+                    typename F::Mask inside = near & (d0 > margin) & (d1 > margin) & (d2 > margin);
+
+                    F edge = F::load(tile.edge + k);
+                    select(onEdge, max(edge, depth), edge).store(tile.edge + k);
+
+                    if (!anyTrue(inside))
+                        continue;
+                    F nearest = F::load(tile.nearest + k);
+                    F second = F::load(tile.second + k);
+                    typename F::Mask isCloser = inside & (depth > nearest);
+                    select(inside, max(second, min(depth, nearest)), second).store(tile.second + k);
+                    select(isCloser, depth, nearest).store(tile.nearest + k);
+                    if (anyTrue(isCloser)) {
+                        select(isCloser, F(1.0f), F(0.0f)).store(closer);
+                        for (int l = 0; l < F::Width; ++l)
+                            if (closer[l] != 0)
+                                tile.triangle[k + l] = tri.triangle;
+                    }
+                }
+            }
+        }
+    }
+}
+
+extern const RenderKernels RT_KERNEL_CONCAT(kernels_, RT_KERNEL_ISA) = {
+    RT_KERNEL_STRING(RT_KERNEL_ISA),
+    closestHitLanes<Lane>,
+    occludedLanes<Lane>,
+    {shadeHits<0>, shadeHits<1>, shadeHits<2>, shadeHits<3>,
+     shadeHits<4>, shadeHits<5>, shadeHits<6>, shadeHits<7>},
+    rasterTileLanes<Lane>,
+};
@@ -0,0 +1,172 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include "parser.hpp"
+#include "raytracer.hpp"
+#include <string>
+#include <vector>
+
+// Triangle arrays are padded with degenerate triangles to a multiple of the
+// widest lane count, with at least KERNEL_TRIANGLE_PAD - 1 of them, so a
+// lane group starting at any BVH leaf never reads past the end.
+const int KERNEL_TRIANGLE_PAD = 16;
+
+// Deepest BVH the kernels can traverse (their stack size).
+const int BVH_MAX_DEPTH = 64;
+
+// Screen tiles are KERNEL_TILE_SIZE pixels square; the raster kernel always
+// covers a full tile and the caller ignores pixels past the image edge.
+const int KERNEL_TILE_SIZE = 16;
+const int KERNEL_TILE_PIXELS = KERNEL_TILE_SIZE * KERNEL_TILE_SIZE;
+
+// Channels of the structure-of-arrays G-buffer (see GBuffer in shading.hpp).
+// Channel GB_LIT + l holds 1 where light l is visible from the hit.
+enum GBufferChannel
+{
+    GB_PX, GB_PY, GB_PZ,    // intersection point
+    GB_NX, GB_NY, GB_NZ,    // shading normal (faces the ray)
+    GB_OX, GB_OY, GB_OZ,    // ray origin
+    GB_DX, GB_DY, GB_DZ,    // ray direction
+    GB_DR, GB_DG, GB_DB,    // diffuse after texture blending
+    GB_SR, GB_SG, GB_SB,    // specular
+    GB_PHONG,               // phong exponent
+    GB_R, GB_G, GB_B,       // accumulated color
+    GB_LIT
+};
+
+// Material feature bits, decided once per material in compileScene(). Each
+// combination is a material class with its own template-instantiated
+// pipeline, so terms a class does not use are compiled out.
+enum MaterialFeature
+{
+    MATERIAL_TEXTURED = 1,  // texture_factor != 0
+    MATERIAL_SPECULAR = 2,  // any specular component != 0
+    MATERIAL_MIRROR = 4     // any mirror_reflactance component > 0
+};
+const int MATERIAL_CLASS_COUNT = 8;
+
+// Node of the bounding volume hierarchy over the compiled triangles (see
+// bvh.hpp). A leaf (count > 0) holds kernel slots [first, first + count);
+// an inner node's children are the next node and node first. Boxes are
+// padded so the ray-box test never rejects a triangle the exact test hits.
+struct BvhNode
+{
+    float lower[3];
+    int first;
+    float upper[3];
+    int count;
+};
+
+struct KernelLight
+{
+    parser::Vec3f position;
+    parser::Vec3f intensity;
+};
+
+// Plain-pointer view of the scene passed to the ISA specific kernels.
+struct KernelScene
+{
+    int triangleCount;          // padded
+    const float *triangles;     // 9 arrays of triangleCount floats: v0, edge1, edge2 (x, y, z each), in BVH order; null for a compact scene
+    const int *corners;         // compact scene: 3 arrays of triangleCount 0-based vertex indices, in BVH order
+    const uint16_t *positions;  // compact scene: quantized vertices and their blocks (see compact.hpp)
+    const float *blocks;
+    const int *triangleIndex;   // slot -> triangle index in the compiled scene, -1 for padding
+    int nodeCount;
+    const BvhNode *nodes;
+    int lightCount;
+    const KernelLight *lights;
+};
+
+// How compileScene() got the BVH, for the startup log.
+struct BvhCacheInfo
+{
+    std::string path;                   // cache file, empty when caching is off
+    bool hit = false;                   // loaded from path
+    bool written = false;               // built and written to path
+    double seconds = 0;                 // load or build time
+};
+
+// Scene data laid out for the kernels, built once after loading. Triangle
+// indices are in mesh and face order everywhere outside the kernels; only
+// the kernel arrays are stored in BVH order.
+struct CompiledScene
+{
+    int triangleCount;                  // real triangles, without padding
+    std::vector<float> triangles;       // by slot, empty for a compact scene
+    std::vector<int> corners;           // by slot, compact scene only
+    const CompactGeometry *compact = 0; // the scene's, when active
+    std::vector<int> triangleOrder;     // slot -> triangle, -1 for padding
+    std::vector<BvhNode> nodes;
+    std::vector<int> triangleMesh;      // triangle -> index into scene.meshes
+    std::vector<int> triangleFace;      // triangle -> index into mesh.faces
+    std::vector<KernelLight> lights;
+    std::vector<int> materialClass;     // material index -> MaterialFeature bits
+    BvhCacheInfo bvhCache;
+
+    KernelScene view() const;
+};
+
+int classifyMaterial(const parser::Material &material);
+// bvhCache names a file to load the BVH from, or to write it to after
+// building it; empty always builds.
+void compileScene(const parser::Scene &scene, CompiledScene &compiled, const std::string &bvhCache = "");
+// refreshes compiled.lights after scene.point_lights changed
+void compileLights(const parser::Scene &scene, CompiledScene &compiled);
+
+// Triangle projected for the hybrid rasterizer (see raster.hpp). Pixel
+// (x, y) has its center at screen position (x, y). Each edge is stored as
+// a signed distance in pixels, a * x + b * y + c, positive inside; depth is
+// the plane 1 / z = za * x + zb * y + zc in camera space. Offsets are kept
+// in double so the kernel can rebase them to the tile without losing bits.
+struct RasterTriangle
+{
+    float a[3], b[3];
+    double c[3];
+    float za, zb;
+    double zc;
+    float margin;           // edge distance that counts as "on the edge"
+    int triangle;           // index in the compiled scene
+};
+
+// Per-pixel result of rasterizing one tile. Depths are 1 / z, so larger is
+// closer; -FLT_MAX means nothing was found.
+struct RasterTile
+{
+    float nearest[KERNEL_TILE_PIXELS];  // closest triangle covering the pixel center
+    float second[KERNEL_TILE_PIXELS];   // next closest covering triangle
+    float edge[KERNEL_TILE_PIXELS];     // closest triangle with an edge within its margin
+    int triangle[KERNEL_TILE_PIXELS];   // triangle of nearest, or -1
+};
+
+// One set of kernels; kernels.cpp is compiled once per instruction set and
+// each build exports its own table.
+struct RenderKernels
+{
+    const char *name;
+    // nearest triangle with t > 0, or -1 (triangle index in the compiled
+    // scene; the lowest index wins ties)
+    float (*closestHit)(const KernelScene &scene, const Ray &ray, int &triangle);
+    // any triangle with 0 <= t <= maxDistance
+    bool (*occluded)(const KernelScene &scene, const Ray &ray, float maxDistance);
+    // Blinn-Phong for all point lights over count G-buffer entries of one
+    // material class, indexed by the class
+    void (*shade[MATERIAL_CLASS_COUNT])(const KernelScene &scene, float *channels, int capacity, int count);
+    // z-buffer pass over the listed triangles for the tile at (x0, y0)
+    void (*rasterTile)(const RasterTriangle *triangles, const int *list, int count, int x0, int y0, RasterTile &tile);
+};
+
+extern const RenderKernels kernels_generic;
+extern const RenderKernels kernels_sse2;
+extern const RenderKernels kernels_sse42;
+extern const RenderKernels kernels_avx2;
+extern const RenderKernels kernels_avx512;
+
+// Kernels in use; picked from the CPU features on first call unless
+// selectKernels() was called before.
+const RenderKernels &activeKernels();
+// isa is "auto" or one of sse2, sse4.2, avx2, avx512 (generic on non-x86).
+// Returns false with a message if the name is unknown or the CPU lacks it.
+bool selectKernels(const std::string &isa, std::string &error);
+
+#endif
@@ -1,77 +1,709 @@
 #include "parser.hpp"
+#include "adaptive.hpp"
+#include "bvh.hpp"
 #include "raytracer.hpp"
+#include "shading.hpp"
+#include "kernels.hpp"
+#include "checkpoint.hpp"
+#include "distributed.hpp"
+#include "incremental.hpp"
+#include "progressive.hpp"
+#include "relight.hpp"
+#include "render.hpp"
+#include "server.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <vector>
+
+// Ctrl-C ends a progressive render with the samples done so far, and Ctrl-C
+// or SIGTERM ends a checkpointed one after saving it; a second signal kills
+// the process as usual.
+static std::atomic<bool> interrupted(false);
+
+static void interrupt(int signal)
+{
+    interrupted = true;
+    std::signal(signal, SIG_DFL);
+}
+
+// Output of view (0-based) out of views: the scene's output numbered from 1,
+// e.g. frame_07.ppm, padded so the files sort in camera order.
+static std::string viewOutput(const std::string &output, size_t view, size_t views)
+{
+    std::string number = std::to_string(view + 1);
+    number.insert(0, std::to_string(views).size() - number.size(), '0');
+    size_t slash = output.find_last_of('/');
+    size_t dot = output.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = output.size();
+    return output.substr(0, dot) + "_" + number + output.substr(dot);
+}
 
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <XML file path>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <XML or binary scene path> [--isa=auto|sse2|sse4.2|avx2|avx512] [--hybrid] [--threads=N] [--no-bvh-cache] [--compact]"
+                  << " [--region=x0,y0,x1,y1 ...] [--regions=FILE] [--merge=PPM] [--incremental=OLD_SCENE]"
+                  << " [--progressive=SAMPLES] [--snapshot-interval=SECONDS] [--preview-scale=N]"
+                  << " [--checkpoint=PATH] [--checkpoint-interval=SECONDS] [--resume] [--deadline=SECONDS]"
+                  << " [--adaptive=MAX_SAMPLES] [--adaptive-threshold=LUMINANCE] [--sample-map=PPM] [--gbuffer=PATH] [--cameras=FILE]" << std::endl;
+        std::cerr << "       " << argv[0] << " compile <XML file path> <binary scene path>" << std::endl;
+        std::cerr << "       " << argv[0] << " serve <socket path> [--isa=...] [--hybrid] [--threads=N] [--no-bvh-cache] [--compact]" << std::endl;
+        std::cerr << "       " << argv[0] << " send <socket path> <request>" << std::endl;
+        std::cerr << "       " << argv[0] << " coordinate <scene path> [--listen=ADDRESS] [--spawn=N] [--tile=N] [--output=PATH] [render options]" << std::endl;
+        std::cerr << "       " << argv[0] << " worker <coordinator address> [--isa=...] [--threads=N]" << std::endl;
+        return 1;
+    }
+
+    // converts the XML into the binary scene format and exits
+    if (std::string(argv[1]) == "compile")
+    {
+        if (argc != 4)
+        {
+            std::cerr << "Usage: " << argv[0] << " compile <XML file path> <binary scene path>" << std::endl;
+            return 1;
+        }
+        ThreadPool pool;
+        parser::Scene scene;
+        scene.loadFromXml(argv[2], &pool);
+        scene.saveBinary(argv[3]);
+        std::cout << "Compiled " << argv[2] << " to " << argv[3] << std::endl;
+        return 0;
+    }
+
+    // passes one request to a running render server and prints the replies
+    if (std::string(argv[1]) == "send")
+    {
+        if (argc < 4)
+        {
+            std::cerr << "Usage: " << argv[0] << " send <socket path> <request>" << std::endl;
+            return 1;
+        }
+        std::string request = argv[3];
+        for (int i = 4; i < argc; ++i)
+            request += std::string(" ") + argv[i];
+        return sendRequest(argv[2], request);
+    }
+
+    // serve keeps scenes loaded and renders jobs sent over a socket until
+    // shut down; coordinate hands the tiles of one frame to worker processes
+    std::string mode = argv[1];
+    bool command = mode == "serve" || mode == "coordinate" || mode == "worker";
+    if (command && argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " " << mode << (mode == "worker" ? " <coordinator address>" : mode == "serve" ? " <socket path>" : " <scene path>")
+                  << " [options]" << std::endl;
         return 1;
     }
 
-    std::string xml_file_path = argv[1];  // xml path with name
+    std::string xml_file_path = argv[command ? 2 : 1];  // xml path with name, the server socket or the coordinator address
+    std::string isa = "auto";
+    bool hybrid = false;
+    bool bvhCache = true;
+    bool compact = false;
+    int threads = 0;
+    std::vector<Region> regions;
+    std::string merge;
+    std::string incrementalPath;
+    ProgressiveOptions progressive;
+    bool progressiveMode = false;
+    std::string checkpointPath;
+    double checkpointInterval = 60;
+    bool resume = false;
+    double deadlineSeconds = 0;
+    AdaptiveOptions adaptive;
+    bool adaptiveMode = false;
+    std::string sampleMap;
+    std::string gbufferPath;
+    std::string camerasPath;
+    CoordinatorOptions coordinator;
+    for (int i = command ? 3 : 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 6, "--isa=") == 0)
+        {
+            isa = arg.substr(6);
+        }
+        else if (arg.compare(0, 10, "--threads=") == 0)
+        {
+            threads = std::atoi(arg.c_str() + 10);
+        }
+        else if (arg == "--hybrid")
+        {
+            hybrid = true;
+        }
+        else if (arg == "--no-bvh-cache")
+        {
+            bvhCache = false;
+        }
+        else if (arg == "--compact")
+        {
+            compact = true;
+        }
+        else if (!command && arg.compare(0, 9, "--region=") == 0)
+        {
+            Region region;
+            if (!parseRegion(arg.substr(9), region))
+            {
+                std::cerr << "Error: --region expects x0,y0,x1,y1, got " << arg.substr(9) << std::endl;
+                return 1;
+            }
+            regions.push_back(region);
+        }
+        else if (!command && arg.compare(0, 10, "--regions=") == 0)
+        {
+            if (!readRegions(arg.substr(10), regions))
+            {
+                std::cerr << "Error: cannot read regions (x0,y0,x1,y1 per line) from " << arg.substr(10) << std::endl;
+                return 1;
+            }
+        }
+        else if (!command && arg.compare(0, 8, "--merge=") == 0)
+        {
+            merge = arg.substr(8);
+        }
+        else if (!command && arg.compare(0, 14, "--incremental=") == 0)
+        {
+            incrementalPath = arg.substr(14);
+        }
+        else if (!command && arg.compare(0, 14, "--progressive=") == 0)
+        {
+            progressive.samples = std::atoi(arg.c_str() + 14);
+            progressiveMode = true;
+        }
+        else if (!command && arg.compare(0, 20, "--snapshot-interval=") == 0)
+        {
+            progressive.snapshotInterval = std::atof(arg.c_str() + 20);
+        }
+        else if (!command && arg.compare(0, 16, "--preview-scale=") == 0)
+        {
+            progressive.previewScale = std::atoi(arg.c_str() + 16);
+        }
+        else if (!command && arg.compare(0, 13, "--checkpoint=") == 0)
+        {
+            checkpointPath = arg.substr(13);
+        }
+        else if (!command && arg.compare(0, 22, "--checkpoint-interval=") == 0)
+        {
+            checkpointInterval = std::atof(arg.c_str() + 22);
+        }
+        else if (!command && arg == "--resume")
+        {
+            resume = true;
+        }
+        else if (!command && arg.compare(0, 11, "--adaptive=") == 0)
+        {
+            adaptive.maxSamples = std::atoi(arg.c_str() + 11);
+            adaptiveMode = true;
+        }
+        else if (!command && arg.compare(0, 21, "--adaptive-threshold=") == 0)
+        {
+            adaptive.threshold = (float)std::atof(arg.c_str() + 21);
+        }
+        else if (!command && arg.compare(0, 13, "--sample-map=") == 0)
+        {
+            sampleMap = arg.substr(13);
+        }
+        else if (!command && arg.compare(0, 10, "--gbuffer=") == 0)
+        {
+            gbufferPath = arg.substr(10);
+        }
+        else if (!command && arg.compare(0, 10, "--cameras=") == 0)
+        {
+            camerasPath = arg.substr(10);
+        }
+        else if (!command && arg.compare(0, 11, "--deadline=") == 0)
+        {
+            deadlineSeconds = std::atof(arg.c_str() + 11);
+            if (deadlineSeconds <= 0)
+            {
+                std::cerr << "Error: --deadline expects a positive number of seconds, got " << arg.substr(11) << std::endl;
+                return 1;
+            }
+        }
+        else if (mode == "coordinate" && arg.compare(0, 9, "--listen=") == 0)
+        {
+            coordinator.listen = arg.substr(9);
+        }
+        else if (mode == "coordinate" && arg.compare(0, 8, "--spawn=") == 0)
+        {
+            coordinator.spawn = std::atoi(arg.c_str() + 8);
+        }
+        else if (mode == "coordinate" && arg.compare(0, 7, "--tile=") == 0)
+        {
+            coordinator.tileSize = std::atoi(arg.c_str() + 7);
+        }
+        else if (mode == "coordinate" && arg.compare(0, 9, "--output=") == 0)
+        {
+            coordinator.output = arg.substr(9);
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (!incrementalPath.empty() && (merge.empty() || !regions.empty()))
+    {
+        std::cerr << "Error: --incremental finds the regions itself and needs the image rendered from the old scene (--merge)" << std::endl;
+        return 1;
+    }
+    if (!incrementalPath.empty() && (progressiveMode || adaptiveMode || deadlineSeconds > 0 || !checkpointPath.empty() || !gbufferPath.empty()))
+    {
+        std::cerr << "Error: --incremental cannot be combined with other render modes" << std::endl;
+        return 1;
+    }
+    if (!merge.empty() && regions.empty() && incrementalPath.empty())
+    {
+        std::cerr << "Error: --merge needs the regions to render (--region or --regions)" << std::endl;
+        return 1;
+    }
+    if (progressiveMode && (progressive.samples < 1 || progressive.previewScale < 1))
+    {
+        std::cerr << "Error: --progressive and --preview-scale expect a positive count" << std::endl;
+        return 1;
+    }
+    if (progressiveMode && !regions.empty())
+    {
+        std::cerr << "Error: --progressive renders the whole frame and cannot be combined with regions" << std::endl;
+        return 1;
+    }
+    if (adaptiveMode && adaptive.maxSamples < 1)
+    {
+        std::cerr << "Error: --adaptive expects a positive sample count" << std::endl;
+        return 1;
+    }
+    if (!sampleMap.empty() && !adaptiveMode)
+    {
+        std::cerr << "Error: --sample-map needs an adaptive render (--adaptive)" << std::endl;
+        return 1;
+    }
+    if (adaptiveMode && (progressiveMode || deadlineSeconds > 0 || !checkpointPath.empty() || !regions.empty()))
+    {
+        std::cerr << "Error: --adaptive cannot be combined with --progressive, --deadline, --checkpoint or regions" << std::endl;
+        return 1;
+    }
+    if (!gbufferPath.empty() && (adaptiveMode || progressiveMode || deadlineSeconds > 0 || !checkpointPath.empty() || !regions.empty()))
+    {
+        std::cerr << "Error: --gbuffer renders one sample of the whole frame and cannot be combined with other render modes" << std::endl;
+        return 1;
+    }
+    bool singleView = progressiveMode || adaptiveMode || deadlineSeconds > 0 || !checkpointPath.empty() || !gbufferPath.empty() ||
+                      !incrementalPath.empty() || !regions.empty();
+    if (!camerasPath.empty() && (singleView || hybrid))
+    {
+        std::cerr << "Error: --cameras renders whole traced frames and cannot be combined with --hybrid or other render modes" << std::endl;
+        return 1;
+    }
+    if (resume && checkpointPath.empty())
+    {
+        std::cerr << "Error: --resume needs the checkpoint to resume from (--checkpoint)" << std::endl;
+        return 1;
+    }
+    if (deadlineSeconds > 0 && (!regions.empty() || !checkpointPath.empty()))
+    {
+        std::cerr << "Error: --deadline renders the whole frame in one go and cannot be combined with regions or --checkpoint" << std::endl;
+        return 1;
+    }
+    if (!checkpointPath.empty() && !regions.empty())
+    {
+        std::cerr << "Error: --checkpoint saves whole-frame renders and cannot be combined with regions" << std::endl;
+        return 1;
+    }
+
+    std::string error;
+    if (!selectKernels(isa, error))
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    std::cout << "Kernel ISA: " << activeKernels().name << (isa == "auto" ? " (detected)" : " (forced)") << std::endl;
+
+    if (mode == "coordinate")
+    {
+        coordinator.hybrid = hybrid;
+        coordinator.compact = compact;
+        coordinator.bvhCache = bvhCache;
+        coordinator.isa = isa;
+        coordinator.threads = threads;
+        return runCoordinator(xml_file_path, coordinator);
+    }
+
+    ThreadPool pool(threads);
+    if (mode == "worker")
+    {
+        return runWorker(xml_file_path, pool);
+    }
+    if (mode == "serve")
+    {
+        ServerOptions options;
+        options.hybrid = hybrid;
+        options.compact = compact;
+        options.bvhCache = bvhCache;
+        return runServer(xml_file_path, pool, options);
+    }
 
     parser::Scene scene;
-    scene.loadFromXml(xml_file_path);
+    if (parser::isBinaryScene(xml_file_path))
+    {
+        auto start = std::chrono::steady_clock::now();
+        scene.loadFromBinary(xml_file_path);
+        std::cout << "Loaded binary scene in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms" << std::endl;
+    }
+    else
+    {
+        scene.loadFromXml(xml_file_path, &pool);
+        const parser::ParseStats &stats = scene.parse_stats;
+        std::cout << "Parsed " << stats.bytes << " bytes of numeric data in " << stats.seconds * 1000 << " ms ("
+                  << (stats.seconds > 0 ? stats.bytes / stats.seconds / 1e6 : 0) << " MB/s)" << std::endl;
+    }
     std::string outputfile_name = scene.texture_image;
 
+    size_t faceCount = 0, faceBytes = 0;
+    for (const parser::Mesh &mesh : scene.meshes)
+    {
+        faceCount += mesh.faces.size();
+        faceBytes += mesh.faces.bytes();
+    }
+    std::cout << "Faces: " << faceCount << " stored in " << faceBytes << " bytes ("
+              << (faceCount ? (double)faceBytes / faceCount : 0) << " per face)" << std::endl;
+
+    if (compact)
+    {
+        size_t before = (scene.vertex_data.size() + scene.texture_data.size() + scene.normal_data.size()) * sizeof(parser::Vec3f);
+        scene.compactGeometry();
+        std::cout << "Compact geometry: " << before << " bytes of vertex, texture and normal data stored in "
+                  << scene.compact.bytes() << " bytes" << std::endl;
+    }
+
+    // all scene storage comes from one arena, released with the scene
+    const ArenaStats &arena = scene.arena.stats();
+    std::cout << "Scene arena: " << arena.allocations << " allocations, " << arena.bytes << " bytes (" << arena.freed
+              << " freed early) in " << arena.chunks << " chunks of " << arena.capacity << " bytes" << std::endl;
+
+    // the BVH is cached next to the scene, keyed by its geometry
+    CompiledScene compiled;
+    compileScene(scene, compiled, bvhCache ? xml_file_path + ".bvh" : "");
+    const BvhCacheInfo &cache = compiled.bvhCache;
+    if (cache.hit)
+    {
+        std::cout << "BVH cache hit: loaded " << compiled.nodes.size() << " nodes from " << cache.path << " in "
+                  << cache.seconds * 1000 << " ms" << std::endl;
+    }
+    else
+    {
+        std::cout << "BVH " << (cache.path.empty() ? "" : "cache miss: ") << "built " << compiled.nodes.size()
+                  << " nodes in " << cache.seconds * 1000 << " ms";
+        if (!cache.path.empty())
+            std::cout << (cache.written ? ", wrote " : ", could not write ") << cache.path;
+        std::cout << std::endl;
+    }
+
+    // Several cameras, from the scene or --cameras, render in one batch of
+    // tiles over the same BVH, each into a numbered copy of the output name.
+    std::vector<parser::Camera> views = scene.cameras;
+    if (!camerasPath.empty())
+    {
+        views.clear();
+        if (!readCameras(camerasPath, views) || views.empty())
+        {
+            std::cerr << "Error: cannot read cameras (position gaze up near_plane near_distance width height per line) from "
+                      << camerasPath << std::endl;
+            return 1;
+        }
+    }
+    if (views.size() > 1 && (singleView || hybrid))
+    {
+        std::cout << "Rendering the first of " << views.size() << " cameras" << std::endl;
+    }
+    else if (views.size() > 1 || !camerasPath.empty())
+    {
+        std::vector<std::vector<unsigned char>> frames(views.size());
+        std::vector<unsigned char *> images;
+        long viewPixels = 0;
+        for (size_t i = 0; i < views.size(); ++i)
+        {
+            frames[i].assign((size_t)views[i].image_width * views[i].image_height * 3, 0);
+            images.push_back(&frames[i][0]);
+            viewPixels += (long)views[i].image_width * views[i].image_height;
+        }
+        auto start = std::chrono::steady_clock::now();
+        renderViews(scene, compiled, pool, views, images);
+        std::cout << "Rendered " << views.size() << " views (" << viewPixels << " pixels) in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms on "
+                  << pool.size() << " threads" << std::endl;
+        for (size_t i = 0; i < views.size(); ++i)
+        {
+            std::string output = viewOutput(scene.texture_image, i, views.size());
+            writePpm(output, images[i], views[i].image_width, views[i].image_height);
+            std::cout << "View " << i + 1 << ": " << views[i].image_width << "x" << views[i].image_height << " -> " << output << std::endl;
+        }
+        return 0;
+    }
+
     parser::Camera &cam = scene.camera;
     int width = cam.image_width;
     int height = cam.image_height;
-    unsigned char *image = new unsigned char[width * height * 3];
 
-#pragma omp parallel for
-    for (int y = 0; y < height; ++y)
+    // An incremental render compares the scene with the one the --merge
+    // image was rendered from and renders only the tiles that can differ.
+    if (!incrementalPath.empty())
     {
-        for (int x = 0; x < width; ++x)
-        {
-            Ray ray = generateRay(cam, x, y);
-            Hit hit = sendRayToObjects(scene.maxraytracedepth, scene, ray);
-
-            // std::cout << "Pixel before hit [" << x << ", " << y<< "]: " << hit.pixel.x << " " << hit.pixel.y << " " << hit.pixel.z << std::endl;
-            int r = std::min(std::max(hit.pixel.x, 0), 255);
-            int g = std::min(std::max(hit.pixel.y, 0), 255);
-            int b = std::min(std::max(hit.pixel.z, 0), 255);
+        parser::Scene before;
+        if (parser::isBinaryScene(incrementalPath))
+            before.loadFromBinary(incrementalPath);
+        else
+            before.loadFromXml(incrementalPath, &pool);
+        if (compact)
+            before.compactGeometry();
+        auto start = std::chrono::steady_clock::now();
+        DirtyTiles dirty = findDirtyTiles(before, scene);
+        regions = dirty.regions;
+        std::cout << "Incremental: ";
+        if (!dirty.everything.empty())
+            std::cout << dirty.everything << ", rendering the whole frame";
+        else
+            std::cout << dirty.changedMeshes << " of " << scene.meshes.size() << " meshes changed, " << dirty.tiles << " of "
+                      << dirty.totalTiles << " tiles to render";
+        std::cout << " (" << 100.0 * dirty.pixels / ((double)width * height) << "% of the pixels), found in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms" << std::endl;
+    }
 
-            int index = (y * width + x) * 3;
-            image[index] = static_cast<unsigned char>(r);
-            image[index + 1] = static_cast<unsigned char>(g);
-            image[index + 2] = static_cast<unsigned char>(b);
-            std::cout << "Pixel [" << x << ", " << y << "]: " << r << " " << g << " " << b << std::endl;
+    // With regions only they are rendered, with the full frame's rays, into
+    // a crop of their bounding box or into the image given by --merge.
+    long pixels = regions.empty() && incrementalPath.empty() ? (long)width * height : 0;
+    ImageWindow target = {0, 0, 0, width, height};
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        const Region &region = regions[i];
+        if (region.x0 < 0 || region.y0 < 0 || region.x1 > width || region.y1 > height || region.x0 >= region.x1 || region.y0 >= region.y1)
+        {
+            std::cerr << "Error: region " << region.x0 << "," << region.y0 << "," << region.x1 << "," << region.y1
+                      << " is empty or outside the " << width << "x" << height << " frame" << std::endl;
+            return 1;
+        }
+        pixels += (long)(region.x1 - region.x0) * (region.y1 - region.y0);
+        if (merge.empty())
+        {
+            target.x0 = i == 0 ? region.x0 : std::min(target.x0, region.x0);
+            target.y0 = i == 0 ? region.y0 : std::min(target.y0, region.y0);
+            target.x1 = i == 0 ? region.x1 : std::max(target.x1, region.x1);
+            target.y1 = i == 0 ? region.y1 : std::max(target.y1, region.y1);
+        }
+    }
+    std::vector<unsigned char> image;
+    if (!merge.empty())
+    {
+        int mergeWidth, mergeHeight;
+        readPpm(merge, image, mergeWidth, mergeHeight);
+        if (mergeWidth != width || mergeHeight != height)
+        {
+            std::cerr << "Error: " << merge << " is " << mergeWidth << "x" << mergeHeight << ", not the " << width << "x" << height << " frame" << std::endl;
+            return 1;
         }
     }
+    else
+    {
+        image.assign((size_t)(target.x1 - target.x0) * (target.y1 - target.y0) * 3, 0);
+    }
+    target.image = &image[0];
+
+    // A checkpointed render saves the finished tiles (and a progressive one
+    // its samples) every checkpoint interval and when it is stopped; --resume
+    // continues from the file if it was written for this scene and camera.
+    bool checkpointing = !checkpointPath.empty();
+    Checkpoint keys;
+    if (checkpointing)
+    {
+        keys.sceneKey = sceneHash(scene);
+        keys.cameraKey = cameraHash(cam);
+        keys.width = width;
+        keys.height = height;
+    }
+    CheckpointWriter checkpoint(checkpointPath, checkpointInterval, keys);
+    Checkpoint resumed;
+    bool resuming = false;
+    if (resume && !std::ifstream(checkpointPath.c_str()))
+    {
+        std::cout << "No checkpoint at " << checkpointPath << ", starting from the beginning" << std::endl;
+    }
+    else if (resume)
+    {
+        std::string error;
+        if (!loadCheckpoint(checkpointPath, keys.sceneKey, keys.cameraKey, resumed, error))
+        {
+            std::cerr << "Error: cannot resume: " << error << std::endl;
+            return 1;
+        }
+        if (resumed.samples > 0 && !progressiveMode)
+        {
+            std::cerr << "Error: cannot resume: " << checkpointPath << " holds a progressive render (--progressive)" << std::endl;
+            return 1;
+        }
+        int finished = 0;
+        for (unsigned char tile : resumed.tiles)
+            finished += tile;
+        std::cout << "Resuming from " << checkpointPath << ": " << finished << " of " << resumed.tiles.size() << " tiles";
+        if (progressiveMode)
+            std::cout << " of sample " << resumed.samples + 1;
+        std::cout << std::endl;
+        resuming = true;
+    }
+    if (progressiveMode || checkpointing)
+    {
+        std::signal(SIGINT, interrupt);
+        std::signal(SIGTERM, interrupt);
+    }
 
-    FILE *outfile = fopen(scene.texture_image.c_str(), "w");
-    if (!outfile)
+    // A progressive render snapshots the image into the output while it
+    // refines it, and stops early on Ctrl-C.
+    // With a deadline the image and the quality it reached, written into
+    // the output's header, depend on how fast this machine renders the scene.
+    RenderStats stats;
+    bool stopped = false;
+    std::vector<std::string> metadata;
+    if (deadlineSeconds > 0)
+    {
+        DeadlineOptions deadline;
+        deadline.seconds = deadlineSeconds;
+        if (progressiveMode)
+            deadline.maxSamples = progressive.samples;
+        deadline.previewScale = progressive.previewScale;
+        deadline.hybrid = hybrid;
+        DeadlineStats result = renderDeadline(scene, compiled, pool, deadline, target.image);
+        std::cout << "Deadline: " << result.seconds * 1000 << " of " << deadlineSeconds * 1000 << " ms, "
+                  << (result.scale == 0 ? "no image" : result.scale == 1 ? "full resolution" : "1/" + std::to_string(result.scale) + " resolution")
+                  << ", " << result.samples << " samples per pixel (" << result.planned << " planned, at most " << deadline.maxSamples
+                  << "), " << result.pixelsPerSecond << " pixels/s" << (result.expired ? ", last pass cut at the deadline" : "") << std::endl;
+        metadata.push_back("deadline=" + std::to_string(deadlineSeconds) + " seconds=" + std::to_string(result.seconds) +
+                           " expired=" + std::to_string(result.expired ? 1 : 0));
+        metadata.push_back("scale=" + std::to_string(result.scale) + " samples=" + std::to_string(result.samples) +
+                           " planned=" + std::to_string(result.planned) + " max_samples=" + std::to_string(deadline.maxSamples) +
+                           " maxraytracedepth=" + std::to_string(scene.maxraytracedepth));
+        metadata.push_back("pixels_per_second=" + std::to_string(result.pixelsPerSecond));
+    }
+    else if (adaptiveMode)
+    {
+        adaptive.hybrid = hybrid;
+        std::vector<int> counts;
+        AdaptiveStats result = renderAdaptive(scene, compiled, pool, adaptive, target.image, &counts);
+        std::cout << "Adaptive: " << result.refined << " of " << pixels << " pixels refined in " << result.rounds << " rounds, "
+                  << (double)result.samples / pixels << " samples per pixel on average (at most " << adaptive.maxSamples << ")" << std::endl;
+        if (!sampleMap.empty())
+        {
+            std::vector<unsigned char> map;
+            sampleCountImage(counts, adaptive.maxSamples, map);
+            writePpm(sampleMap, &map[0], width, height, {"samples per pixel, white = " + std::to_string(adaptive.maxSamples)});
+            std::cout << "Sample counts written to " << sampleMap << std::endl;
+        }
+    }
+    else if (progressiveMode)
+    {
+        progressive.hybrid = hybrid;
+        progressive.snapshotPath = scene.texture_image;
+        progressive.checkpoint = checkpointing ? &checkpoint : 0;
+        progressive.resume = resuming ? &resumed : 0;
+        ProgressiveStats result = renderProgressive(scene, compiled, pool, progressive, target.image, &interrupted);
+        stats = result.render;
+        stopped = result.stopped;
+        pixels *= result.samples;
+        std::cout << "Progressive: " << result.samples << " of " << progressive.samples << " samples per pixel"
+                  << (result.preview ? " (coarse preview only)" : "") << (result.stopped ? ", stopped early" : "")
+                  << ", " << result.snapshots << " snapshots" << std::endl;
+    }
+    else if (!gbufferPath.empty())
+    {
+        // primary hits come from the cache while geometry and camera match
+        PrimaryHits hits;
+        std::string reason;
+        uint64_t geometryKey = geometryHash(scene), cameraKey = cameraHash(cam);
+        auto start = std::chrono::steady_clock::now();
+        if (loadHitCache(gbufferPath, geometryKey, cameraKey, hits, reason))
+        {
+            std::cout << "Hit cache hit: loaded primary hits from " << gbufferPath << " in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms" << std::endl;
+        }
+        else
+        {
+            tracePrimaryHits(scene, compiled, pool, hits);
+            bool written = saveHitCache(gbufferPath, geometryKey, cameraKey, hits);
+            std::cout << "Hit cache miss (" << reason << "): traced primary hits in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms"
+                      << (written ? ", wrote " : ", could not write ") << gbufferPath << std::endl;
+        }
+        start = std::chrono::steady_clock::now();
+        shadePrimaryHits(scene, compiled, pool, hits, target.image);
+        std::cout << "Shaded " << (long)width * height << " pixels from primary hits in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms" << std::endl;
+    }
+    else if (checkpointing)
     {
-        perror("Error opening file");
-        delete[] image;
-        throw std::runtime_error("Error: The ppm file cannot be opened for writing.");
+        TileProgress progress;
+        if (resuming)
+        {
+            std::copy(resumed.image.begin(), resumed.image.end(), image.begin());
+            progress.restore(resumed.tiles);
+        }
+        checkpoint.capture = [&](Checkpoint &state) { captureFrame(progress, target.image, width, height, state); };
+        progress.onTile = [&]() { checkpoint.tick(); };
+        stats = renderImage(scene, compiled, pool, hybrid, target.image, &interrupted, &progress);
+        if (stats.cancelled)
+        {
+            checkpoint.save();
+            std::cerr << "Interrupted: the finished tiles are saved in " << checkpointPath << ", continue with --resume" << std::endl;
+            return 1;
+        }
+    }
+    else if (regions.empty() && !incrementalPath.empty())
+    {
+        std::cout << "Nothing changed: the output is a copy of " << merge << std::endl;
+    }
+    else
+    {
+        stats = regions.empty() ? renderImage(scene, compiled, pool, hybrid, target.image)
+                                : renderRegions(scene, compiled, pool, hybrid, regions, target);
+    }
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    if (checkpointing)
+    {
+        std::cout << "Checkpoints: " << checkpoint.saves() << " written"
+                  << (stopped ? ", resume with --resume" : ", removed now that the render is complete") << std::endl;
+        if (!stopped)
+            checkpoint.discard();
+    }
+    if (hybrid && deadlineSeconds == 0 && !adaptiveMode && gbufferPath.empty())
+    {
+        std::cout << "Hybrid raster: " << stats.undecided << " of " << pixels
+                  << " pixels undecided by the z-buffer (" << stats.clipped << " triangles behind the camera)" << std::endl;
+    }
+    if (!regions.empty())
+    {
+        std::cout << "Rendered " << regions.size() << " regions (" << pixels << " pixels) into "
+                  << (merge.empty() ? "a crop at " + std::to_string(target.x0) + ", " + std::to_string(target.y0) : merge) << std::endl;
     }
 
-    fprintf(outfile, "P3\n%d %d\n255\n", width, height);
-    for (size_t j = 0, idx = 0; j < height; ++j)
+    for (int y = target.y0; y < target.y1; ++y)
     {
-        for (size_t i = 0; i < width; ++i)
+        for (int x = target.x0; x < target.x1; ++x)
         {
-            for (size_t c = 0; c < 3; ++c, ++idx)
-            {
-                if (i == width - 1 && c == 2)
-                {
-                    fprintf(outfile, "%d", image[idx]);
-                }
-                else
-                {
-                    fprintf(outfile, "%d ", image[idx]);
-                }
-            }
+            int index = target.index(x, y) * 3;
+            int r = image[index];
+            int g = image[index + 1];
+            int b = image[index + 2];
+            std::cout << "Pixel [" << x << ", " << y << "]: " << r << " " << g << " " << b << std::endl;
         }
-        fprintf(outfile, "\n");
     }
-    fclose(outfile);
 
-    delete[] image;
+    writePpm(scene.texture_image, target.image, target.x1 - target.x0, target.y1 - target.y0, metadata);
 
     /*
      *
@@ -200,8 +832,9 @@ int main(int argc, char *argv[])
 
         // Vertex data
         std::cout << "Vertex Data: " << std::endl;
-        for (const auto &vertex : scene.vertex_data)
+        for (int id = 1; id <= scene.vertexCount(); ++id)
         {
+            parser::Vec3f vertex = scene.vertex(id);
             std::cout << "  " << vertex.x << " "
                       << vertex.y << " "
                       << vertex.z << std::endl;
@@ -209,16 +842,18 @@ int main(int argc, char *argv[])
 
         // Texture data
         std::cout << "Texture Data: " << std::endl;
-        for (const auto &texture : scene.texture_data)
+        for (int id = 1; id <= scene.texcoordCount(); ++id)
         {
+            parser::Vec3f texture = scene.texcoord(id);
             std::cout << "  " << texture.x << " "
                       << texture.y << std::endl;
         }
 
         // Normal data
         std::cout << "Normal Data: " << std::endl;
-        for (const auto &normal : scene.normal_data)
+        for (int id = 1; id <= scene.normalCount(); ++id)
         {
+            parser::Vec3f normal = scene.normal(id);
             std::cout << "  " << normal.x << " "
                       << normal.y << " "
                       << normal.z << std::endl;
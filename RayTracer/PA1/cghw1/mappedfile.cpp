@@ -0,0 +1,32 @@
+#include "mappedfile.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+    if (bytes)
+        munmap((void *)bytes, length);
+}
+
+bool MappedFile::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+    if (bytes)
+        munmap((void *)bytes, length);
+    bytes = (const unsigned char *)mapping;
+    length = info.st_size;
+    return true;
+}
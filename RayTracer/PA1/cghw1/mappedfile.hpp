@@ -0,0 +1,29 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file with a sequential access hint,
+// released on destruction.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile();
+
+    // false for files that are missing, empty or cannot be mapped
+    bool open(const std::string &path);
+
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    const unsigned char *bytes = 0;
+    size_t length = 0;
+};
+
+#endif
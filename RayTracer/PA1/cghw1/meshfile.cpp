@@ -0,0 +1,429 @@
+#include "meshfile.hpp"
+#include "mappedfile.hpp"
+#include "scanner.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using namespace parser;
+
+namespace
+{
+    std::runtime_error fileError(const std::string &path, const std::string &message)
+    {
+        return std::runtime_error("Error: " + path + ": " + message);
+    }
+
+    std::runtime_error lineError(const std::string &path, int line, const std::string &message)
+    {
+        return fileError(path, "line " + std::to_string(line) + ": " + message);
+    }
+
+    inline bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Normals and uvs for the corners that have none, and an index check.
+    void completeFaces(const std::string &path, MeshFile &file)
+    {
+        int fallbackUv = 0;
+        for (Face &face : file.faces) {
+            int *v[3] = {&face.v1_id, &face.v2_id, &face.v3_id};
+            int *t[3] = {&face.t1_id, &face.t2_id, &face.t3_id};
+            int *n[3] = {&face.n1_id, &face.n2_id, &face.n3_id};
+            for (int c = 0; c < 3; ++c) {
+                if (*v[c] < 1 || *v[c] > (int)file.vertices.size() || *t[c] < 0 || *t[c] > (int)file.texcoords.size() ||
+                    *n[c] < 0 || *n[c] > (int)file.normals.size())
+                    throw fileError(path, "face index out of range.");
+            }
+
+            if (!*n[0] || !*n[1] || !*n[2]) {
+                Vec3f v0 = file.vertices[face.v1_id - 1];
+                Vec3f normal = normalize(cross(file.vertices[face.v2_id - 1] - v0, file.vertices[face.v3_id - 1] - v0));
+                file.normals.push_back(normal);
+                for (int c = 0; c < 3; ++c)
+                    *n[c] = (int)file.normals.size();
+            }
+            for (int c = 0; c < 3; ++c) {
+                if (*t[c])
+                    continue;
+                if (!fallbackUv) {
+                    file.texcoords.push_back(Vec3f{0, 0, 0});
+                    fallbackUv = (int)file.texcoords.size();
+                }
+                *t[c] = fallbackUv;
+            }
+        }
+    }
+
+    void addPolygon(const std::vector<int> &corners, MeshFile &file)
+    {
+        // corners holds v, t, n per corner; 0 means absent
+        size_t count = corners.size() / 3;
+        for (size_t c = 2; c < count; ++c) {
+            const int *a = &corners[0], *b = &corners[3 * (c - 1)], *d = &corners[3 * c];
+            file.faces.push_back(Face{a[0], a[1], a[2], b[0], b[1], b[2], d[0], d[1], d[2]});
+        }
+    }
+
+    // One index of an OBJ corner: 1-based, or negative counting back from
+    // the last element defined so far.
+    bool objIndex(const char *&p, const char *end, size_t count, int &index)
+    {
+        int value;
+        if (p == end || isBlank(*p) || !scanInt(p, end, value) || value == 0)
+            return false;
+        index = value > 0 ? value : (int)count + value + 1;
+        return index >= 1;
+    }
+
+    void loadObj(const std::string &path, const char *p, const char *end, MeshFile &file)
+    {
+        std::vector<int> corners;
+        for (int line = 1; p < end; ++line) {
+            const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+            if (!lineEnd)
+                lineEnd = end;
+            while (p < lineEnd && isBlank(*p))
+                ++p;
+            const char *keyword = p;
+            while (p < lineEnd && !isBlank(*p))
+                ++p;
+            size_t length = p - keyword;
+
+            if (length == 1 && keyword[0] == 'v') {
+                Vec3f vertex;
+                if (!scanFloat(p, lineEnd, vertex.x) || !scanFloat(p, lineEnd, vertex.y) || !scanFloat(p, lineEnd, vertex.z))
+                    throw lineError(path, line, "bad vertex.");
+                file.vertices.push_back(vertex);
+            } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+                Vec3f uv = {0, 0, 0};
+                if (!scanFloat(p, lineEnd, uv.x))
+                    throw lineError(path, line, "bad texture coordinate.");
+                scanFloat(p, lineEnd, uv.y);
+                file.texcoords.push_back(uv);
+            } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+                Vec3f normal;
+                if (!scanFloat(p, lineEnd, normal.x) || !scanFloat(p, lineEnd, normal.y) || !scanFloat(p, lineEnd, normal.z))
+                    throw lineError(path, line, "bad normal.");
+                file.normals.push_back(normal);
+            } else if (length == 1 && keyword[0] == 'f') {
+                // v, v/t, v//n or v/t/n per corner
+                corners.clear();
+                for (;;) {
+                    while (p < lineEnd && isBlank(*p))
+                        ++p;
+                    if (p == lineEnd)
+                        break;
+                    int v = 0, t = 0, n = 0;
+                    bool valid = objIndex(p, lineEnd, file.vertices.size(), v);
+                    if (valid && p < lineEnd && *p == '/') {
+                        ++p;
+                        if (p < lineEnd && *p != '/')
+                            valid = objIndex(p, lineEnd, file.texcoords.size(), t);
+                        if (valid && p < lineEnd && *p == '/') {
+                            ++p;
+                            valid = objIndex(p, lineEnd, file.normals.size(), n);
+                        }
+                    }
+                    if (!valid || (p < lineEnd && !isBlank(*p)))
+                        throw lineError(path, line, "bad face corner.");
+                    corners.push_back(v);
+                    corners.push_back(t);
+                    corners.push_back(n);
+                }
+                if (corners.size() < 9)
+                    throw lineError(path, line, "face with fewer than 3 corners.");
+                addPolygon(corners, file);
+            }
+            // groups, objects, smoothing groups, materials and comments are ignored
+            p = lineEnd + 1;
+        }
+    }
+
+    enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+    bool plyType(const std::string &name, PlyType &type)
+    {
+        static const char *names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+                                         {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}};
+        for (int i = 0; i < 8; ++i) {
+            if (name == names[i][0] || name == names[i][1]) {
+                type = (PlyType)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const size_t plySizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+
+    struct PlyProperty
+    {
+        std::string name;
+        PlyType type;
+        bool list = false;
+        PlyType countType;
+    };
+
+    struct PlyElement
+    {
+        std::string name;
+        size_t count;
+        std::vector<PlyProperty> properties;
+    };
+
+    // Reads one binary value of type at p and advances past it.
+    class PlyReader
+    {
+    public:
+        PlyReader(const std::string &path, const unsigned char *p, const unsigned char *end, bool bigEndian)
+            : path(path), p(p), end(end), bigEndian(bigEndian) {}
+
+        double read(PlyType type)
+        {
+            size_t size = plySizes[type];
+            if ((size_t)(end - p) < size)
+                throw fileError(path, "unexpected end of the PLY data.");
+            unsigned char bytes[8];
+            memcpy(bytes, p, size);
+            p += size;
+            if (bigEndian)
+                std::reverse(bytes, bytes + size);
+
+            switch (type) {
+            case PLY_INT8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+            case PLY_UINT8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+            case PLY_INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+            case PLY_UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+            case PLY_INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+            case PLY_UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+            case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+            default: { double v; memcpy(&v, bytes, 8); return v; }
+            }
+        }
+
+    private:
+        const std::string &path;
+        const unsigned char *p, *end;
+        bool bigEndian;
+    };
+
+    void loadPly(const std::string &path, const unsigned char *data, size_t size, MeshFile &file)
+    {
+        static const char END_HEADER[] = "end_header";
+        const char *text = (const char *)data;
+        const char *headerEnd = std::search(text, text + size, END_HEADER, END_HEADER + sizeof(END_HEADER) - 1);
+        const char *body = headerEnd == text + size ? 0 : (const char *)memchr(headerEnd, '\n', text + size - headerEnd);
+        if (size < 4 || memcmp(text, "ply", 3) != 0 || !body)
+            throw fileError(path, "not a PLY file.");
+        ++body;
+
+        std::stringstream header(std::string(text, headerEnd));
+        std::string line, format;
+        std::vector<PlyElement> elements;
+        while (std::getline(header, line)) {
+            std::stringstream words(line);
+            std::string keyword;
+            words >> keyword;
+            if (keyword == "format") {
+                words >> format;
+            } else if (keyword == "element") {
+                PlyElement element;
+                if (!(words >> element.name >> element.count))
+                    throw fileError(path, "bad PLY element: " + line);
+                elements.push_back(element);
+            } else if (keyword == "property") {
+                PlyProperty property;
+                std::string type;
+                words >> type;
+                if (type == "list") {
+                    std::string countType;
+                    words >> countType >> type;
+                    property.list = plyType(countType, property.countType);
+                    if (!property.list)
+                        type.clear();
+                }
+                if (elements.empty() || !plyType(type, property.type) || !(words >> property.name))
+                    throw fileError(path, "bad PLY property: " + line);
+                elements.back().properties.push_back(property);
+            }
+        }
+        if (format != "binary_little_endian" && format != "binary_big_endian")
+            throw fileError(path, "only binary PLY files are supported.");
+
+        PlyReader reader(path, (const unsigned char *)body, data + size, format == "binary_big_endian");
+        std::vector<double> values;
+        std::vector<int> corners;
+        bool hasNormals = false, hasUvs = false;
+        for (const PlyElement &element : elements) {
+            // property slots of the vertex attributes, -1 when absent
+            int slot[8];
+            static const char *attributes[8][4] = {
+                {"x"}, {"y"}, {"z"}, {"nx"}, {"ny"}, {"nz"},
+                {"u", "s", "texture_u", "texture_s"}, {"v", "t", "texture_v", "texture_t"}};
+            for (int a = 0; a < 8; ++a) {
+                slot[a] = -1;
+                for (size_t i = 0; i < element.properties.size(); ++i)
+                    for (int k = 0; k < 4 && attributes[a][k]; ++k)
+                        if (element.properties[i].name == attributes[a][k] && !element.properties[i].list)
+                            slot[a] = (int)i;
+            }
+            bool vertices = element.name == "vertex";
+            bool faces = element.name == "face";
+            if (vertices) {
+                if (slot[0] < 0 || slot[1] < 0 || slot[2] < 0)
+                    throw fileError(path, "PLY vertices without x, y and z.");
+                hasNormals = slot[3] >= 0 && slot[4] >= 0 && slot[5] >= 0;
+                hasUvs = slot[6] >= 0 && slot[7] >= 0;
+            }
+
+            values.resize(element.properties.size());
+            for (size_t item = 0; item < element.count; ++item) {
+                for (size_t i = 0; i < element.properties.size(); ++i) {
+                    const PlyProperty &property = element.properties[i];
+                    if (!property.list) {
+                        values[i] = reader.read(property.type);
+                        continue;
+                    }
+                    double count = reader.read(property.countType);
+                    bool indices = faces && (property.name == "vertex_indices" || property.name == "vertex_index");
+                    if (count < 0 || count > 1e9)
+                        throw fileError(path, "bad PLY list length.");
+                    if (indices) {
+                        if (count < 3)
+                            throw fileError(path, "PLY face with fewer than 3 corners.");
+                        corners.clear();
+                    }
+                    for (int k = 0; k < (int)count; ++k) {
+                        double index = reader.read(property.type);
+                        if (!indices)
+                            continue;
+                        if (index < 0 || index >= 2147483647.0)
+                            throw fileError(path, "face index out of range.");
+                        // normals and uvs are per vertex
+                        int id = (int)index + 1;
+                        corners.push_back(id);
+                        corners.push_back(hasUvs ? id : 0);
+                        corners.push_back(hasNormals ? id : 0);
+                    }
+                    if (indices)
+                        addPolygon(corners, file);
+                }
+                if (vertices) {
+                    file.vertices.push_back(Vec3f{(float)values[slot[0]], (float)values[slot[1]], (float)values[slot[2]]});
+                    if (hasNormals)
+                        file.normals.push_back(Vec3f{(float)values[slot[3]], (float)values[slot[4]], (float)values[slot[5]]});
+                    if (hasUvs)
+                        file.texcoords.push_back(Vec3f{(float)values[slot[6]], (float)values[slot[7]], 0});
+                }
+            }
+        }
+    }
+
+    std::string extension(const std::string &path)
+    {
+        size_t dot = path.find_last_of("./");
+        std::string result = dot == std::string::npos || path[dot] != '.' ? "" : path.substr(dot + 1);
+        for (char &c : result)
+            c = (char)tolower((unsigned char)c);
+        return result;
+    }
+}
+
+void parser::loadMeshFile(const std::string &path, MeshFile &out)
+{
+    std::string type = extension(path);
+    if (type != "obj" && type != "ply")
+        throw fileError(path, "unknown mesh file type, expected .obj or .ply.");
+    MappedFile file;
+    if (!file.open(path))
+        throw fileError(path, "the mesh file cannot be loaded.");
+
+    out = MeshFile();
+    out.bytes = file.size();
+    if (type == "obj")
+        loadObj(path, (const char *)file.data(), (const char *)file.data() + file.size(), out);
+    else
+        loadPly(path, file.data(), file.size(), out);
+    completeFaces(path, out);
+}
+
+void parser::mergeMeshFiles(Scene &scene, const std::vector<MeshFileReference> &references, ThreadPool *pool)
+{
+    // the same file through different paths is still loaded once
+    std::vector<std::string> paths;
+    std::map<std::string, int> known;
+    std::vector<int> fileOf;
+    for (const MeshFileReference &reference : references) {
+        std::string key = reference.path;
+        if (char *resolved = realpath(reference.path.c_str(), 0)) {
+            key = resolved;
+            free(resolved);
+        }
+        auto found = known.find(key);
+        if (found == known.end()) {
+            found = known.insert(std::make_pair(key, (int)paths.size())).first;
+            paths.push_back(reference.path);
+        }
+        fileOf.push_back(found->second);
+    }
+
+    std::vector<MeshFile> files(paths.size());
+    std::vector<std::string> errors(paths.size());
+    auto load = [&](int i) {
+        try {
+            loadMeshFile(paths[i], files[i]);
+        } catch (const std::exception &error) {
+            errors[i] = error.what();
+        }
+    };
+    if (pool)
+        pool->parallelFor((int)paths.size(), load);
+    else
+        for (int i = 0; i < (int)paths.size(); ++i)
+            load(i);
+    for (const std::string &error : errors)
+        if (!error.empty())
+            throw std::runtime_error(error);
+
+    // one reallocation per array, with the inline data copied once
+    size_t vertices = scene.vertex_data.size(), texcoords = scene.texture_data.size(), normals = scene.normal_data.size();
+    for (const MeshFile &file : files) {
+        vertices += file.vertices.size();
+        texcoords += file.texcoords.size();
+        normals += file.normals.size();
+    }
+    scene.vertex_data.reserve(vertices);
+    scene.texture_data.reserve(texcoords);
+    scene.normal_data.reserve(normals);
+
+    std::vector<Face> offsets(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        int v = (int)scene.vertex_data.size(), t = (int)scene.texture_data.size(), n = (int)scene.normal_data.size();
+        offsets[i] = Face{v, t, n, v, t, n, v, t, n};
+        scene.vertex_data.insert(scene.vertex_data.end(), files[i].vertices.begin(), files[i].vertices.end());
+        scene.texture_data.insert(scene.texture_data.end(), files[i].texcoords.begin(), files[i].texcoords.end());
+        scene.normal_data.insert(scene.normal_data.end(), files[i].normals.begin(), files[i].normals.end());
+        scene.parse_stats.bytes += files[i].bytes;
+    }
+
+    for (size_t r = 0; r < references.size(); ++r) {
+        const Face &offset = offsets[fileOf[r]];
+        std::vector<Face> faces;
+        faces.reserve(files[fileOf[r]].faces.size());
+        for (const Face &face : files[fileOf[r]].faces) {
+            faces.push_back(Face{face.v1_id + offset.v1_id, face.t1_id + offset.t1_id, face.n1_id + offset.n1_id,
+                                 face.v2_id + offset.v2_id, face.t2_id + offset.t2_id, face.n2_id + offset.n2_id,
+                                 face.v3_id + offset.v3_id, face.t3_id + offset.t3_id, face.n3_id + offset.n3_id});
+        }
+        scene.meshes[references[r].mesh].faces.append(faces);
+    }
+}
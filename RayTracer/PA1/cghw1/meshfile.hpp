@@ -0,0 +1,42 @@
+#ifndef __HW1__MESHFILE__
+#define __HW1__MESHFILE__
+
+#include "parser.hpp"
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+namespace parser
+{
+    // Geometry of one external mesh file. Face ids are 1-based into the
+    // file's own arrays, as in the scene.
+    struct MeshFile
+    {
+        std::vector<Vec3f> vertices;
+        std::vector<Vec3f> texcoords;
+        std::vector<Vec3f> normals;
+        std::vector<Face> faces;
+        size_t bytes = 0;
+    };
+
+    // A mesh's <file> element, with the path resolved against the scene file.
+    struct MeshFileReference
+    {
+        int mesh;
+        std::string path;
+    };
+
+    // Wavefront OBJ (v, vt, vn and f; polygons are fanned into triangles) or
+    // binary PLY, picked by the extension. Corners without a normal get the
+    // face normal and corners without a uv get (0, 0), both added to the
+    // file's arrays. Errors throw std::runtime_error.
+    void loadMeshFile(const std::string &path, MeshFile &out);
+
+    // Loads every referenced file once, one pool task per file, appends the
+    // arrays of each to the scene's in order of first reference and adds
+    // its faces, offset into them, to every mesh that references it.
+    void mergeMeshFiles(Scene &scene, const std::vector<MeshFileReference> &references, ThreadPool *pool = 0);
+}
+
+#endif
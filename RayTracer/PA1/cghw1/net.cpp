@@ -0,0 +1,227 @@
+#include "net.hpp"
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+static bool isPath(const std::string &address)
+{
+    return address.find('/') != std::string::npos;
+}
+
+static bool unixAddress(const std::string &path, sockaddr_un &address, std::string &error)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        error = "socket path '" + path + "' is too long";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// host:port, with an IPv6 host in brackets
+static bool splitHostPort(const std::string &address, std::string &host, std::string &port, std::string &error)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) {
+        error = "address '" + address + "' is neither a socket path nor host:port";
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')
+        host = host.substr(1, host.size() - 2);
+    return true;
+}
+
+static addrinfo *resolve(const std::string &address, bool passive, std::string &host, std::string &error)
+{
+    std::string port;
+    if (!splitHostPort(address, host, port, error))
+        return 0;
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo *list = 0;
+    int status = getaddrinfo(host.empty() ? 0 : host.c_str(), port.c_str(), &hints, &list);
+    if (status != 0) {
+        error = "cannot resolve '" + address + "': " + gai_strerror(status);
+        return 0;
+    }
+    return list;
+}
+
+int listenOn(const std::string &address, std::string &bound, std::string &error)
+{
+    if (isPath(address)) {
+        sockaddr_un local;
+        if (!unixAddress(address, local, error))
+            return -1;
+        struct stat info;
+        if (stat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(address.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (sockaddr *)&local, sizeof(local)) != 0 || listen(fd, 64) != 0) {
+            error = "cannot listen on " + address + ": " + std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        bound = address;
+        return fd;
+    }
+
+    std::string host;
+    addrinfo *list = resolve(address, true, host, error);
+    if (!list)
+        return -1;
+    int fd = -1;
+    for (addrinfo *entry = list; entry && fd < 0; entry = entry->ai_next) {
+        fd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+        if (fd < 0)
+            continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, entry->ai_addr, entry->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+            error = "cannot listen on " + address + ": " + std::strerror(errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_storage local;
+    socklen_t length = sizeof(local);
+    char port[NI_MAXSERV];
+    if (getsockname(fd, (sockaddr *)&local, &length) != 0 ||
+        getnameinfo((sockaddr *)&local, length, 0, 0, port, sizeof(port), NI_NUMERICSERV) != 0) {
+        bound = address;
+    } else {
+        bound = (host.find(':') != std::string::npos ? "[" + host + "]" : host) + ":" + port;
+    }
+    return fd;
+}
+
+void closeListener(int fd, const std::string &address)
+{
+    close(fd);
+    if (isPath(address))
+        unlink(address.c_str());
+}
+
+int connectTo(const std::string &address, std::string &error)
+{
+    if (isPath(address)) {
+        sockaddr_un remote;
+        if (!unixAddress(address, remote, error))
+            return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr *)&remote, sizeof(remote)) != 0) {
+            error = "cannot connect to " + address + ": " + std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    std::string host;
+    addrinfo *list = resolve(address, false, host, error);
+    if (!list)
+        return -1;
+    int fd = -1;
+    for (addrinfo *entry = list; entry && fd < 0; entry = entry->ai_next) {
+        fd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, entry->ai_addr, entry->ai_addrlen) != 0) {
+            error = "cannot connect to " + address + ": " + std::strerror(errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    // requests are short lines answered at once
+    int on = 1;
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+bool sendAll(int fd, const void *data, size_t bytes)
+{
+    const char *next = (const char *)data;
+    while (bytes > 0) {
+        ssize_t count = send(fd, next, bytes, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        next += count;
+        bytes -= count;
+    }
+    return true;
+}
+
+bool sendLine(int fd, const std::string &line)
+{
+    std::string text = line + "\n";
+    return sendAll(fd, text.data(), text.size());
+}
+
+bool SocketReader::fill()
+{
+    char buffer[65536];
+    while (true) {
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        pending.append(buffer, count);
+        return true;
+    }
+}
+
+bool SocketReader::readLine(std::string &line, size_t maxLength)
+{
+    size_t newline;
+    while ((newline = pending.find('\n')) == std::string::npos) {
+        if (pending.size() > maxLength)
+            return false;
+        if (!fill()) {
+            if (pending.empty())
+                return false;
+            newline = pending.size();
+            pending += '\n';
+            break;
+        }
+    }
+    line = pending.substr(0, newline);
+    pending.erase(0, newline + 1);
+    if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+    return true;
+}
+
+bool SocketReader::read(void *data, size_t bytes)
+{
+    while (pending.size() < bytes)
+        if (!fill())
+            return false;
+    std::memcpy(data, pending.data(), bytes);
+    pending.erase(0, bytes);
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef NET_HPP
+#define NET_HPP
+
+#include <cstddef>
+#include <string>
+
+// Stream sockets named by an address string: anything containing a '/' is
+// the path of a UNIX-domain socket, anything else is host:port for TCP (an
+// empty host listens on every interface). Failures return -1 with a message
+// in error.
+
+// Listens on address, replacing a socket file left behind by a killed
+// process. bound receives the address clients should use, with the port
+// filled in when port 0 picked one.
+int listenOn(const std::string &address, std::string &bound, std::string &error);
+// Closes a listening socket and removes its socket file, if any.
+void closeListener(int fd, const std::string &address);
+int connectTo(const std::string &address, std::string &error);
+
+// Block until everything is sent; false once the peer has gone.
+bool sendAll(int fd, const void *data, size_t bytes);
+bool sendLine(int fd, const std::string &line);
+
+// Reads newline-terminated lines and raw blocks from a blocking socket.
+class SocketReader
+{
+public:
+    explicit SocketReader(int fd) : fd(fd) {}
+
+    // Next line without its newline (and '\r'); a last line may end with
+    // the input instead. False at the end of input, on an error or when no
+    // newline comes within maxLength bytes.
+    bool readLine(std::string &line, size_t maxLength = 1 << 16);
+    bool read(void *data, size_t bytes);
+
+private:
+    bool fill();
+
+    int fd;
+    std::string pending;
+};
+
+#endif
@@ -1,256 +1,337 @@
 #include "parser.hpp"
-#include "tinyxml2.h"
+#include "scanner.hpp"
+#include "xmlreader.hpp"
+#include "meshfile.hpp"
 #include <sstream>
 #include <stdexcept>
-#include <algorithm> 
+#include <chrono>
+#include <map>
+#include <set>
+#include <sys/stat.h>
 
-void parser::Scene::loadFromXml(const std::string &filepath) {
-    tinyxml2::XMLDocument file;
-    std::stringstream stream;
+// Texts of the children of the current element, the first of each name.
+typedef std::map<std::string, std::string> ChildTexts;
 
-    auto res = file.LoadFile(filepath.c_str());
-    if (res) {
-        throw std::runtime_error("Error: The xml file cannot be loaded.");
+static ChildTexts readChildTexts(parser::XmlReader &reader) {
+    ChildTexts texts;
+    reader.enter();
+    while (reader.nextElement()) {
+        if (!texts.count(reader.name())) {
+            texts[reader.name()] = reader.readText();
+        }
     }
+    return texts;
+}
 
-    auto root = file.RootElement(); 
-    if (!root) {
-        throw std::runtime_error("Error: Root element not found.");
+// Adds the text of a child followed by a space, if the child exists.
+static void appendChild(std::stringstream &stream, const ChildTexts &texts, const char *name) {
+    auto child = texts.find(name);
+    if (child != texts.end()) stream << child->second << " ";
+}
+
+// Streams a numeric block from the file straight into out.
+template <typename T, typename Allocator>
+static void streamBlock(parser::XmlReader &reader, std::vector<T, Allocator> &out, int group, ThreadPool *pool, parser::ParseStats &stats) {
+    auto start = std::chrono::steady_clock::now();
+    parser::BlockScanner<T, Allocator> scanner(out, group);
+    reader.streamText([&](const char *begin, const char *end) {
+        scanner.scan(begin, end, pool);
+        stats.bytes += end - begin;
+    });
+    scanner.finish();
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Element counts of a scene file, each an upper bound of what the loader
+// keeps (it ignores repeated elements).
+struct SceneCounts {
+    size_t pointLights = 0, triangularLights = 0, materials = 0;
+    size_t vertices = 0, texcoords = 0, normals = 0;
+    size_t meshes = 0, faces = 0;
+
+    // storage for all of it, with faces at their largest packed size
+    size_t bytes() const {
+        return pointLights * sizeof(parser::PointLight) + triangularLights * sizeof(parser::TriangularLight) +
+               materials * sizeof(parser::Material) + (vertices + texcoords + normals) * sizeof(parser::Vec3f) +
+               meshes * (sizeof(parser::Mesh) + 2 * alignof(parser::Face)) + faces * sizeof(parser::Face) + 4096;
+    }
+};
+
+static size_t blockTokens(parser::XmlReader &reader, ThreadPool *pool) {
+    size_t tokens = 0;
+    reader.streamText([&](const char *begin, const char *end) { tokens += parser::countTokens(begin, end, pool); });
+    return tokens;
+}
+
+// Counts the elements of a regular file with a second reader, so the
+// arena and every array can be sized before loading. Anything else (a
+// pipe) can only be read once and is not pre-scanned.
+static bool prescan(const std::string &filepath, SceneCounts &counts, ThreadPool *pool) {
+    struct stat info;
+    if (stat(filepath.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    parser::XmlReader reader(filepath);
+    if (!reader.nextElement()) {
+        return false;
+    }
+    reader.enter();
+    while (reader.nextElement()) {
+        const std::string &name = reader.name();
+        if (name == "lights") {
+            reader.enter();
+            while (reader.nextElement()) {
+                counts.pointLights += reader.name() == "pointlight";
+                counts.triangularLights += reader.name() == "triangularlight";
+            }
+        } else if (name == "materials") {
+            reader.enter();
+            while (reader.nextElement()) {
+                counts.materials += reader.name() == "material";
+            }
+        } else if (name == "vertexdata") {
+            counts.vertices += blockTokens(reader, pool) / 3;
+        } else if (name == "texturedata") {
+            counts.texcoords += blockTokens(reader, pool) / 2;
+        } else if (name == "normaldata") {
+            counts.normals += blockTokens(reader, pool) / 3;
+        } else if (name == "objects") {
+            reader.enter();
+            while (reader.nextElement()) {
+                if (reader.name() != "mesh") {
+                    continue;
+                }
+                ++counts.meshes;
+                reader.enter();
+                while (reader.nextElement()) {
+                    if (reader.name() == "faces") {
+                        counts.faces += blockTokens(reader, pool) / 3;
+                    }
+                }
+            }
+        }
     }
+    return true;
+}
 
-    // Maxraytracedepth
-    auto element = root->FirstChildElement("maxraytracedepth");
-    if (element) {
-        stream << element->GetText();
-    } else {
-        stream << "0";
+// Mesh files are named relative to the scene file.
+static std::string meshFilePath(const std::string &scenePath, std::string name) {
+    name.erase(0, name.find_first_not_of(" \t\r\n"));
+    name.erase(name.find_last_not_of(" \t\r\n") + 1);
+    size_t slash = scenePath.find_last_of('/');
+    if (name.empty() || name[0] == '/' || slash == std::string::npos) {
+        return name;
     }
-    stream >> maxraytracedepth;
-    stream.clear();
-    stream.str("");
-
-    // BackgroundColor
-    element = root->FirstChildElement("backgroundColor");
-    if (element) {
-        stream << element->GetText();
-    } else {
-        stream << "0 0 0";
+    return scenePath.substr(0, slash + 1) + name;
+}
+
+// The file is read front to back with a pull reader, so only one buffer of
+// it is in memory at a time and the numeric blocks go directly into their
+// vectors. Like the DOM lookups this replaced, only the first element of
+// each name counts (except for cameras, lights, materials and meshes).
+//
+// Everything is stored in the scene's arena. A pre-scan sizes it and each
+// array up front, so nothing is reallocated while loading.
+void parser::Scene::loadFromXml(const std::string &filepath, ThreadPool *pool) {
+    SceneCounts counts;
+    if (prescan(filepath, counts, pool)) {
+        arena.reserve(counts.bytes());
     }
-    stream >> background_color.x >> background_color.y >> background_color.z;
-    stream.clear();
-    stream.str("");
-
-    // Camera
-    element = root->FirstChildElement("camera");
-    if (element) {
-        auto child = element->FirstChildElement("position");
-        if (child) stream << child->GetText() << " ";
-        child = element->FirstChildElement("gaze");
-        if (child) stream << child->GetText() << " ";
-        child = element->FirstChildElement("up");
-        if (child) stream << child->GetText() << " ";
-        child = element->FirstChildElement("nearPlane");
-        if (child) stream << child->GetText() << " ";
-        child = element->FirstChildElement("neardistance");
-        if (child) stream << child->GetText() << " ";
-        child = element->FirstChildElement("imageresolution");
-        if (child) stream << child->GetText() << " ";
-
-        stream >> camera.position.x >> camera.position.y >> camera.position.z;
-        stream >> camera.gaze.x >> camera.gaze.y >> camera.gaze.z;
-        stream >> camera.up.x >> camera.up.y >> camera.up.z;
-        stream >> camera.near_plane.x >> camera.near_plane.y >> camera.near_plane.z >> camera.near_plane.w;
-        stream >> camera.near_distance;
-        stream >> camera.image_width >> camera.image_height;
+    useArena(point_lights, arena, counts.pointLights);
+    useArena(triangular_lights, arena, counts.triangularLights);
+    useArena(materials, arena, counts.materials);
+    useArena(vertex_data, arena, counts.vertices);
+    useArena(texture_data, arena, counts.texcoords);
+    useArena(normal_data, arena, counts.normals);
+    useArena(meshes, arena, counts.meshes);
+
+    XmlReader reader(filepath);
+    std::stringstream stream;
+
+    if (!reader.nextElement()) {
+        throw std::runtime_error("Error: Root element not found.");
     }
-    stream.clear();
-    stream.str("");
-
-    // Lights
-    element = root->FirstChildElement("lights");
-    if (element) {
-        // AmbientLight
-        auto child = element->FirstChildElement("ambientlight");
-        if (child) {
-            stream << child->GetText();
-            stream >> ambient_light.x >> ambient_light.y >> ambient_light.z;
+    reader.enter();
+
+    maxraytracedepth = 0;
+    background_color = Vec3i{0, 0, 0};
+
+    std::set<std::string> seen;
+    std::vector<MeshFileReference> meshFiles;
+    while (reader.nextElement()) {
+        const std::string name = reader.name();
+        if (!seen.insert(name).second && name != "camera") {
+            continue;
         }
-        stream.clear();
-        stream.str("");
 
-        // PointLights
-        auto pointElement = element->FirstChildElement("pointlight");
-        while (pointElement) {
-            PointLight point_light;
-            point_light.id = pointElement->Attribute("id"); // id 
-            child = pointElement->FirstChildElement("position");
-            if (child) stream << child->GetText() << " ";
-            child = pointElement->FirstChildElement("intensity");
-            if (child) stream << child->GetText() << " ";
-
-            stream >> point_light.position.x >> point_light.position.y >> point_light.position.z;
-            stream >> point_light.intensity.x >> point_light.intensity.y >> point_light.intensity.z;
-
-            point_lights.push_back(point_light);
-            pointElement = pointElement->NextSiblingElement("pointlight");
-            stream.clear();
-            stream.str("");
+        // Maxraytracedepth
+        if (name == "maxraytracedepth") {
+            stream << reader.readText();
+            stream >> maxraytracedepth;
         }
 
-        // TriangularLights
-        auto triElement = element->FirstChildElement("triangularlight");
-        while (triElement) {
-            TriangularLight tri_light;
-            tri_light.id = triElement->Attribute("id"); // id 
-            child = triElement->FirstChildElement("vertex1");
-            if (child) stream << child->GetText() << " ";
-            child = triElement->FirstChildElement("vertex2");
-            if (child) stream << child->GetText() << " ";
-            child = triElement->FirstChildElement("vertex3");
-            if (child) stream << child->GetText() << " ";
-            child = triElement->FirstChildElement("intensity");
-            if (child) stream << child->GetText() << " ";
-
-            stream >> tri_light.vertex1.x >> tri_light.vertex1.y >> tri_light.vertex1.z;
-            stream >> tri_light.vertex2.x >> tri_light.vertex2.y >> tri_light.vertex2.z;
-            stream >> tri_light.vertex3.x >> tri_light.vertex3.y >> tri_light.vertex3.z;
-            stream >> tri_light.intensity.x >> tri_light.intensity.y >> tri_light.intensity.z;
-
-            triangular_lights.push_back(tri_light);
-            triElement = triElement->NextSiblingElement("triangularlight");
-            stream.clear();
-            stream.str("");
+        // BackgroundColor
+        else if (name == "backgroundColor") {
+            stream << reader.readText();
+            stream >> background_color.x >> background_color.y >> background_color.z;
         }
-    }
 
-    // Materials
-    element = root->FirstChildElement("materials");
-    if (element) {
-        auto matElement = element->FirstChildElement("material");
-        while (matElement) {
-            Material material;
-            material.id = matElement->Attribute("id");  // id 
-            auto child = matElement->FirstChildElement("ambient");
-            if (child) stream << child->GetText() << " ";
-            child = matElement->FirstChildElement("diffuse");
-            if (child) stream << child->GetText() << " ";
-            child = matElement->FirstChildElement("specular");
-            if (child) stream << child->GetText() << " ";
-            child = matElement->FirstChildElement("mirrorreflactance"); 
-            if (child) stream << child->GetText() << " ";
-            child = matElement->FirstChildElement("phongexponent");
-            if (child) stream << child->GetText() << " ";
-            child = matElement->FirstChildElement("texturefactor");
-            if (child) stream << child->GetText() << " ";
-
-            stream >> material.ambient.x >> material.ambient.y >> material.ambient.z;
-            stream >> material.diffuse.x >> material.diffuse.y >> material.diffuse.z;
-            stream >> material.specular.x >> material.specular.y >> material.specular.z;
-            stream >> material.mirror_reflactance.x >> material.mirror_reflactance.y >> material.mirror_reflactance.z;
-            stream >> material.phong_exponent;
-            stream >> material.texture_factor;
-
-            materials.push_back(material);
-            matElement = matElement->NextSiblingElement("material");
-            stream.clear();
-            stream.str("");
+        // Camera
+        else if (name == "camera") {
+            Camera view;
+            ChildTexts texts = readChildTexts(reader);
+            appendChild(stream, texts, "position");
+            appendChild(stream, texts, "gaze");
+            appendChild(stream, texts, "up");
+            appendChild(stream, texts, "nearPlane");
+            appendChild(stream, texts, "neardistance");
+            appendChild(stream, texts, "imageresolution");
+
+            stream >> view.position.x >> view.position.y >> view.position.z;
+            stream >> view.gaze.x >> view.gaze.y >> view.gaze.z;
+            stream >> view.up.x >> view.up.y >> view.up.z;
+            stream >> view.near_plane.x >> view.near_plane.y >> view.near_plane.z >> view.near_plane.w;
+            stream >> view.near_distance;
+            stream >> view.image_width >> view.image_height;
+
+            if (cameras.empty()) {
+                camera = view;
+            }
+            cameras.push_back(view);
         }
-    }
 
-    // Vertex Data
-    element = root->FirstChildElement("vertexdata");
-    if (element) {
-        stream << element->GetText();
-        Vec3f vertex;
-        while (stream >> vertex.x >> vertex.y >> vertex.z) {
-            vertex_data.push_back(vertex);
+        // Lights
+        else if (name == "lights") {
+            bool ambientSeen = false;
+            reader.enter();
+            while (reader.nextElement()) {
+                // AmbientLight
+                if (reader.name() == "ambientlight" && !ambientSeen) {
+                    ambientSeen = true;
+                    stream << reader.readText();
+                    stream >> ambient_light.x >> ambient_light.y >> ambient_light.z;
+                }
+
+                // PointLights
+                else if (reader.name() == "pointlight") {
+                    PointLight point_light;
+                    point_light.id = reader.attribute("id"); // id 
+                    ChildTexts texts = readChildTexts(reader);
+                    appendChild(stream, texts, "position");
+                    appendChild(stream, texts, "intensity");
+
+                    stream >> point_light.position.x >> point_light.position.y >> point_light.position.z;
+                    stream >> point_light.intensity.x >> point_light.intensity.y >> point_light.intensity.z;
+
+                    point_lights.push_back(point_light);
+                }
+
+                // TriangularLights
+                else if (reader.name() == "triangularlight") {
+                    TriangularLight tri_light;
+                    tri_light.id = reader.attribute("id"); // id 
+                    ChildTexts texts = readChildTexts(reader);
+                    appendChild(stream, texts, "vertex1");
+                    appendChild(stream, texts, "vertex2");
+                    appendChild(stream, texts, "vertex3");
+                    appendChild(stream, texts, "intensity");
+
+                    stream >> tri_light.vertex1.x >> tri_light.vertex1.y >> tri_light.vertex1.z;
+                    stream >> tri_light.vertex2.x >> tri_light.vertex2.y >> tri_light.vertex2.z;
+                    stream >> tri_light.vertex3.x >> tri_light.vertex3.y >> tri_light.vertex3.z;
+                    stream >> tri_light.intensity.x >> tri_light.intensity.y >> tri_light.intensity.z;
+
+                    triangular_lights.push_back(tri_light);
+                }
+                stream.clear();
+                stream.str("");
+            }
         }
-        stream.clear();
-        stream.str("");
-    }
 
-    // Texture Data
-    element = root->FirstChildElement("texturedata");
-    if (element) {
-        stream << element->GetText();
-        Vec3f texture;
-        while (stream >> texture.x >> texture.y) {
-            texture.z = 0.0f;
-            texture_data.push_back(texture);
+        // Materials
+        else if (name == "materials") {
+            reader.enter();
+            while (reader.nextElement()) {
+                if (reader.name() != "material") {
+                    continue;
+                }
+                Material material;
+                material.id = reader.attribute("id");  // id 
+                ChildTexts texts = readChildTexts(reader);
+                appendChild(stream, texts, "ambient");
+                appendChild(stream, texts, "diffuse");
+                appendChild(stream, texts, "specular");
+                appendChild(stream, texts, "mirrorreflactance");
+                appendChild(stream, texts, "phongexponent");
+                appendChild(stream, texts, "texturefactor");
+
+                stream >> material.ambient.x >> material.ambient.y >> material.ambient.z;
+                stream >> material.diffuse.x >> material.diffuse.y >> material.diffuse.z;
+                stream >> material.specular.x >> material.specular.y >> material.specular.z;
+                stream >> material.mirror_reflactance.x >> material.mirror_reflactance.y >> material.mirror_reflactance.z;
+                stream >> material.phong_exponent;
+                stream >> material.texture_factor;
+
+                materials.push_back(material);
+                stream.clear();
+                stream.str("");
+            }
         }
-        stream.clear();
-        stream.str("");
-    }
 
-    // Normal Data
-    element = root->FirstChildElement("normaldata");
-    if (element) {
-        stream << element->GetText();
-        Vec3f normal;
-        while (stream >> normal.x >> normal.y >> normal.z) {
-            normal_data.push_back(normal);
+        // Vertex, Texture and Normal Data
+        else if (name == "vertexdata") {
+            streamBlock(reader, vertex_data, 3, pool, parse_stats);
+        } else if (name == "texturedata") {
+            streamBlock(reader, texture_data, 2, pool, parse_stats);
+        } else if (name == "normaldata") {
+            streamBlock(reader, normal_data, 3, pool, parse_stats);
         }
-        stream.clear();
-        stream.str("");
-    }
 
-    // Texture Image
-    element = root->FirstChildElement("textureimage");
-    if (element) {
-        texture_image = element->GetText();
-    }
+        // Texture Image
+        else if (name == "textureimage") {
+            texture_image = reader.readText();
+        }
 
-    // Meshes
-    element = root->FirstChildElement("objects");
-    if (element) {
-        auto meshElement = element->FirstChildElement("mesh");
-        while (meshElement) {
-            Mesh mesh;
-            mesh.id = meshElement->Attribute("id"); // id 
-            auto child = meshElement->FirstChildElement("materialid");
-            if (child) {
-                stream << child->GetText();
-                stream >> mesh.material_id;
-            }
-            stream.clear();
-            stream.str("");
-
-            child = meshElement->FirstChildElement("faces");
-            if (child) {
-                std::string facesText = child->GetText();
-                std::replace(facesText.begin(), facesText.end(), '\n', ' ');
-                std::stringstream faceStream(facesText);
-                std::string token;
-
-                while (faceStream >> token) {
-                    Face face;
-                    for (int i = 0; i < 3; ++i) { 
-                        std::replace(token.begin(), token.end(), '/', ' ');
-                        std::stringstream tokenStream(token);
-                        int v, t, n;
-                        tokenStream >> v >> t >> n;
-
-                        if (i == 0) {
-                            face.v1_id = v;
-                            face.t1_id = t;
-                            face.n1_id = n;
-                        } else if (i == 1) {
-                            face.v2_id = v;
-                            face.t2_id = t;
-                            face.n2_id = n;
-                        } else if (i == 2) {
-                            face.v3_id = v;
-                            face.t3_id = t;
-                            face.n3_id = n;
-                        }
-
-                        if (i < 2) faceStream >> token; 
+        // Meshes
+        else if (name == "objects") {
+            reader.enter();
+            while (reader.nextElement()) {
+                if (reader.name() != "mesh") {
+                    continue;
+                }
+                Mesh mesh;
+                mesh.id = reader.attribute("id"); // id 
+                bool materialSeen = false, facesSeen = false, fileSeen = false;
+                reader.enter();
+                while (reader.nextElement()) {
+                    if (reader.name() == "materialid" && !materialSeen) {
+                        materialSeen = true;
+                        stream << reader.readText();
+                        stream >> mesh.material_id;
+                        stream.clear();
+                        stream.str("");
+                    } else if (reader.name() == "faces" && !facesSeen) {
+                        facesSeen = true;
+                        std::vector<Face> faces;
+                        streamBlock(reader, faces, 3, pool, parse_stats);
+                        mesh.faces.assign(std::move(faces), &arena);
+                    } else if (reader.name() == "file" && !fileSeen) {
+                        fileSeen = true;
+                        meshFiles.push_back(MeshFileReference{(int)meshes.size(), meshFilePath(filepath, reader.readText())});
                     }
-                    mesh.faces.push_back(face);
                 }
+                meshes.push_back(std::move(mesh));
             }
-            meshes.push_back(mesh);
-            meshElement = meshElement->NextSiblingElement("mesh");
         }
+
+        stream.clear();
+        stream.str("");
+    }
+
+    // external meshes go after the inline data, so inline ids stay valid
+    if (!meshFiles.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        mergeMeshFiles(*this, meshFiles, pool);
+        parse_stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
-}
\ No newline at end of file
+}
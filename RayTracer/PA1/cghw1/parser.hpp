@@ -1,82 +1,19 @@
 #ifndef __HW1__PARSER__
 #define __HW1__PARSER__
 
+#include "vecmath.hpp"
+#include "arena.hpp"
+#include "compact.hpp"
 #include <string>
 #include <vector>
 
+class ThreadPool;
+
 namespace parser
 {
-    struct Vec3f
-    {
-        float x, y, z;
-    };
-
-    struct Vec3i
-    {
-        int x, y, z;
-    };
-
-    struct Vec4f
-    {
-        float x, y, z, w;
-    };
-
-    inline Vec3f operator +(const Vec3f& vec1,const Vec3f& vec2){
-        Vec3f tmpVec;
-        tmpVec.x = vec1.x+vec2.x;
-        tmpVec.y = vec1.y+vec2.y;
-        tmpVec.z = vec1.z+vec2.z;
-
-        return tmpVec;
-    }
-
-    inline Vec3f operator -(const Vec3f& vec1,const Vec3f& vec2){
-        Vec3f tmpVec;
-        tmpVec.x = vec1.x-vec2.x;
-        tmpVec.y = vec1.y-vec2.y;
-        tmpVec.z = vec1.z-vec2.z;
-
-        return tmpVec;
-    }
-    inline Vec3f operator -(const Vec3f& vec) {
-        return Vec3f{-vec.x, -vec.y, -vec.z};
-    }
-
-    inline Vec3f operator *(const Vec3f& vec1,const float &number){
-        Vec3f tmpVec;
-        tmpVec.x = vec1.x*number;
-        tmpVec.y = vec1.y*number;
-        tmpVec.z = vec1.z*number;
-
-        return tmpVec;
-    }
-
-    inline Vec3f operator *(const Vec3f& vec1,const Vec3f &vec2){
-        Vec3f tmpVec;
-        tmpVec.x = vec1.x*vec2.x;
-        tmpVec.y = vec1.y*vec2.y;
-        tmpVec.z = vec1.z*vec2.z;
-
-        return tmpVec;
-    }
-
-    inline Vec3f operator /(const Vec3f& vec1,const float &number){
-        Vec3f tmpVec;
-        tmpVec.x = vec1.x/number;
-        tmpVec.y = vec1.y/number;
-        tmpVec.z = vec1.z/number;
-
-        return tmpVec;
-    }
-
-    inline Vec3f operator *(const Vec3i& vec1,const Vec3f &vec2){
-        Vec3f tmpVec;
-        tmpVec.x = vec1.x*vec2.x;
-        tmpVec.y = vec1.y*vec2.y;
-        tmpVec.z = vec1.z*vec2.z;
-
-        return tmpVec;
-    }
+    typedef vecmath::Vec3<float> Vec3f;
+    typedef vecmath::Vec3<int> Vec3i;
+    typedef vecmath::Vec4<float> Vec4f;
 
     struct Camera
     {
@@ -124,29 +61,130 @@ namespace parser
     };
     
 
+    // Faces of one mesh, packed by assign() (faces.cpp). Ids are stored
+    // relative to the lowest id of their kind, as 16-bit values when they
+    // span fewer than 65536 ids and 32-bit ones otherwise. When the vertex,
+    // texture and normal ids of every corner move together (v/v/v style
+    // exports), one relative id per corner is kept instead of three.
+    // Indexing decodes a Face by value.
+    class FaceList
+    {
+    public:
+        class const_iterator
+        {
+        public:
+            const_iterator(const FaceList *list, size_t index) : list(list), index(index) {}
+            Face operator*() const { return (*list)[index]; }
+            const_iterator &operator++() { ++index; return *this; }
+            bool operator!=(const const_iterator &other) const { return index != other.index; }
+        private:
+            const FaceList *list;
+            size_t index;
+        };
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, count); }
+
+        Face operator[](size_t i) const
+        {
+            int ids[9];
+            size_t first = i * (shared ? 3 : 9);
+            for (int k = 0; k < (shared ? 3 : 9); ++k)
+                ids[k] = narrow.empty() ? (int)wide[first + k] : narrow[first + k];
+            if (shared)
+                return Face{base[0] + ids[0], base[1] + ids[0], base[2] + ids[0],
+                            base[0] + ids[1], base[1] + ids[1], base[2] + ids[1],
+                            base[0] + ids[2], base[1] + ids[2], base[2] + ids[2]};
+            return Face{base[0] + ids[0], base[1] + ids[1], base[2] + ids[2],
+                        base[0] + ids[3], base[1] + ids[4], base[2] + ids[5],
+                        base[0] + ids[6], base[1] + ids[7], base[2] + ids[8]};
+        }
+
+        // replaces the faces with the given ones, packed into arena (the
+        // heap without one); append() packs into the list's current arena
+        void assign(std::vector<Face> faces, Arena *arena = 0);
+        void append(const std::vector<Face> &faces);
+        std::vector<Face> unpack() const;
+        size_t bytes() const { return narrow.size() * sizeof(uint16_t) + wide.size() * sizeof(uint32_t); }
+
+    private:
+        size_t count = 0;
+        bool shared = false;
+        int base[3] = {0, 0, 0};        // lowest vertex, texture and normal id
+        SceneVector<uint16_t> narrow;
+        SceneVector<uint32_t> wide;
+    };
+
     struct Mesh {
         std::string id; 
         int material_id;
-        std::vector<Face> faces;
+        FaceList faces;
+    };
+
+    // Time spent scanning the numeric blocks (vertices, uvs, normals, faces).
+    struct ParseStats
+    {
+        size_t bytes = 0;
+        double seconds = 0;
     };
 
     struct Scene
     {
+        // Holds the storage of every container below, so it is destroyed
+        // after them and frees everything in one go (see arena.hpp).
+        Arena arena;
+
         int maxraytracedepth;      
         Vec3i background_color;
         Camera camera;
+        std::vector<Camera> cameras;    // every camera of the file, in order; camera is the first
         Vec3f ambient_light;
-        std::vector<PointLight> point_lights;
-        std::vector<TriangularLight> triangular_lights;
-        std::vector<Material> materials;
-        std::vector<Vec3f> vertex_data;
-        std::vector<Vec3f> texture_data;
-        std::vector<Vec3f> normal_data;
+        SceneVector<PointLight> point_lights;
+        SceneVector<TriangularLight> triangular_lights;
+        SceneVector<Material> materials;
+        SceneVector<Vec3f> vertex_data;
+        SceneVector<Vec3f> texture_data;
+        SceneVector<Vec3f> normal_data;
         std::string texture_image;
-        std::vector<Mesh> meshes;
-
-        void loadFromXml(const std::string &filepath);
+        SceneVector<Mesh> meshes;
+        ParseStats parse_stats;
+        CompactGeometry compact;
+
+        // Corner data by 1-based id, decoded from the compact arrays once
+        // compactGeometry() has replaced the float ones.
+        Vec3f vertex(int id) const
+        {
+            return compact.active ? decodePosition(&compact.positions[0], &compact.blocks[0], id - 1) : vertex_data[id - 1];
+        }
+        Vec3f texcoord(int id) const
+        {
+            return compact.active ? decodeTexcoord(compact.texcoords[id - 1]) : texture_data[id - 1];
+        }
+        Vec3f normal(int id) const
+        {
+            return compact.active ? decodeNormal(compact.normals[id - 1]) : normal_data[id - 1];
+        }
+        int vertexCount() const { return (int)(compact.active ? compact.positions.size() / 3 : vertex_data.size()); }
+        int texcoordCount() const { return (int)(compact.active ? compact.texcoords.size() : texture_data.size()); }
+        int normalCount() const { return (int)(compact.active ? compact.normals.size() : normal_data.size()); }
+
+        // pool, if given, parses the large numeric blocks in parallel
+        void loadFromXml(const std::string &filepath, ThreadPool *pool = 0);
+
+        // Compiled binary form of a scene (scenefile.cpp), written by
+        // "program compile" and loaded without parsing.
+        void saveBinary(const std::string &filepath) const;
+        void loadFromBinary(const std::string &filepath);
+
+        // Moves the vertex, texture and normal arrays into the compact,
+        // lossy form (compact.cpp) and frees the float arrays.
+        void compactGeometry();
     };
+
+    // true when the file starts with the binary scene signature
+    bool isBinaryScene(const std::string &filepath);
 }
 
 #endif
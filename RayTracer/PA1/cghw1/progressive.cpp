@@ -0,0 +1,262 @@
+#include "progressive.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+typedef std::chrono::steady_clock Clock;
+
+
+void Accumulator::reset(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    samples = 0;
+    sum.assign((size_t)width * height * 3, 0.0f);
+}
+
+void Accumulator::add(const unsigned char *image)
+{
+    for (size_t i = 0; i < sum.size(); ++i)
+        sum[i] += image[i];
+    ++samples;
+}
+
+void Accumulator::resolve(unsigned char *image) const
+{
+    float scale = samples > 0 ? 1.0f / samples : 0.0f;
+    for (size_t i = 0; i < sum.size(); ++i)
+        image[i] = (unsigned char)(sum[i] * scale + 0.5f);
+}
+
+static float radicalInverse(int n, int base)
+{
+    float value = 0, digit = 1.0f / base;
+    for (; n > 0; n /= base, digit /= base)
+        value += (n % base) * digit;
+    return value;
+}
+
+void sampleOffset(int sample, float &dx, float &dy)
+{
+    dx = sample > 0 ? radicalInverse(sample, 2) - 0.5f : 0.0f;
+    dy = sample > 0 ? radicalInverse(sample, 3) - 0.5f : 0.0f;
+}
+
+parser::Camera offsetCamera(const parser::Camera &camera, float dx, float dy)
+{
+    // generateRay goes right with x and down with y across near_plane (l, r, b, t)
+    parser::Camera moved = camera;
+    float pixelWidth = (camera.near_plane.y - camera.near_plane.x) / camera.image_width;
+    float pixelHeight = (camera.near_plane.w - camera.near_plane.z) / camera.image_height;
+    moved.near_plane.x += dx * pixelWidth;
+    moved.near_plane.y += dx * pixelWidth;
+    moved.near_plane.z -= dy * pixelHeight;
+    moved.near_plane.w -= dy * pixelHeight;
+    return moved;
+}
+
+// A camera whose pixels are scale x scale blocks of the original, with the
+// image plane grown so that partial blocks at the right and bottom fit.
+static parser::Camera previewCamera(const parser::Camera &camera, int scale)
+{
+    parser::Camera preview = camera;
+    preview.image_width = (camera.image_width + scale - 1) / scale;
+    preview.image_height = (camera.image_height + scale - 1) / scale;
+    float pixelWidth = (camera.near_plane.y - camera.near_plane.x) / camera.image_width;
+    float pixelHeight = (camera.near_plane.w - camera.near_plane.z) / camera.image_height;
+    preview.near_plane.y = camera.near_plane.x + pixelWidth * preview.image_width * scale;
+    preview.near_plane.z = camera.near_plane.w - pixelHeight * preview.image_height * scale;
+    return preview;
+}
+
+// Renders the frame at 1 / scale of its resolution and scales it up into
+// image; false, with image untouched, if stop cut it short.
+static bool renderPreview(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, bool hybrid, int scale,
+                          unsigned char *image, const std::atomic<bool> *stop, TileProgress *progress = 0)
+{
+    const parser::Camera camera = scene.camera;
+    int width = camera.image_width, height = camera.image_height;
+    scene.camera = previewCamera(camera, scale);
+    int previewWidth = scene.camera.image_width, previewHeight = scene.camera.image_height;
+    std::vector<unsigned char> preview((size_t)previewWidth * previewHeight * 3);
+    bool cancelled = renderImage(scene, compiled, pool, hybrid, &preview[0], stop, progress).cancelled;
+    scene.camera = camera;
+    if (cancelled)
+        return false;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < 3; ++c)
+                image[((size_t)y * width + x) * 3 + c] = preview[((size_t)(y / scale) * previewWidth + x / scale) * 3 + c];
+    return true;
+}
+
+static void writeSnapshot(const std::string &path, const unsigned char *image, int width, int height)
+{
+    // viewers polling the file never see half of it
+    std::string partial = path + ".part";
+    writePpm(partial, image, width, height);
+    if (std::rename(partial.c_str(), path.c_str()) != 0)
+        std::remove(partial.c_str());
+}
+
+ProgressiveStats renderProgressive(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                                   const ProgressiveOptions &options, unsigned char *image, const std::atomic<bool> *stop)
+{
+    const parser::Camera camera = scene.camera;
+    int width = camera.image_width, height = camera.image_height;
+    ProgressiveStats stats;
+    Clock::time_point start = Clock::now(), lastSnapshot = start;
+    auto elapsed = [&](Clock::time_point since) {
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    };
+    auto snapshot = [&](bool now) {
+        if (options.snapshotPath.empty() || (!now && elapsed(lastSnapshot) < options.snapshotInterval))
+            return;
+        writeSnapshot(options.snapshotPath, image, width, height);
+        lastSnapshot = Clock::now();
+        ++stats.snapshots;
+    };
+
+    Accumulator accumulator;
+    accumulator.reset(width, height);
+    std::vector<unsigned char> sample((size_t)width * height * 3);
+    TileProgress progress;
+    if (options.resume) {
+        accumulator.samples = options.resume->samples;
+        if (accumulator.samples > 0)
+            accumulator.sum = options.resume->sum;
+        sample = options.resume->image;
+        progress.restore(options.resume->tiles);
+    }
+    if (options.checkpoint) {
+        options.checkpoint->capture = [&](Checkpoint &checkpoint) {
+            checkpoint.samples = accumulator.samples;
+            checkpoint.sum = accumulator.sum;
+            captureFrame(progress, &sample[0], width, height, checkpoint);
+        };
+        progress.onTile = [&]() { options.checkpoint->tick(); };
+    }
+
+    if (accumulator.samples > 0) {
+        accumulator.resolve(image);
+    } else if (options.previewScale > 1 &&
+               renderPreview(scene, compiled, pool, options.hybrid, options.previewScale, image, stop)) {
+        stats.preview = true;
+        std::cout << "Progressive preview: " << (width + options.previewScale - 1) / options.previewScale << "x"
+                  << (height + options.previewScale - 1) / options.previewScale << " in " << elapsed(start) * 1000
+                  << " ms" << std::endl;
+        // shown at once, whatever the interval
+        snapshot(true);
+    }
+
+    for (int passSamples = 1; !(stop && *stop); passSamples *= 2) {
+        passSamples = std::min(passSamples, options.samples);
+        int passStart = accumulator.samples;
+        while (accumulator.samples < passSamples) {
+            float dx, dy;
+            sampleOffset(accumulator.samples, dx, dy);
+            scene.camera = offsetCamera(camera, dx, dy);
+            RenderStats render = renderImage(scene, compiled, pool, options.hybrid, &sample[0], stop, &progress);
+            scene.camera = camera;
+            if (render.cancelled)
+                break;
+            accumulator.add(&sample[0]);
+            progress.reset(progress.count());
+            accumulator.resolve(image);
+            stats.preview = false;
+            stats.render.undecided += render.undecided;
+            stats.render.clipped = render.clipped;
+            snapshot(false);
+        }
+        if (accumulator.samples < passSamples)
+            break;
+        if (accumulator.samples > passStart)
+            std::cout << "Progressive pass: " << accumulator.samples << " samples per pixel after " << elapsed(start) * 1000
+                      << " ms" << std::endl;
+        if (passSamples == options.samples)
+            break;
+    }
+    stats.samples = accumulator.samples;
+    stats.stopped = accumulator.samples < options.samples;
+    if (options.checkpoint) {
+        if (stats.stopped)
+            options.checkpoint->save();
+        options.checkpoint->capture = nullptr;
+    }
+    return stats;
+}
+
+DeadlineStats renderDeadline(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                             const DeadlineOptions &options, unsigned char *image)
+{
+    const parser::Camera camera = scene.camera;
+    int width = camera.image_width, height = camera.image_height;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    auto elapsed = [](Clock::time_point since) {
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    };
+    auto remaining = [&]() { return options.seconds * DEADLINE_MARGIN - elapsed(start); };
+
+    // renders still running at the deadline stop after their current tiles;
+    // progress is emptied before each one so it never skips any
+    std::atomic<bool> expired(false);
+    TileProgress progress;
+    progress.onTile = [&]() {
+        if (Clock::now() >= deadline)
+            expired = true;
+    };
+
+    // previews until a full frame fits; the first one measures the throughput
+    DeadlineStats stats;
+    double framePixels = (double)width * height;
+    for (int scale = options.previewScale; scale > 1; scale /= 2) {
+        double pixels = (double)((width + scale - 1) / scale) * ((height + scale - 1) / scale);
+        if (stats.pixelsPerSecond > 0 && (framePixels / stats.pixelsPerSecond <= remaining() ||
+                                          pixels / stats.pixelsPerSecond > remaining()))
+            break;
+        Clock::time_point begin = Clock::now();
+        progress.reset(0);
+        if (!renderPreview(scene, compiled, pool, options.hybrid, scale, image, &expired, &progress))
+            break;
+        if (stats.pixelsPerSecond == 0)
+            stats.pixelsPerSecond = pixels / std::max(elapsed(begin), 1e-6);
+        stats.scale = scale;
+    }
+
+    // then samples while the last one shows there is time for another
+    double frameSeconds = stats.pixelsPerSecond > 0 ? framePixels / stats.pixelsPerSecond : 0;
+    if (!expired && (stats.pixelsPerSecond == 0 || frameSeconds <= remaining())) {
+        if (frameSeconds > 0)
+            stats.planned = std::min(std::max((int)(remaining() / frameSeconds), 1), options.maxSamples);
+        Accumulator accumulator;
+        accumulator.reset(width, height);
+        std::vector<unsigned char> sample((size_t)width * height * 3);
+        while (accumulator.samples < options.maxSamples && (accumulator.samples == 0 || frameSeconds <= remaining())) {
+            float dx, dy;
+            sampleOffset(accumulator.samples, dx, dy);
+            Clock::time_point begin = Clock::now();
+            scene.camera = offsetCamera(camera, dx, dy);
+            progress.reset(0);
+            bool cancelled = renderImage(scene, compiled, pool, options.hybrid, &sample[0], &expired, &progress).cancelled;
+            scene.camera = camera;
+            if (cancelled)
+                break;
+            frameSeconds = elapsed(begin);
+            // without a preview the first sample is the first pass
+            if (stats.pixelsPerSecond == 0) {
+                stats.pixelsPerSecond = framePixels / std::max(frameSeconds, 1e-6);
+                stats.planned = std::min((int)(remaining() / frameSeconds) + 1, options.maxSamples);
+            }
+            accumulator.add(&sample[0]);
+            accumulator.resolve(image);
+            stats.scale = 1;
+            stats.samples = accumulator.samples;
+        }
+    }
+
+    stats.expired = expired;
+    stats.seconds = elapsed(start);
+    return stats;
+}
@@ -0,0 +1,96 @@
+#ifndef PROGRESSIVE_HPP
+#define PROGRESSIVE_HPP
+
+#include "parser.hpp"
+#include "checkpoint.hpp"
+#include "kernels.hpp"
+#include "render.hpp"
+#include "threadpool.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Progressive rendering. A coarse preview at 1 / previewScale of the
+// resolution comes first; then whole frames are traced again and again, each
+// through a different sub-pixel offset of the camera, and averaged in a float
+// framebuffer. Passes end at 1, 2, 4, ... samples per pixel; the first sample
+// is the pixel center, so one sample gives exactly the image of renderImage.
+struct ProgressiveOptions
+{
+    int samples = 16;               // per pixel when the last pass ends
+    int previewScale = 8;           // 1 for no preview
+    double snapshotInterval = 10;   // seconds between snapshots, 0 for every sample
+    std::string snapshotPath;       // no snapshots when empty
+    bool hybrid = false;
+    CheckpointWriter *checkpoint = 0;   // saves the accumulation and the frame in flight
+    const Checkpoint *resume = 0;       // continues from it, without a preview if it has samples
+};
+
+struct ProgressiveStats
+{
+    int samples = 0;                // per pixel in the image
+    bool preview = false;           // the image is (still) the coarse preview
+    bool stopped = false;           // stop was set before the last pass ended
+    int snapshots = 0;
+    RenderStats render;             // summed over the samples
+};
+
+// Per-pixel RGB sums of whole-frame samples.
+struct Accumulator
+{
+    int width = 0, height = 0;
+    int samples = 0;
+    std::vector<float> sum;
+
+    void reset(int width, int height);
+    void add(const unsigned char *image);
+    // the mean of the samples, rounded
+    void resolve(unsigned char *image) const;
+};
+
+// Offset of sample n from the pixel center, in pixels within [-0.5, 0.5):
+// (0, 0) for the first, then the Halton (2, 3) sequence.
+void sampleOffset(int sample, float &dx, float &dy);
+// The camera with its image plane moved by (dx, dy) pixels.
+parser::Camera offsetCamera(const parser::Camera &camera, float dx, float dy);
+
+// Renders scene.camera progressively into image (width * height RGB bytes),
+// writing a snapshot of it at most every snapshotInterval seconds. Once stop
+// is set no further tile is started, image holds the samples done so far and
+// a checkpoint, if there is one, is saved with the finished tiles of the
+// sample in flight. scene.camera is changed during the render and restored
+// afterwards.
+ProgressiveStats renderProgressive(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                                   const ProgressiveOptions &options, unsigned char *image, const std::atomic<bool> *stop = 0);
+
+// Deadline mode: the best image that can be rendered within seconds of wall
+// time. The coarse preview measures the throughput; finer previews follow
+// while a full-resolution frame would not fit, then as many samples per
+// pixel as the rest of the budget allows. Whatever is still rendering at the
+// deadline is cancelled and dropped, so the image is the last one finished.
+// Only DEADLINE_MARGIN of the budget is planned for.
+const double DEADLINE_MARGIN = 0.9;
+
+struct DeadlineOptions
+{
+    double seconds = 1;
+    int maxSamples = 16;
+    int previewScale = 8;
+    bool hybrid = false;
+};
+
+// Quality reached, for the metadata written with the image.
+struct DeadlineStats
+{
+    int scale = 0;                  // resolution: 1 / scale of the frame, 0 if nothing finished
+    int samples = 0;                // per pixel, at full resolution
+    int planned = 0;                // samples per pixel predicted from the first pass
+    double pixelsPerSecond = 0;     // throughput measured by the first pass
+    double seconds = 0;             // wall time used
+    bool expired = false;           // a render was cancelled at the deadline
+};
+
+DeadlineStats renderDeadline(parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                             const DeadlineOptions &options, unsigned char *image);
+
+#endif
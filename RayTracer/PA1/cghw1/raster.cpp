@@ -0,0 +1,227 @@
+#include "raster.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+using namespace std;
+using namespace parser;
+
+typedef vecmath::Vec3<double> Vec3d;
+
+// projected coordinates beyond this many pixels lose too much precision
+const double RASTER_MAX_COORDINATE = 1e6;
+const int RASTER_SETUP_CHUNK = 4096;
+
+enum RasterStatus { RASTER_OFFSCREEN, RASTER_BINNED, RASTER_CLIPPED };
+
+static Vec3d toDouble(const Vec3f &v)
+{
+    return Vec3d{v.x, v.y, v.z};
+}
+
+RasterCamera::RasterCamera(const Camera &cam)
+{
+    Vec3d g = toDouble(cam.gaze);
+    position = toDouble(cam.position);
+    u = normalize(cross(toDouble(cam.up), g * -1.0));
+    v = normalize(cross(g * -1.0, u));
+    gaze = normalize(g);
+    distance = cam.near_distance * length(g);
+    left = cam.near_plane.x;
+    top = cam.near_plane.w;
+    scaleX = cam.image_width / ((double)cam.near_plane.y - cam.near_plane.x);
+    scaleY = cam.image_height / ((double)cam.near_plane.w - cam.near_plane.z);
+}
+
+void RasterCamera::project(const Vec3f &p, double &x, double &y, double &z) const
+{
+    Vec3d d = toDouble(p) - position;
+    z = dot(d, gaze);
+    x = (dot(d, u) * distance / z - left) * scaleX - 0.5;
+    y = (top - dot(d, v) * distance / z) * scaleY - 0.5;
+}
+
+static RasterStatus setupTriangle(const Scene &scene, const CompiledScene &compiled, const RasterCamera &camera,
+                                  int triangle, RasterTriangle &tri, int box[4])
+{
+    Face face = scene.meshes[compiled.triangleMesh[triangle]].faces[compiled.triangleFace[triangle]];
+    int ids[3] = {face.v1_id, face.v2_id, face.v3_id};
+    double x[3], y[3], w[3];
+    for (int i = 0; i < 3; ++i) {
+        double z;
+        camera.project(scene.vertex(ids[i]), x[i], y[i], z);
+        if (!(z > 0) || !(fabs(x[i]) < RASTER_MAX_COORDINATE) || !(fabs(y[i]) < RASTER_MAX_COORDINATE))
+            return RASTER_CLIPPED;
+        w[i] = 1.0 / z;
+    }
+
+    double minX = min(x[0], min(x[1], x[2])), maxX = max(x[0], max(x[1], x[2]));
+    double minY = min(y[0], min(y[1], y[2])), maxY = max(y[0], max(y[1], y[2]));
+    double extent = max(maxX - minX, maxY - minY);
+    tri.triangle = triangle;
+    // the exact test's rounding grows with the triangle's size on screen
+    tri.margin = (float)(0.05 + 1e-3 * extent);
+
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (!(fabs(area) > 1e-9 * extent * extent)) {
+        // seen edge-on: every pixel in reach is an edge pixel at the nearest depth
+        for (int e = 0; e < 3; ++e) {
+            tri.a[e] = tri.b[e] = 0;
+            tri.c[e] = 0;
+        }
+        tri.za = tri.zb = 0;
+        tri.zc = max(w[0], max(w[1], w[2]));
+    } else {
+        double sign = area > 0 ? 1 : -1;
+        for (int e = 0; e < 3; ++e) {
+            int i = e, j = (e + 1) % 3;
+            double dx = x[j] - x[i], dy = y[j] - y[i];
+            double scale = sign / sqrt(dx * dx + dy * dy);
+            tri.a[e] = (float)(-dy * scale);
+            tri.b[e] = (float)(dx * scale);
+            tri.c[e] = (dy * x[i] - dx * y[i]) * scale;
+        }
+        double za = ((w[1] - w[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (w[2] - w[0])) / area;
+        double zb = ((x[1] - x[0]) * (w[2] - w[0]) - (w[1] - w[0]) * (x[2] - x[0])) / area;
+        tri.za = (float)za;
+        tri.zb = (float)zb;
+        tri.zc = w[0] - za * x[0] - zb * y[0];
+    }
+
+    const Camera &cam = scene.camera;
+    box[0] = max((int)floor(minX - tri.margin), 0);
+    box[1] = max((int)floor(minY - tri.margin), 0);
+    box[2] = min((int)ceil(maxX + tri.margin), cam.image_width - 1);
+    box[3] = min((int)ceil(maxY + tri.margin), cam.image_height - 1);
+    if (box[0] > box[2] || box[1] > box[3])
+        return RASTER_OFFSCREEN;
+    return RASTER_BINNED;
+}
+
+void buildRasterScene(const Scene &scene, const CompiledScene &compiled, ThreadPool &pool, RasterScene &raster)
+{
+    const Camera &cam = scene.camera;
+    RasterCamera camera(cam);
+    int count = compiled.triangleCount;
+
+    raster.tilesX = (cam.image_width + KERNEL_TILE_SIZE - 1) / KERNEL_TILE_SIZE;
+    raster.tilesY = (cam.image_height + KERNEL_TILE_SIZE - 1) / KERNEL_TILE_SIZE;
+    raster.triangles.assign(count, RasterTriangle());
+    vector<int> boxes((size_t)count * 4);
+    vector<unsigned char> status(count);
+
+    pool.parallelFor((count + RASTER_SETUP_CHUNK - 1) / RASTER_SETUP_CHUNK, [&](int chunk) {
+        int end = min(count, (chunk + 1) * RASTER_SETUP_CHUNK);
+        for (int i = chunk * RASTER_SETUP_CHUNK; i < end; ++i)
+            status[i] = setupTriangle(scene, compiled, camera, i, raster.triangles[i], &boxes[(size_t)i * 4]);
+    });
+
+    // bin by tile in triangle order
+    int tileCount = raster.tilesX * raster.tilesY;
+    raster.tileStart.assign(tileCount + 1, 0);
+    raster.clipped.clear();
+    for (int pass = 0; pass < 2; ++pass) {
+        vector<int> fill;
+        if (pass == 1) {
+            for (int tile = 0; tile < tileCount; ++tile)
+                raster.tileStart[tile + 1] += raster.tileStart[tile];
+            raster.tileTriangles.resize(raster.tileStart[tileCount]);
+            fill.assign(raster.tileStart.begin(), raster.tileStart.end() - 1);
+        }
+        for (int i = 0; i < count; ++i) {
+            if (status[i] == RASTER_CLIPPED && pass == 0)
+                raster.clipped.push_back(i);
+            if (status[i] != RASTER_BINNED)
+                continue;
+            const int *box = &boxes[(size_t)i * 4];
+            for (int ty = box[1] / KERNEL_TILE_SIZE; ty <= box[3] / KERNEL_TILE_SIZE; ++ty) {
+                for (int tx = box[0] / KERNEL_TILE_SIZE; tx <= box[2] / KERNEL_TILE_SIZE; ++tx) {
+                    int tile = ty * raster.tilesX + tx;
+                    if (pass == 0)
+                        ++raster.tileStart[tile + 1];
+                    else
+                        raster.tileTriangles[fill[tile]++] = i;
+                }
+            }
+        }
+    }
+}
+
+static float intersectCompiled(const Scene &scene, const CompiledScene &compiled, const Ray &ray, int triangle)
+{
+    Face face = scene.meshes[compiled.triangleMesh[triangle]].faces[compiled.triangleFace[triangle]];
+    return intersectionTriangle(scene, ray, face);
+}
+
+int renderTileHybrid(const Scene &scene, const CompiledScene &compiled, const RasterScene &raster,
+                     int tileX, int tileY, const ImageWindow &window, TileBuffers &buffers)
+{
+    const Camera &cam = scene.camera;
+    int x0 = tileX * KERNEL_TILE_SIZE, y0 = tileY * KERNEL_TILE_SIZE;
+    int x1 = min(x0 + KERNEL_TILE_SIZE, window.x1), y1 = min(y0 + KERNEL_TILE_SIZE, window.y1);
+    int left = max(x0, window.x0), top = max(y0, window.y0);
+    beginTile(scene, max(x1 - left, 0) * max(y1 - top, 0), buffers);
+
+    RasterTile tile;
+    int tileIndex = tileY * raster.tilesX + tileX;
+    int start = raster.tileStart[tileIndex];
+    int count = raster.tileStart[tileIndex + 1] - start;
+    if (count > 0)
+        activeKernels().rasterTile(&raster.triangles[0], &raster.tileTriangles[start], count, x0, y0, tile);
+    else
+        activeKernels().rasterTile(0, 0, 0, x0, y0, tile);
+
+    int traced = 0;
+    for (int y = top; y < y1; ++y) {
+        for (int x = left; x < x1; ++x) {
+            int k = (y - y0) * KERNEL_TILE_SIZE + (x - x0);
+            int pixel = window.index(x, y);
+            Ray ray = generateRay(cam, x, y);
+
+            float trusted = tile.nearest[k] * (1 - RASTER_DEPTH_EPSILON);
+            int triangle = tile.triangle[k];
+            float t = -1;
+            bool undecided;
+            if (triangle >= 0) {
+                undecided = tile.second[k] >= trusted || tile.edge[k] >= trusted;
+                if (!undecided) {
+                    t = intersectCompiled(scene, compiled, ray, triangle);
+                    undecided = t < 0;
+                }
+            } else {
+                undecided = tile.edge[k] > -FLT_MAX;
+            }
+
+            // Only triangles binned to this tile can reach the pixel, so the
+            // exact test runs over them instead of the whole scene.
+            if (undecided) {
+                ++traced;
+                t = -1;
+                triangle = -1;
+                for (int n = start; n < start + count; ++n) {
+                    int candidate = raster.triangles[raster.tileTriangles[n]].triangle;
+                    float tc = intersectCompiled(scene, compiled, ray, candidate);
+                    if (tc > 0 && (t < 0 || tc < t)) {
+                        t = tc;
+                        triangle = candidate;
+                    }
+                }
+            }
+
+            // same tie-break as the closest hit kernel: lowest triangle index wins
+            for (int clipped : raster.clipped) {
+                float tc = intersectCompiled(scene, compiled, ray, clipped);
+                if (tc > 0 && (t < 0 || tc < t || (tc == t && clipped < triangle))) {
+                    t = tc;
+                    triangle = clipped;
+                }
+            }
+            if (t > 0)
+                appendHit(scene, compiled, ray, t, triangle, pixel, buffers);
+            else
+                writeBackground(scene, pixel, window.image);
+        }
+    }
+
+    finishTile(scene, compiled, window.image, buffers);
+    return traced;
+}
@@ -0,0 +1,49 @@
+#ifndef RASTER_HPP
+#define RASTER_HPP
+
+#include "parser.hpp"
+#include "raytracer.hpp"
+#include "kernels.hpp"
+#include "shading.hpp"
+#include "threadpool.hpp"
+#include <vector>
+
+// Hybrid mode (--hybrid): primary visibility comes from a z-buffer pass over
+// the triangles projected with the generateRay() camera, and the winning
+// triangle is then intersected exactly, so pixels match the traced path.
+// Pixels the raster cannot decide safely (near a triangle edge, two depths
+// too close to call, or the winner rejected by the exact test) are traced
+// against the triangles binned to their tile. Shadows and mirror bounces are
+// always traced through the whole scene.
+const float RASTER_DEPTH_EPSILON = 1e-3f;  // relative 1 / z gap needed to trust the nearest triangle
+
+// Camera basis of generateRay(), in double.
+struct RasterCamera
+{
+    typedef vecmath::Vec3<double> Vec3d;
+
+    Vec3d position, u, v, gaze;
+    double distance;            // camera to image plane along gaze
+    double left, top, scaleX, scaleY;
+
+    explicit RasterCamera(const parser::Camera &cam);
+    // screen position (pixel centers at integers) and camera depth of p
+    void project(const parser::Vec3f &p, double &x, double &y, double &z) const;
+};
+
+struct RasterScene
+{
+    int tilesX = 0, tilesY = 0;
+    std::vector<RasterTriangle> triangles;
+    std::vector<int> tileStart;         // tile -> offset in tileTriangles, tilesX * tilesY + 1 entries
+    std::vector<int> tileTriangles;     // indices into triangles, ascending per tile
+    std::vector<int> clipped;           // compiled triangles reaching behind the camera, tested per pixel
+};
+
+void buildRasterScene(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, RasterScene &raster);
+// Renders the part of tile (tileX, tileY) inside window and returns how
+// many pixels the raster left undecided.
+int renderTileHybrid(const parser::Scene &scene, const CompiledScene &compiled, const RasterScene &raster,
+                     int tileX, int tileY, const ImageWindow &window, TileBuffers &buffers);
+
+#endif
@@ -12,36 +12,6 @@ using namespace parser;
 bool DEBUG = false;   // debug check intersection
 
 
-Vec3f crossProduct(const Vec3f &a, const Vec3f &b)
-{
-    return Vec3f{
-        a.y * b.z - a.z * b.y,
-        a.z * b.x - a.x * b.z,
-        a.x * b.y - a.y * b.x};
-}
-
-float dotProduct(const Vec3f &a, const Vec3f &b)
-{
-    return a.x * b.x + a.y * b.y + a.z * b.z;
-}
-
-float magnitude(const Vec3f &v)
-{
-    return sqrt(dotProduct(v, v));
-}
-
-Vec3f normalize(const Vec3f &v)
-{
-    Vec3f result = v;
-    double length = magnitude(v);
-    if (length == 0)
-        return result;
-    result.x /= length;
-    result.y /= length;
-    result.z /= length;
-    return result;
-}
-
 Ray generateRay(const Camera &cam, int i, int j) {
     float l = cam.near_plane.x;
     float r = cam.near_plane.y;
@@ -51,8 +21,8 @@ Ray generateRay(const Camera &cam, int i, int j) {
     // (m) = camera position + gaze * near_distance
     Vec3f m = cam.position + cam.gaze * cam.near_distance;
 
-    Vec3f u = normalize(crossProduct(cam.up, cam.gaze * -1));   
-    Vec3f v = normalize(crossProduct(cam.gaze * -1, u));        
+    Vec3f u = normalize(cross(cam.up, cam.gaze * -1));   
+    Vec3f v = normalize(cross(cam.gaze * -1, u));        
 
     Vec3f q = m + u * l + v * t;
 
@@ -80,9 +50,9 @@ float intersectionPointLight(Scene const &scene, Ray const &ray, Vec3f center)
 {
     double radius = pow(10, -1);
 
-    float A = dotProduct(ray.direction, ray.direction);
-    float B = 2 * dotProduct(ray.direction, ray.origin - center);
-    float C = dotProduct(ray.origin - center, ray.origin - center) - pow(radius, 2);
+    float A = dot(ray.direction, ray.direction);
+    float B = 2 * dot(ray.direction, ray.origin - center);
+    float C = dot(ray.origin - center, ray.origin - center) - pow(radius, 2);
 
     float discriminant = pow(B, 2) - 4 * A * C;
 
@@ -101,34 +71,34 @@ float intersectionPointLight(Scene const &scene, Ray const &ray, Vec3f center)
 float intersectionTriangle(const Scene &scene, const Ray &ray, const Face &face) {
     const float EPSILON = 1e-6;
 
-    Vec3f v0 = scene.vertex_data[face.v1_id - 1];
-    Vec3f v1 = scene.vertex_data[face.v2_id - 1];
-    Vec3f v2 = scene.vertex_data[face.v3_id - 1];
+    Vec3f v0 = scene.vertex(face.v1_id);
+    Vec3f v1 = scene.vertex(face.v2_id);
+    Vec3f v2 = scene.vertex(face.v3_id);
 
 
     Vec3f edge1 = v1 - v0;
     Vec3f edge2 = v2 - v0;
 
-    Vec3f h = crossProduct(ray.direction, edge2);
-    float a = dotProduct(edge1, h);
+    Vec3f h = cross(ray.direction, edge2);
+    float a = dot(edge1, h);
     if (fabs(a) < EPSILON) {
         return -1;  
     }
 
     float f = 1.0f / a;
     Vec3f s = ray.origin - v0;
-    float u = f * dotProduct(s, h);
+    float u = f * dot(s, h);
     if (u < 0.0f || u > 1.0f) {
         return -1;  
     }
 
-    Vec3f q = crossProduct(s, edge1);
-    float v = f * dotProduct(ray.direction, q);
+    Vec3f q = cross(s, edge1);
+    float v = f * dot(ray.direction, q);
     if (v < 0.0f || (u + v) > 1.0f) {
         return -1;  
     }
 
-    float t = f * dotProduct(edge2, q);
+    float t = f * dot(edge2, q);
     if (t > EPSILON) {
         return t;   
     } else {
@@ -158,7 +128,7 @@ Vec3f calculateDiffuse(Hit hit, PointLight pointLight, Vec3f irradiance)
 {
     Vec3f W_i = pointLight.position - hit.intersectionPoint;
     W_i = normalize(W_i);
-    double cos_teta = dotProduct(hit.normal, W_i);
+    double cos_teta = dot(hit.normal, W_i);
     double epsilon = pow(10, -6);
     if (cos_teta < 0 + epsilon)
         cos_teta = 0;
@@ -175,7 +145,7 @@ Vec3f calculateSpecular(Hit hit, Ray ray, Vec3f irradiance, PointLight pointLigh
     Vec3f h = W_i + W_o;
     h = normalize(h);
 
-    double cos_alpha_teta = dotProduct(hit.normal, h);
+    double cos_alpha_teta = dot(hit.normal, h);
     double epsilon = pow(10, -6);
     if (cos_alpha_teta < 0 + epsilon)
         cos_alpha_teta = 0;
@@ -184,20 +154,27 @@ Vec3f calculateSpecular(Hit hit, Ray ray, Vec3f irradiance, PointLight pointLigh
     return hit.material.specular * (irradiance * tmp);
 }
 
-int detectShadow(const Scene &scene, const PointLight &pointLight, const Vec3f &intersectionPoint, const Hit &hit)
+Ray generateShadowRay(const PointLight &pointLight, const Vec3f &intersectionPoint, const Hit &hit, float &lightDistance)
 {
     Ray shadow;
     shadow.direction = pointLight.position - intersectionPoint;
     shadow.direction = normalize(shadow.direction);
     shadow.origin = intersectionPoint + hit.normal * SHADOW_RAY_EPSILON;
 
-    float lightDistance = magnitude(pointLight.position - shadow.origin);
+    lightDistance = length(pointLight.position - shadow.origin);
+    return shadow;
+}
+
+int detectShadow(const Scene &scene, const PointLight &pointLight, const Vec3f &intersectionPoint, const Hit &hit)
+{
+    float lightDistance;
+    Ray shadow = generateShadowRay(pointLight, intersectionPoint, hit, lightDistance);
     if (DEBUG)
         std::cout << "[DEBUG] detectShadow: lightDistance = " << lightDistance << std::endl;
 
     for (const Mesh &mesh : scene.meshes)
     {
-        for (const Face &face : mesh.faces)
+        for (Face face : mesh.faces)
         {
             float t = intersectionTriangle(scene, shadow, face);
             if (DEBUG)
@@ -217,19 +194,17 @@ Ray detectMirror(Scene const &scene, Ray const &ray, Hit const &hit)
 {
     Ray result;
     Vec3f w0_direction = ray.direction * -1;
-    float dp = dotProduct(hit.normal, w0_direction);
+    float dp = dot(hit.normal, w0_direction);
     Vec3f w_r_direction = ray.direction + (hit.normal * 2) * dp;
     w_r_direction = normalize(w_r_direction);
     result.origin = hit.intersectionPoint + hit.normal * SHADOW_RAY_EPSILON;
     result.direction = w_r_direction;
     return result;
 }
-Hit sendRayToObjects(int recursion_number, const Scene &scene, const Ray &ray) {
-    Hit hit;
-    hit.pixel = scene.background_color; 
+float findClosestFace(const Scene &scene, const Ray &ray, int &meshIndex, int &faceIndex) {
     float t = -1;
-    int hitMeshIndex = -1;
-    int hitFaceIndex = -1;
+    meshIndex = -1;
+    faceIndex = -1;
 
     for (int i = 0; i < scene.meshes.size(); ++i) {
         const Mesh& mesh = scene.meshes[i];
@@ -243,31 +218,42 @@ Hit sendRayToObjects(int recursion_number, const Scene &scene, const Ray &ray) {
                 if (t < 0 || tmp_t < t) {
                     // find more near intersection
                     t = tmp_t;
-                    hitMeshIndex = i;
-                    hitFaceIndex = j;
+                    meshIndex = i;
+                    faceIndex = j;
                 }
             }
         }
     }
+    return t;
+}
 
-    if (t < 0) {
-        if (recursion_number > 0) {
-            hit.pixel = scene.background_color;
-            if (DEBUG) {
-                std::cout << "[DEBUG] sendRayToObjects: No hit, returning background." << std::endl;
-            }
-        }
-        return hit;
+Vec3f faceTextureColor(const Scene &scene, const Face &face) {
+    Vec3f t1 = scene.texcoord(face.t1_id);
+    Vec3f t2 = scene.texcoord(face.t2_id);
+    Vec3f t3 = scene.texcoord(face.t3_id);
+    return (t1 + t2 + t3) / 3.0f;
+}
+
+Vec3f faceNormal(const Scene &scene, const Face &face, const Ray &ray) {
+    Vec3f n1 = scene.normal(face.n1_id);
+    Vec3f n2 = scene.normal(face.n2_id);
+    Vec3f n3 = scene.normal(face.n3_id);
+    Vec3f normal = normalize(n1 + n2 + n3);
+    
+    if (dot(ray.direction, normal) > 0) {
+        normal = normal * -1;
     }
+    return normal;
+}
 
-    const Mesh& hitMesh = scene.meshes[hitMeshIndex];
-    const Face& face = hitMesh.faces[hitFaceIndex];
+void prepareHit(const Scene &scene, const Ray &ray, float t, int meshIndex, int faceIndex, Hit &hit) {
+    const Mesh& hitMesh = scene.meshes[meshIndex];
+    Face face = hitMesh.faces[faceIndex];
+    hit.isHit = true;
+    hit.t = t;
     hit.material = scene.materials[hitMesh.material_id - 1];
 
-    Vec3f t1 = scene.texture_data[face.t1_id - 1];
-    Vec3f t2 = scene.texture_data[face.t2_id - 1];
-    Vec3f t3 = scene.texture_data[face.t3_id - 1];
-    Vec3f uv = (t1 + t2 + t3) / 3.0f;
+    Vec3f uv = faceTextureColor(scene, face);
     
     hit.material.diffuse = hit.material.diffuse * (1 - hit.material.texture_factor) 
                            + uv * hit.material.texture_factor;
@@ -281,16 +267,28 @@ Hit sendRayToObjects(int recursion_number, const Scene &scene, const Ray &ray) {
                   << hit.intersectionPoint.z << ")" << std::endl;
     }
 
-    
-    Vec3f n1 = scene.normal_data[face.n1_id - 1];
-    Vec3f n2 = scene.normal_data[face.n2_id - 1];
-    Vec3f n3 = scene.normal_data[face.n3_id - 1];
-    hit.normal = normalize(n1 + n2 + n3);
-    
-    if (dotProduct(ray.direction, hit.normal) > 0) {
-        hit.normal = hit.normal * -1;
+    hit.normal = faceNormal(scene, face, ray);
+}
+
+Hit sendRayToObjects(int recursion_number, const Scene &scene, const Ray &ray) {
+    Hit hit;
+    hit.pixel = scene.background_color; 
+    int hitMeshIndex = -1;
+    int hitFaceIndex = -1;
+    float t = findClosestFace(scene, ray, hitMeshIndex, hitFaceIndex);
+
+    if (t < 0) {
+        if (recursion_number > 0) {
+            hit.pixel = scene.background_color;
+            if (DEBUG) {
+                std::cout << "[DEBUG] sendRayToObjects: No hit, returning background." << std::endl;
+            }
+        }
+        return hit;
     }
 
+    prepareHit(scene, ray, t, hitMeshIndex, hitFaceIndex, hit);
+
     
     Vec3f color = {0, 0, 0};
 
@@ -315,14 +313,14 @@ Hit sendRayToObjects(int recursion_number, const Scene &scene, const Ray &ray) {
 
     
             Vec3f L = normalize(pointLight.position - hit.intersectionPoint);
-            float cosTheta = dotProduct(hit.normal, L);
+            float cosTheta = dot(hit.normal, L);
             if (cosTheta < 0) cosTheta = 0;  
             Vec3f diffuse = hit.material.diffuse * (irradiance * cosTheta);
 
     
             Vec3f V = normalize(ray.origin - hit.intersectionPoint);         
             Vec3f H = normalize(L + V);                                     
-            float cosAlpha = dotProduct(hit.normal, H);
+            float cosAlpha = dot(hit.normal, H);
             if (cosAlpha < 0) cosAlpha = 0;
             float specFactor = pow(cosAlpha, hit.material.phong_exponent);
             Vec3f specular = hit.material.specular * (irradiance * specFactor);
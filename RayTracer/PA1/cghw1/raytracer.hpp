@@ -22,16 +22,18 @@ struct Hit {
     parser::Material material;
 };
 
-parser::Vec3f crossProduct(const parser::Vec3f &a, const parser::Vec3f &b);
-float dotProduct(const parser::Vec3f &a, const parser::Vec3f &b);
-parser::Vec3f normalize(const parser::Vec3f &v);
 Ray generateRay(const parser::Camera &cam, int i, int j);
 float intersectionPointLight(parser::Scene const &scene, Ray const &ray, parser::Vec3f center);
 float intersectionTriangle(const parser::Scene &scene, const Ray &ray, const parser::Face &face);
 parser::Vec3f calculateIrradience(Hit hit, parser::PointLight pointLight);
 parser::Vec3f calculateDiffuse(Hit hit, parser::PointLight pointLight, parser::Vec3f irradiance);
+Ray generateShadowRay(const parser::PointLight &pointLight, const parser::Vec3f &intersectionPoint, const Hit &hit, float &lightDistance);
 int detectShadow(const parser::Scene &scene, const parser::PointLight &pointLight, const parser::Vec3f &intersectionPoint, const Hit &hit);
 Ray detectMirror(parser::Scene const &scene, Ray const &ray, Hit const &hit);
+float findClosestFace(const parser::Scene &scene, const Ray &ray, int &meshIndex, int &faceIndex);
+parser::Vec3f faceTextureColor(const parser::Scene &scene, const parser::Face &face);
+parser::Vec3f faceNormal(const parser::Scene &scene, const parser::Face &face, const Ray &ray);
+void prepareHit(const parser::Scene &scene, const Ray &ray, float t, int meshIndex, int faceIndex, Hit &hit);
 Hit sendRayToObjects(int recursion_number, parser::Scene const &scene, Ray const &ray);
 
 #endif
\ No newline at end of file
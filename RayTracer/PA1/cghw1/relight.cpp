@@ -0,0 +1,170 @@
+#include "relight.hpp"
+#include "checksum.hpp"
+#include "mappedfile.hpp"
+#include "shading.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using namespace parser;
+
+namespace
+{
+    /*
+     * Hit cache file: HitCacheHeader, then the triangle of every pixel as
+     * int32 and its distance as float, both row by row. The checksum covers
+     * everything after the header.
+     */
+    const char HIT_CACHE_MAGIC[8] = {'H', 'W', '1', 'H', 'I', 'T', 'S', 0};
+    const uint32_t HIT_CACHE_VERSION = 1;
+
+    struct HitCacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        int32_t width, height;
+        uint32_t reserved;
+        uint64_t geometryKey;
+        uint64_t cameraKey;
+        uint64_t checksum;
+        char padding[16];
+    };
+
+    static_assert(sizeof(HitCacheHeader) == 64, "HitCacheHeader layout");
+
+    // runs body(x0, y0, x1, y1) for every tile of the camera image
+    template <typename Body>
+    void forEachTile(const Camera &cam, ThreadPool &pool, const Body &body)
+    {
+        int tilesX = (cam.image_width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (cam.image_height + TILE_SIZE - 1) / TILE_SIZE;
+        pool.parallelFor(tilesX * tilesY, [&](int tile) {
+            int x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+            body(x0, y0, std::min(x0 + TILE_SIZE, cam.image_width), std::min(y0 + TILE_SIZE, cam.image_height));
+        });
+    }
+}
+
+void tracePrimaryHits(const Scene &scene, const CompiledScene &compiled, ThreadPool &pool, PrimaryHits &hits)
+{
+    const Camera &cam = scene.camera;
+    hits.width = cam.image_width;
+    hits.height = cam.image_height;
+    hits.triangle.assign((size_t)hits.width * hits.height, -1);
+    hits.distance.assign((size_t)hits.width * hits.height, -1.0f);
+    forEachTile(cam, pool, [&](int x0, int y0, int x1, int y1) {
+        KernelScene view = compiled.view();
+        for (int y = y0; y < y1; ++y) {
+            for (int x = x0; x < x1; ++x) {
+                size_t pixel = (size_t)y * hits.width + x;
+                int triangle;
+                float t = activeKernels().closestHit(view, generateRay(cam, x, y), triangle);
+                if (t >= 0) {
+                    hits.triangle[pixel] = triangle;
+                    hits.distance[pixel] = t;
+                }
+            }
+        }
+    });
+}
+
+void shadePrimaryHits(const Scene &scene, const CompiledScene &compiled, ThreadPool &pool, const PrimaryHits &hits,
+                      unsigned char *image)
+{
+    // the same hits, in the same order, as renderTile
+    const Camera &cam = scene.camera;
+    ImageWindow window = {image, 0, 0, cam.image_width, cam.image_height};
+    forEachTile(cam, pool, [&](int x0, int y0, int x1, int y1) {
+        TileBuffers buffers;
+        beginTile(scene, (x1 - x0) * (y1 - y0), buffers);
+        for (int y = y0; y < y1; ++y) {
+            for (int x = x0; x < x1; ++x) {
+                int pixel = window.index(x, y);
+                if (hits.triangle[pixel] < 0)
+                    writeBackground(scene, pixel, image);
+                else
+                    appendHit(scene, compiled, generateRay(cam, x, y), hits.distance[pixel], hits.triangle[pixel], pixel, buffers);
+            }
+        }
+        finishTile(scene, compiled, image, buffers);
+    });
+}
+
+bool saveHitCache(const std::string &path, uint64_t geometryKey, uint64_t cameraKey, const PrimaryHits &hits)
+{
+    size_t pixels = hits.triangle.size();
+    HitCacheHeader header = {};
+    memcpy(header.magic, HIT_CACHE_MAGIC, sizeof(header.magic));
+    header.version = HIT_CACHE_VERSION;
+    header.width = hits.width;
+    header.height = hits.height;
+    header.geometryKey = geometryKey;
+    header.cameraKey = cameraKey;
+    Checksum checksum;
+    checksum.update(hits.triangle.data(), pixels * sizeof(int));
+    checksum.update(hits.distance.data(), pixels * sizeof(float));
+    header.checksum = checksum.value();
+
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(hits.triangle.data(), sizeof(int), pixels, file) == pixels &&
+                   fwrite(hits.distance.data(), sizeof(float), pixels, file) == pixels;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool loadHitCache(const std::string &path, uint64_t geometryKey, uint64_t cameraKey, PrimaryHits &hits, std::string &error)
+{
+    MappedFile file;
+    HitCacheHeader header;
+    if (!file.open(path)) {
+        error = "no cache";
+        return false;
+    }
+    if (file.size() < sizeof(header) || memcmp(file.data(), HIT_CACHE_MAGIC, sizeof(HIT_CACHE_MAGIC)) != 0) {
+        error = "not a hit cache";
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.version != HIT_CACHE_VERSION) {
+        error = "written by another version";
+        return false;
+    }
+    if (header.geometryKey != geometryKey) {
+        error = "the geometry changed";
+        return false;
+    }
+    if (header.cameraKey != cameraKey) {
+        error = "the camera changed";
+        return false;
+    }
+
+    size_t pixels = (size_t)std::max(header.width, 0) * std::max(header.height, 0);
+    bool valid = file.size() == sizeof(header) + pixels * (sizeof(int) + sizeof(float));
+    if (valid) {
+        Checksum checksum;
+        checksum.update(file.data() + sizeof(header), file.size() - sizeof(header));
+        valid = checksum.value() == header.checksum;
+    }
+    if (!valid) {
+        error = "damaged";
+        return false;
+    }
+
+    const unsigned char *data = file.data() + sizeof(header);
+    hits.width = header.width;
+    hits.height = header.height;
+    hits.triangle.resize(pixels);
+    hits.distance.resize(pixels);
+    memcpy(hits.triangle.data(), data, pixels * sizeof(int));
+    memcpy(hits.distance.data(), data + pixels * sizeof(int), pixels * sizeof(float));
+    return true;
+}
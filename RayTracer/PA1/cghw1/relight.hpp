@@ -0,0 +1,38 @@
+#ifndef RELIGHT_HPP
+#define RELIGHT_HPP
+
+#include "parser.hpp"
+#include "kernels.hpp"
+#include "threadpool.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Relighting cache. The primary hit of every pixel, as the compiled triangle
+// and the distance along the camera ray, is saved to a file; while the
+// geometry and the camera stay the same, later renders rebuild the hits from
+// it and only run shading and shadow rays, so lights and materials (even
+// which material a mesh uses) can change freely. Primary hits are all there
+// is to keep: they are resolved without mirror bounces (see finishTile).
+struct PrimaryHits
+{
+    int width = 0, height = 0;
+    std::vector<int> triangle;      // per pixel, -1 for the background
+    std::vector<float> distance;
+};
+
+// One closest-hit query per pixel of scene.camera, a tile per pool index.
+void tracePrimaryHits(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, PrimaryHits &hits);
+// Shades hits into image (width * height RGB bytes), giving the image a
+// render with the same geometry and camera would.
+void shadePrimaryHits(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, const PrimaryHits &hits,
+                      unsigned char *image);
+
+// The file is keyed by the geometry (geometryHash) and the camera
+// (cameraHash) and written through a temporary file renamed over path.
+bool saveHitCache(const std::string &path, uint64_t geometryKey, uint64_t cameraKey, const PrimaryHits &hits);
+// false, with the reason in error, unless path holds intact hits for this
+// geometry and camera.
+bool loadHitCache(const std::string &path, uint64_t geometryKey, uint64_t cameraKey, PrimaryHits &hits, std::string &error);
+
+#endif
@@ -0,0 +1,233 @@
+#include "render.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+
+RenderStats renderImage(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, bool hybrid,
+                        unsigned char *image, const std::atomic<bool> *cancel, TileProgress *progress)
+{
+    ImageWindow window = {image, 0, 0, scene.camera.image_width, scene.camera.image_height};
+    if (!hybrid)
+        return renderWindow(scene, compiled, pool, 0, window, cancel, progress);
+
+    RasterScene raster;
+    buildRasterScene(scene, compiled, pool, raster);
+    RenderStats stats = renderWindow(scene, compiled, pool, &raster, window, cancel, progress);
+    stats.clipped = raster.clipped.size();
+    return stats;
+}
+
+RenderStats renderWindow(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, const RasterScene *raster,
+                         const ImageWindow &window, const std::atomic<bool> *cancel, TileProgress *progress)
+{
+    // kernel tiles stay on the image's grid, clipped to the window
+    int tileX0 = window.x0 / TILE_SIZE, tileY0 = window.y0 / TILE_SIZE;
+    int tilesX = (window.x1 + TILE_SIZE - 1) / TILE_SIZE - tileX0;
+    int tilesY = (window.y1 + TILE_SIZE - 1) / TILE_SIZE - tileY0;
+
+    if (progress && progress->count() != tilesX * tilesY)
+        progress->reset(tilesX * tilesY);
+
+    RenderStats stats;
+    std::atomic<int> rendered(0);
+    std::atomic<long> traced(0);
+    pool.parallelFor(tilesX * tilesY, [&](int tile) {
+        if (progress && progress->finished(tile)) {
+            ++rendered;
+            return;
+        }
+        if (cancel && *cancel)
+            return;
+        int tileX = tileX0 + tile % tilesX, tileY = tileY0 + tile / tilesX;
+        TileBuffers buffers;
+        if (raster) {
+            traced += renderTileHybrid(scene, compiled, *raster, tileX, tileY, window, buffers);
+        } else {
+            int x0 = std::max(tileX * TILE_SIZE, window.x0), y0 = std::max(tileY * TILE_SIZE, window.y0);
+            int x1 = std::min((tileX + 1) * TILE_SIZE, window.x1), y1 = std::min((tileY + 1) * TILE_SIZE, window.y1);
+            renderTile(scene, compiled, x0, y0, x1, y1, window, buffers);
+        }
+        ++rendered;
+        if (progress) {
+            progress->finish(tile);
+            if (progress->onTile)
+                progress->onTile();
+        }
+    });
+    stats.undecided = traced.load();
+    stats.cancelled = rendered.load() < tilesX * tilesY;
+    return stats;
+}
+
+RenderStats renderRegions(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, bool hybrid,
+                          const std::vector<Region> &regions, const ImageWindow &target)
+{
+    RasterScene raster;
+    if (hybrid)
+        buildRasterScene(scene, compiled, pool, raster);
+
+    RenderStats stats;
+    std::vector<unsigned char> pixels;
+    for (const Region &region : regions) {
+        int width = region.x1 - region.x0;
+        pixels.resize((size_t)width * (region.y1 - region.y0) * 3);
+        ImageWindow window = {&pixels[0], region.x0, region.y0, region.x1, region.y1};
+        stats.undecided += renderWindow(scene, compiled, pool, hybrid ? &raster : 0, window).undecided;
+        for (int y = region.y0; y < region.y1; ++y)
+            std::memcpy(target.image + (size_t)target.index(region.x0, y) * 3, &pixels[(size_t)window.index(region.x0, y) * 3], (size_t)width * 3);
+    }
+    stats.clipped = raster.clipped.size();
+    return stats;
+}
+
+void renderViews(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                 const std::vector<parser::Camera> &cameras, const std::vector<unsigned char *> &images)
+{
+    // first tile of each view in the batch
+    std::vector<int> first(1, 0);
+    for (const parser::Camera &cam : cameras) {
+        int tilesX = (cam.image_width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (cam.image_height + TILE_SIZE - 1) / TILE_SIZE;
+        first.push_back(first.back() + tilesX * tilesY);
+    }
+    pool.parallelFor(first.back(), [&](int index) {
+        int view = (int)(std::upper_bound(first.begin(), first.end(), index) - first.begin()) - 1;
+        const parser::Camera &cam = cameras[view];
+        int tilesX = (cam.image_width + TILE_SIZE - 1) / TILE_SIZE;
+        int tile = index - first[view];
+        int x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+        int x1 = std::min(x0 + TILE_SIZE, cam.image_width), y1 = std::min(y0 + TILE_SIZE, cam.image_height);
+
+        // the rays of renderTile, in its order, for this view's camera
+        Ray rays[KERNEL_TILE_PIXELS];
+        unsigned char colors[KERNEL_TILE_PIXELS * 3];
+        int count = 0;
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+                rays[count++] = generateRay(cam, x, y);
+        TileBuffers buffers;
+        renderRays(scene, compiled, rays, count, colors, buffers);
+        for (int y = y0; y < y1; ++y)
+            std::memcpy(images[view] + ((size_t)y * cam.image_width + x0) * 3, colors + (y - y0) * (x1 - x0) * 3, (size_t)(x1 - x0) * 3);
+    });
+}
+
+bool readCameras(const std::string &path, std::vector<parser::Camera> &cameras)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+        return false;
+    for (std::string line; std::getline(file, line);) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        if (line.empty() || line[0] == '#')
+            continue;
+        parser::Camera cam;
+        char end;
+        if (sscanf(line.c_str(), "%f %f %f %f %f %f %f %f %f %f %f %f %f %f %d %d %c",
+                   &cam.position.x, &cam.position.y, &cam.position.z, &cam.gaze.x, &cam.gaze.y, &cam.gaze.z,
+                   &cam.up.x, &cam.up.y, &cam.up.z, &cam.near_plane.x, &cam.near_plane.y, &cam.near_plane.z, &cam.near_plane.w,
+                   &cam.near_distance, &cam.image_width, &cam.image_height, &end) != 16 ||
+            cam.image_width < 1 || cam.image_height < 1)
+            return false;
+        cameras.push_back(cam);
+    }
+    return true;
+}
+
+bool parseRegion(const std::string &text, Region &region)
+{
+    char end;
+    return sscanf(text.c_str(), "%d,%d,%d,%d%c", &region.x0, &region.y0, &region.x1, &region.y1, &end) == 4;
+}
+
+bool readRegions(const std::string &path, std::vector<Region> &regions)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+        return false;
+    for (std::string line; std::getline(file, line);) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        Region region;
+        if (line.empty() || line[0] == '#')
+            continue;
+        if (!parseRegion(line, region))
+            return false;
+        regions.push_back(region);
+    }
+    return true;
+}
+
+void writePpm(const std::string &path, const unsigned char *image, int width, int height,
+              const std::vector<std::string> &comments)
+{
+    FILE *outfile = fopen(path.c_str(), "w");
+    if (!outfile) {
+        perror("Error opening file");
+        throw std::runtime_error("Error: The ppm file cannot be opened for writing.");
+    }
+
+    fprintf(outfile, "P3\n");
+    for (const std::string &comment : comments)
+        fprintf(outfile, "# %s\n", comment.c_str());
+    fprintf(outfile, "%d %d\n255\n", width, height);
+    size_t idx = 0;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            for (int c = 0; c < 3; ++c, ++idx) {
+                if (i == width - 1 && c == 2)
+                    fprintf(outfile, "%d", image[idx]);
+                else
+                    fprintf(outfile, "%d ", image[idx]);
+            }
+        }
+        fprintf(outfile, "\n");
+    }
+    fclose(outfile);
+}
+
+// skips whitespace and # comments between header fields
+static bool readHeaderField(FILE *file, int &value)
+{
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(file)) != EOF && c != '\n') {}
+        } else if (!isspace(c)) {
+            ungetc(c, file);
+            return fscanf(file, "%d", &value) == 1;
+        }
+    }
+    return false;
+}
+
+void readPpm(const std::string &path, std::vector<unsigned char> &image, int &width, int &height)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        throw std::runtime_error("Error: The ppm file " + path + " cannot be opened for reading.");
+    char magic[3] = {};
+    int maxValue = 0;
+    bool valid = fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && (magic[1] == '3' || magic[1] == '6') &&
+                 readHeaderField(file, width) && readHeaderField(file, height) && readHeaderField(file, maxValue) &&
+                 width > 0 && height > 0 && maxValue == 255;
+    if (valid) {
+        image.resize((size_t)width * height * 3);
+        if (magic[1] == '6') {
+            valid = fgetc(file) != EOF && fread(&image[0], 1, image.size(), file) == image.size();
+        } else {
+            for (size_t i = 0; i < image.size() && valid; ++i) {
+                int value;
+                valid = fscanf(file, "%d", &value) == 1 && value >= 0 && value <= 255;
+                image[i] = (unsigned char)value;
+            }
+        }
+    }
+    fclose(file);
+    if (!valid)
+        throw std::runtime_error("Error: " + path + " is not an 8-bit PPM image.");
+}
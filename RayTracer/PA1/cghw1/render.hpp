@@ -0,0 +1,92 @@
+#ifndef RENDER_HPP
+#define RENDER_HPP
+
+#include "parser.hpp"
+#include "kernels.hpp"
+#include "raster.hpp"
+#include "shading.hpp"
+#include "threadpool.hpp"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pixel rectangle [x0, x1) x [y0, y1) of the camera frame.
+struct Region
+{
+    int x0, y0, x1, y1;
+};
+
+struct RenderStats
+{
+    bool cancelled = false;     // some tiles were never rendered
+    long undecided = 0;         // hybrid: pixels the z-buffer left to the tracer
+    size_t clipped = 0;         // hybrid: triangles reaching behind the camera
+};
+
+// Finished kernel tiles of a window, in row order over its tile grid, so a
+// render can be checkpointed and resumed. onTile, if set, runs on the
+// rendering thread after each tile; the tiles finished() reports have all
+// their pixels in the image.
+class TileProgress
+{
+public:
+    void reset(int tiles) { std::lock_guard<std::mutex> lock(mutex); done.assign(tiles, 0); }
+    void restore(const std::vector<unsigned char> &tiles) { std::lock_guard<std::mutex> lock(mutex); done = tiles; }
+    int count() const { std::lock_guard<std::mutex> lock(mutex); return (int)done.size(); }
+    bool finished(int tile) const { std::lock_guard<std::mutex> lock(mutex); return done[tile] != 0; }
+    void finish(int tile) { std::lock_guard<std::mutex> lock(mutex); done[tile] = 1; }
+    std::vector<unsigned char> finished() const { std::lock_guard<std::mutex> lock(mutex); return done; }
+
+    std::function<void()> onTile;
+
+private:
+    mutable std::mutex mutex;
+    std::vector<unsigned char> done;
+};
+
+// Renders scene.camera into image (width * height RGB bytes), one tile per
+// pool index, through the hybrid rasterizer if asked. Once cancel is set no
+// further tile is started and the image is left incomplete. With progress,
+// tiles it has as finished are skipped and the others are marked as they
+// finish (it is reset if it does not have one entry per tile).
+RenderStats renderImage(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, bool hybrid,
+                        unsigned char *image, const std::atomic<bool> *cancel = 0, TileProgress *progress = 0);
+// The same for the pixels of window only, through raster when it is given
+// (built for the whole image, so it can be reused across windows).
+RenderStats renderWindow(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, const RasterScene *raster,
+                         const ImageWindow &window, const std::atomic<bool> *cancel = 0, TileProgress *progress = 0);
+
+// Renders each region with the same rays as a full frame and copies it into
+// target, which must contain them all (their bounding box for a crop, the
+// whole frame to patch an existing image).
+RenderStats renderRegions(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool, bool hybrid,
+                          const std::vector<Region> &regions, const ImageWindow &target);
+// Renders the frame of every camera into its image (that camera's width *
+// height RGB bytes). The tiles of all views go to the pool as one batch, so
+// threads that run out of tiles in one view carry on with the next instead
+// of waiting for the frame to finish. Tiles are traced as renderTile does,
+// without the hybrid rasterizer.
+void renderViews(const parser::Scene &scene, const CompiledScene &compiled, ThreadPool &pool,
+                 const std::vector<parser::Camera> &cameras, const std::vector<unsigned char *> &images);
+// One camera per line: position, gaze, up, near plane (left right bottom
+// top), near distance and resolution, as in a scene's <camera>. Blank lines
+// and # comments are ignored; false if the file cannot be read or a line is
+// not a camera.
+bool readCameras(const std::string &path, std::vector<parser::Camera> &cameras);
+
+// "x0,y0,x1,y1"
+bool parseRegion(const std::string &text, Region &region);
+// One region per line, blank lines and # comments ignored; false if the
+// file cannot be read or a line is not a region.
+bool readRegions(const std::string &path, std::vector<Region> &regions);
+
+// Writes image as a plain (P3) PPM, with comments (one per line) in the
+// header; throws if the file cannot be opened.
+void writePpm(const std::string &path, const unsigned char *image, int width, int height,
+              const std::vector<std::string> &comments = std::vector<std::string>());
+// Reads a P3 or P6 PPM with 8-bit channels; throws if it cannot.
+void readPpm(const std::string &path, std::vector<unsigned char> &image, int &width, int &height);
+
+#endif
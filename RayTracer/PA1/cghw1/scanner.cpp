@@ -0,0 +1,301 @@
+#include "scanner.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace
+{
+    // exactly representable powers of ten
+    const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const int MAX_EXACT_POWER = 22;
+    const uint64_t MAX_EXACT_MANTISSA = (uint64_t)1 << 53;
+
+    inline bool isSpace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    inline const char *skipSpace(const char *p, const char *end)
+    {
+        while (p < end && isSpace(*p))
+            ++p;
+        return p;
+    }
+
+    inline const char *tokenEnd(const char *p, const char *end)
+    {
+        while (p < end && !isSpace(*p))
+            ++p;
+        return p;
+    }
+
+    // strtof on a token that is not null-terminated
+    bool slowFloat(const char *begin, const char *end, float &value)
+    {
+        char buffer[64];
+        size_t length = end - begin;
+        std::string large;
+        const char *text = buffer;
+        if (length < sizeof(buffer)) {
+            memcpy(buffer, begin, length);
+            buffer[length] = 0;
+        } else {
+            large.assign(begin, end);
+            text = large.c_str();
+        }
+
+        char *parsed;
+        float result = strtof(text, &parsed);
+        if (parsed != text + length || parsed == text)
+            return false;
+        value = result;
+        return true;
+    }
+
+    inline bool scanPart(const char *&p, const char *end, parser::Vec3f &vector, int part)
+    {
+        return parser::scanFloat(p, end, part == 0 ? vector.x : part == 1 ? vector.y : vector.z);
+    }
+
+    inline bool scanPart(const char *&p, const char *end, parser::Face &face, int part)
+    {
+        switch (part) {
+        case 0: return parser::scanFaceCorner(p, end, face.v1_id, face.t1_id, face.n1_id);
+        case 1: return parser::scanFaceCorner(p, end, face.v2_id, face.t2_id, face.n2_id);
+        default: return parser::scanFaceCorner(p, end, face.v3_id, face.t3_id, face.n3_id);
+        }
+    }
+}
+
+size_t parser::countTokens(const char *begin, const char *end)
+{
+    size_t count = 0;
+    const char *p = skipSpace(begin, end);
+    while (p < end) {
+        ++count;
+        p = skipSpace(tokenEnd(p, end), end);
+    }
+    return count;
+}
+
+size_t parser::countTokens(const char *begin, const char *end, ThreadPool *pool)
+{
+    if (!pool || pool->size() < 2 || (size_t)(end - begin) <= SCAN_CHUNK_BYTES)
+        return countTokens(begin, end);
+    std::vector<const char *> bounds(1, begin);
+    while (bounds.back() < end) {
+        const char *p = bounds.back() + std::min((size_t)(end - bounds.back()), SCAN_CHUNK_BYTES);
+        bounds.push_back(tokenEnd(p, end));
+    }
+    std::vector<size_t> counts(bounds.size() - 1);
+    pool->parallelFor((int)counts.size(), [&](int c) { counts[c] = countTokens(bounds[c], bounds[c + 1]); });
+    size_t total = 0;
+    for (size_t count : counts)
+        total += count;
+    return total;
+}
+
+bool parser::scanFloat(const char *&p, const char *end, float &value)
+{
+    const char *s = skipSpace(p, end);
+    if (s == end)
+        return false;
+    const char *token = s;
+
+    bool negative = false;
+    if (*s == '+' || *s == '-')
+        negative = *s++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    bool exact = true;
+    for (; s < end && isDigit(*s); ++s, ++digits) {
+        if (mantissa < MAX_EXACT_MANTISSA / 10)
+            mantissa = mantissa * 10 + (*s - '0');
+        else
+            exact = false;
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && isDigit(*s); ++s, ++digits) {
+            if (mantissa < MAX_EXACT_MANTISSA / 10) {
+                mantissa = mantissa * 10 + (*s - '0');
+                --exponent;
+            } else {
+                exact = false;
+            }
+        }
+    }
+    if (digits > 0 && s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '+' || *e == '-'))
+            negativeExponent = *e++ == '-';
+        if (e < end && isDigit(*e)) {
+            int value = 0;
+            for (; e < end && isDigit(*e); ++e)
+                if (value < 10000)
+                    value = value * 10 + (*e - '0');
+            exponent += negativeExponent ? -value : value;
+            s = e;
+        }
+    }
+
+    const char *next = tokenEnd(s, end);
+    if (digits > 0 && next == s && exact && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER) {
+        // both operands are exact, so this is the correctly rounded double
+        double result = exponent < 0 ? mantissa / powersOfTen[-exponent] : mantissa * powersOfTen[exponent];
+        uint64_t bits;
+        memcpy(&bits, &result, sizeof(bits));
+        // rounding that double to float is only wrong when it sits exactly
+        // halfway between two floats, or when the float would be subnormal
+        bool halfway = (bits & 0x1FFFFFFF) == 0x10000000;
+        if (result == 0 || (!halfway && result >= FLT_MIN && result <= FLT_MAX)) {
+            value = negative ? -(float)result : (float)result;
+            p = next;
+            return true;
+        }
+    }
+
+    if (digits == 0 || !slowFloat(token, next, value))
+        return false;
+    p = next;
+    return true;
+}
+
+bool parser::scanInt(const char *&p, const char *end, int &value)
+{
+    const char *s = skipSpace(p, end);
+    bool negative = false;
+    if (s < end && (*s == '+' || *s == '-'))
+        negative = *s++ == '-';
+    if (s == end || !isDigit(*s))
+        return false;
+
+    long long result = 0;
+    for (; s < end && isDigit(*s); ++s) {
+        result = result * 10 + (*s - '0');
+        if (result > (long long)INT_MAX + 1)
+            return false;
+    }
+    result = negative ? -result : result;
+    if (result > INT_MAX)
+        return false;
+    value = (int)result;
+    p = s;
+    return true;
+}
+
+// A corner is a single token; no whitespace is allowed around the slashes
+// so that chunked scanning can count corners as tokens.
+bool parser::scanFaceCorner(const char *&p, const char *end, int &v, int &t, int &n)
+{
+    const char *s = p;
+    if (!scanInt(s, end, v) || s == end || *s != '/')
+        return false;
+    if (++s == end || isSpace(*s) || !scanInt(s, end, t) || s == end || *s != '/')
+        return false;
+    if (++s == end || isSpace(*s) || !scanInt(s, end, n) || (s < end && !isSpace(*s)))
+        return false;
+    p = s;
+    return true;
+}
+
+template <typename T, typename Allocator>
+parser::BlockScanner<T, Allocator>::BlockScanner(std::vector<T, Allocator> &out, int group) : out(out), base(out.size()), group(group)
+{
+}
+
+// The piece is split at whitespace into chunks (a single one without a
+// pool or for small pieces). A counting pass gives each chunk the index of
+// its first token, out grows to hold them all, and then every chunk parses
+// into its own range of out. The earliest bad token of any chunk ends the
+// block, exactly where a sequential scan would stop.
+template <typename T, typename Allocator>
+bool parser::BlockScanner<T, Allocator>::scan(const char *begin, const char *end, ThreadPool *pool)
+{
+    if (stopped)
+        return false;
+
+    size_t chunkBytes = pool && pool->size() > 1 ? SCAN_CHUNK_BYTES : (size_t)(end - begin);
+    std::vector<const char *> bounds(1, begin);
+    while (bounds.back() < end) {
+        const char *p = bounds.back() + std::min((size_t)(end - bounds.back()), chunkBytes);
+        bounds.push_back(tokenEnd(p, end));
+    }
+    int chunks = (int)bounds.size() - 1;
+    if (chunks == 0)
+        return true;
+
+    std::vector<size_t> first(chunks + 1, tokens);
+    auto count = [&](int c) { first[c + 1] = countTokens(bounds[c], bounds[c + 1]); };
+    if (chunks > 1)
+        pool->parallelFor(chunks, count);
+    else
+        count(0);
+    for (int c = 0; c < chunks; ++c)
+        first[c + 1] += first[c];
+    out.resize(base + (first[chunks] + group - 1) / group);
+
+    T *target = &out[0] + base;
+    std::vector<size_t> stop(chunks, first[chunks]);
+    auto parse = [&](int c) {
+        const char *p = bounds[c];
+        T *element = target + first[c] / group;
+        int part = (int)(first[c] % group);
+        for (size_t token = first[c]; token < first[c + 1]; ++token) {
+            if (!scanPart(p, bounds[c + 1], *element, part)) {
+                stop[c] = token;
+                break;
+            }
+            if (++part == group) {
+                part = 0;
+                ++element;
+            }
+        }
+    };
+    if (chunks > 1)
+        pool->parallelFor(chunks, parse);
+    else
+        parse(0);
+
+    tokens = *std::min_element(stop.begin(), stop.end());
+    stopped = tokens < first[chunks];
+    return !stopped;
+}
+
+template <typename T, typename Allocator>
+void parser::BlockScanner<T, Allocator>::finish()
+{
+    out.resize(base + tokens / group);
+}
+
+template class parser::BlockScanner<parser::Vec3f>;
+template class parser::BlockScanner<parser::Vec3f, ArenaAllocator<parser::Vec3f> >;
+template class parser::BlockScanner<parser::Face>;
+
+void parser::scanVectorBlock(const char *begin, const char *end, int components, std::vector<Vec3f> &out, ThreadPool *pool)
+{
+    BlockScanner<Vec3f> scanner(out, components);
+    scanner.scan(begin, end, pool);
+    scanner.finish();
+}
+
+void parser::scanFaceBlock(const char *begin, const char *end, std::vector<Face> &out, ThreadPool *pool)
+{
+    BlockScanner<Face> scanner(out, 3);
+    scanner.scan(begin, end, pool);
+    scanner.finish();
+}
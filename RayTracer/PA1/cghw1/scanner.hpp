@@ -0,0 +1,67 @@
+#ifndef __HW1__SCANNER__
+#define __HW1__SCANNER__
+
+#include "parser.hpp"
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+namespace parser
+{
+    // Allocation-free scanning of the large numeric blocks (<vertexdata>,
+    // <texturedata>, <normaldata> and <faces>). Floats take a fast exact
+    // path when the decimal fits in a double and fall back to strtof
+    // otherwise, so values are bit-identical to reading with operator>>.
+    //
+    // The scan functions skip leading whitespace, advance p past what they
+    // consumed and return false at the end of the text or at a token that
+    // is not a number (like operator>> failing, which ends a block).
+
+    // number of whitespace separated tokens, used to size the output up front
+    size_t countTokens(const char *begin, const char *end);
+    // the same, counting chunks of SCAN_CHUNK_BYTES in parallel
+    size_t countTokens(const char *begin, const char *end, ThreadPool *pool);
+
+    bool scanFloat(const char *&p, const char *end, float &value);
+    bool scanInt(const char *&p, const char *end, int &value);
+    // one "v/t/n" face corner
+    bool scanFaceCorner(const char *&p, const char *end, int &v, int &t, int &n);
+
+    // Splits large pieces into chunks of this size when given a pool.
+    const size_t SCAN_CHUNK_BYTES = 1 << 20;
+
+    // A numeric block that may arrive in pieces, as when it is streamed from
+    // the file. Every piece must end at whitespace or at the end of the
+    // block; an element split between pieces is completed by the next one.
+    // With a pool, pieces larger than SCAN_CHUNK_BYTES are counted and parsed
+    // in parallel chunks, each writing straight to its final position in out.
+    // The result is the same as a sequential scan, including where a bad
+    // token ends the block.
+    template <typename T, typename Allocator = std::allocator<T> >
+    class BlockScanner
+    {
+    public:
+        // group is the number of tokens per element: 2 or 3 floats for a
+        // Vec3f (z stays 0 for 2), 3 corners for a Face
+        BlockScanner(std::vector<T, Allocator> &out, int group);
+
+        // returns false once a bad token has ended the block
+        bool scan(const char *begin, const char *end, ThreadPool *pool = 0);
+        // drops a trailing partial element; call after the last piece
+        void finish();
+
+    private:
+        std::vector<T, Allocator> &out;
+        size_t base;                    // first element of the block in out
+        int group;
+        size_t tokens = 0;              // tokens scanned so far
+        bool stopped = false;
+    };
+
+    // Whole blocks in one piece, appended to out.
+    void scanVectorBlock(const char *begin, const char *end, int components, std::vector<Vec3f> &out, ThreadPool *pool = 0);
+    void scanFaceBlock(const char *begin, const char *end, std::vector<Face> &out, ThreadPool *pool = 0);
+}
+
+#endif
@@ -0,0 +1,406 @@
+#include "parser.hpp"
+#include "checksum.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Binary scene files are little-endian and are read in place"
+#endif
+
+/*
+ * Binary scene file, written by "program compile":
+ *
+ *   FileHeader                 64 bytes
+ *   SectionEntry[count]        right after the header
+ *   sections                   each at a multiple of 64 bytes, zero padded
+ *
+ * All values are little-endian. The checksum covers every byte after the
+ * header, so a truncated, corrupt or partially rewritten file is rejected.
+ * Files from another format version are rejected too and must be compiled
+ * again from the XML.
+ */
+namespace
+{
+    using namespace parser;
+
+    const char SCENE_MAGIC[8] = {'H', 'W', '1', 'S', 'C', 'E', 'N', 'E'};
+    const uint32_t SCENE_VERSION = 1;
+    const uint64_t SECTION_ALIGNMENT = 64;
+
+    enum SectionType
+    {
+        SECTION_SETTINGS = 1,       // one SettingsRecord
+        SECTION_STRINGS,            // ids and texture image, null-terminated
+        SECTION_POINT_LIGHTS,
+        SECTION_TRIANGULAR_LIGHTS,
+        SECTION_MATERIALS,
+        SECTION_VERTICES,
+        SECTION_TEXCOORDS,
+        SECTION_NORMALS,
+        SECTION_MESHES,
+        SECTION_FACES,              // faces of all meshes, in mesh order
+        SECTION_CAMERAS,            // every camera, the settings one first; optional
+        SECTION_COUNT = SECTION_CAMERAS
+    };
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t sectionCount;
+        uint64_t fileSize;
+        uint64_t checksum;
+        char reserved[32];
+    };
+
+    struct SectionEntry
+    {
+        uint32_t type;
+        uint32_t elementSize;
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct SettingsRecord
+    {
+        int32_t maxraytracedepth;
+        Vec3i background_color;
+        Camera camera;
+        Vec3f ambient_light;
+    };
+
+    struct PointLightRecord
+    {
+        Vec3f position, intensity;
+    };
+
+    struct TriangularLightRecord
+    {
+        Vec3f vertex1, vertex2, vertex3, intensity;
+    };
+
+    struct MaterialRecord
+    {
+        Vec3f ambient, diffuse, specular, mirror_reflactance;
+        float phong_exponent, texture_factor;
+    };
+
+    struct MeshRecord
+    {
+        int32_t material_id;
+        uint32_t reserved;
+        uint64_t faceCount;
+    };
+
+    static_assert(sizeof(FileHeader) == 64, "FileHeader layout");
+    static_assert(sizeof(SectionEntry) == 24, "SectionEntry layout");
+    static_assert(sizeof(SettingsRecord) == 92, "SettingsRecord layout");
+    static_assert(sizeof(MaterialRecord) == 56, "MaterialRecord layout");
+    static_assert(sizeof(MeshRecord) == 16, "MeshRecord layout");
+    static_assert(sizeof(Vec3f) == 12 && sizeof(Face) == 36, "geometry layout");
+    static_assert(sizeof(Camera) == 64, "Camera layout");
+
+    uint64_t alignSection(uint64_t offset)
+    {
+        return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    }
+
+    // A section to write, gathered from pieces that stay where they are.
+    struct OutputSection
+    {
+        uint32_t type;
+        uint32_t elementSize;
+        uint64_t count;
+        std::vector<std::pair<const void *, size_t> > pieces;
+    };
+
+    template <typename T, typename Allocator>
+    OutputSection section(SectionType type, const std::vector<T, Allocator> &items)
+    {
+        OutputSection out = {type, (uint32_t)sizeof(T), items.size(), {}};
+        if (!items.empty())
+            out.pieces.push_back(std::make_pair((const void *)items.data(), items.size() * sizeof(T)));
+        return out;
+    }
+
+    void appendString(std::vector<char> &strings, const std::string &text)
+    {
+        strings.insert(strings.end(), text.begin(), text.end());
+        strings.push_back(0);
+    }
+
+    class SceneWriter
+    {
+    public:
+        explicit SceneWriter(const std::string &path) : path(path)
+        {
+            // room for the header, which is written last and not checksummed
+            FileHeader header = {};
+            file = fopen(path.c_str(), "wb");
+            if (!file)
+                throw std::runtime_error("Error: " + path + " cannot be opened for writing.");
+            if (fwrite(&header, sizeof(header), 1, file) != 1) {
+                fclose(file);
+                throw std::runtime_error("Error: Writing " + path + " failed.");
+            }
+            offset = sizeof(header);
+        }
+
+        ~SceneWriter()
+        {
+            if (file)
+                fclose(file);
+        }
+
+        void write(const void *data, size_t size)
+        {
+            if (fwrite(data, 1, size, file) != size)
+                throw std::runtime_error("Error: Writing " + path + " failed.");
+            checksum.update(data, size);
+            offset += size;
+        }
+
+        void padTo(uint64_t target)
+        {
+            static const char zeros[SECTION_ALIGNMENT] = {};
+            while (offset < target)
+                write(zeros, std::min(target - offset, SECTION_ALIGNMENT));
+        }
+
+        void close(FileHeader &header)
+        {
+            header.fileSize = offset;
+            header.checksum = checksum.value();
+            if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1 || fclose(file) != 0) {
+                file = 0;
+                throw std::runtime_error("Error: Writing " + path + " failed.");
+            }
+            file = 0;
+        }
+
+        uint64_t offset = 0;
+
+    private:
+        std::string path;
+        FILE *file;
+        Checksum checksum;
+    };
+}
+
+bool parser::isBinaryScene(const std::string &filepath)
+{
+    char magic[sizeof(SCENE_MAGIC)];
+    FILE *file = fopen(filepath.c_str(), "rb");
+    if (!file)
+        return false;
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, SCENE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return binary;
+}
+
+void parser::Scene::saveBinary(const std::string &filepath) const
+{
+    SettingsRecord settings = {maxraytracedepth, background_color, camera, ambient_light};
+
+    std::vector<char> strings;
+    appendString(strings, texture_image);
+    std::vector<PointLightRecord> points;
+    for (const PointLight &light : point_lights) {
+        points.push_back({light.position, light.intensity});
+        appendString(strings, light.id);
+    }
+    std::vector<TriangularLightRecord> triangles;
+    for (const TriangularLight &light : triangular_lights) {
+        triangles.push_back({light.vertex1, light.vertex2, light.vertex3, light.intensity});
+        appendString(strings, light.id);
+    }
+    std::vector<MaterialRecord> records;
+    for (const Material &material : materials) {
+        records.push_back({material.ambient, material.diffuse, material.specular, material.mirror_reflactance,
+                           material.phong_exponent, material.texture_factor});
+        appendString(strings, material.id);
+    }
+    // the file keeps whole faces; meshes hold them packed, so they are
+    // unpacked here until the file is written
+    std::vector<MeshRecord> meshRecords;
+    std::vector<std::vector<Face>> unpacked(meshes.size());
+    OutputSection faces = {SECTION_FACES, (uint32_t)sizeof(Face), 0, {}};
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const Mesh &mesh = meshes[i];
+        meshRecords.push_back({mesh.material_id, 0, mesh.faces.size()});
+        appendString(strings, mesh.id);
+        faces.count += mesh.faces.size();
+        unpacked[i] = mesh.faces.unpack();
+        if (!unpacked[i].empty())
+            faces.pieces.push_back(std::make_pair((const void *)unpacked[i].data(), unpacked[i].size() * sizeof(Face)));
+    }
+
+    std::vector<OutputSection> sections;
+    sections.push_back({SECTION_SETTINGS, (uint32_t)sizeof(settings), 1, {std::make_pair((const void *)&settings, sizeof(settings))}});
+    sections.push_back(section(SECTION_STRINGS, strings));
+    sections.push_back(section(SECTION_POINT_LIGHTS, points));
+    sections.push_back(section(SECTION_TRIANGULAR_LIGHTS, triangles));
+    sections.push_back(section(SECTION_MATERIALS, records));
+    sections.push_back(section(SECTION_VERTICES, vertex_data));
+    sections.push_back(section(SECTION_TEXCOORDS, texture_data));
+    sections.push_back(section(SECTION_NORMALS, normal_data));
+    sections.push_back(section(SECTION_MESHES, meshRecords));
+    sections.push_back(faces);
+    sections.push_back(section(SECTION_CAMERAS, cameras));
+
+    std::vector<SectionEntry> table;
+    uint64_t offset = sizeof(FileHeader) + sections.size() * sizeof(SectionEntry);
+    for (const OutputSection &out : sections) {
+        offset = alignSection(offset);
+        table.push_back({out.type, out.elementSize, offset, out.count});
+        offset += out.count * out.elementSize;
+    }
+
+    // written next to the target and renamed, so readers never see half a file
+    std::string temporary = filepath + ".tmp";
+    {
+        SceneWriter writer(temporary);
+        FileHeader header = {};
+        writer.write(table.data(), table.size() * sizeof(SectionEntry));
+        for (size_t s = 0; s < sections.size(); ++s) {
+            writer.padTo(table[s].offset);
+            for (const auto &piece : sections[s].pieces)
+                writer.write(piece.first, piece.second);
+        }
+        writer.padTo(alignSection(writer.offset));
+
+        memcpy(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+        header.version = SCENE_VERSION;
+        header.sectionCount = (uint32_t)sections.size();
+        writer.close(header);
+    }
+    if (rename(temporary.c_str(), filepath.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("Error: " + filepath + " cannot be replaced.");
+    }
+}
+
+// The file is mapped and its arrays are copied into the scene with one
+// memcpy each; nothing is parsed. The render structures index the scene's
+// vectors directly, so they are filled rather than pointed at the mapping.
+void parser::Scene::loadFromBinary(const std::string &filepath)
+{
+    MappedFile file;
+    if (!file.open(filepath) || file.size() < sizeof(FileHeader))
+        throw std::runtime_error("Error: The binary scene file cannot be loaded.");
+    FileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC)) != 0)
+        throw std::runtime_error("Error: " + filepath + " is not a binary scene file.");
+    if (header.version != SCENE_VERSION)
+        throw std::runtime_error("Error: " + filepath + " has binary scene version " + std::to_string(header.version) +
+                                 ", expected " + std::to_string(SCENE_VERSION) + "; compile the scene again.");
+    if (header.fileSize != file.size())
+        throw std::runtime_error("Error: " + filepath + " is truncated.");
+    Checksum checksum;
+    checksum.update(file.data() + sizeof(header), file.size() - sizeof(header));
+    if (checksum.value() != header.checksum)
+        throw std::runtime_error("Error: " + filepath + " is corrupt (checksum mismatch).");
+    if (header.sectionCount > (file.size() - sizeof(header)) / sizeof(SectionEntry))
+        throw std::runtime_error("Error: " + filepath + " has a bad section table.");
+
+    // sections by type; unknown types are skipped
+    const SectionEntry *found[SECTION_COUNT + 1] = {};
+    for (uint32_t s = 0; s < header.sectionCount; ++s) {
+        const SectionEntry *entry = (const SectionEntry *)(file.data() + sizeof(header)) + s;
+        if (entry->offset % SECTION_ALIGNMENT != 0 || entry->offset > file.size() ||
+            (entry->elementSize && entry->count > (file.size() - entry->offset) / entry->elementSize))
+            throw std::runtime_error("Error: " + filepath + " has a bad section table.");
+        if (entry->type >= SECTION_SETTINGS && entry->type <= SECTION_COUNT)
+            found[entry->type] = entry;
+    }
+    auto sectionData = [&](SectionType type, size_t elementSize, uint64_t &count) -> const unsigned char * {
+        const SectionEntry *entry = found[type];
+        if (!entry || entry->elementSize != elementSize)
+            throw std::runtime_error("Error: " + filepath + " is missing a section.");
+        count = entry->count;
+        return file.data() + entry->offset;
+    };
+    auto array = [&](SectionType type, SceneVector<Vec3f> &out) {
+        uint64_t count;
+        const Vec3f *data = (const Vec3f *)sectionData(type, sizeof(Vec3f), count);
+        useArena(out, arena, count);
+        out.assign(data, data + count);
+    };
+    // the arrays add up to less than the file, faces included
+    arena.reserve(file.size());
+
+    uint64_t count, stringBytes;
+    const char *strings = (const char *)sectionData(SECTION_STRINGS, 1, stringBytes);
+    const char *stringsEnd = strings + stringBytes;
+    auto nextString = [&]() {
+        const char *terminator = (const char *)memchr(strings, 0, stringsEnd - strings);
+        if (!terminator)
+            throw std::runtime_error("Error: " + filepath + " has a bad string section.");
+        std::string text(strings, terminator);
+        strings = terminator + 1;
+        return text;
+    };
+
+    SettingsRecord settings;
+    memcpy(&settings, sectionData(SECTION_SETTINGS, sizeof(settings), count), sizeof(settings));
+    if (count != 1)
+        throw std::runtime_error("Error: " + filepath + " is missing a section.");
+    maxraytracedepth = settings.maxraytracedepth;
+    background_color = settings.background_color;
+    camera = settings.camera;
+    ambient_light = settings.ambient_light;
+    texture_image = nextString();
+    // files written before several cameras were kept have the settings one
+    if (found[SECTION_CAMERAS]) {
+        const Camera *views = (const Camera *)sectionData(SECTION_CAMERAS, sizeof(Camera), count);
+        cameras.assign(views, views + count);
+    } else {
+        cameras.assign(1, camera);
+    }
+
+    const PointLightRecord *points = (const PointLightRecord *)sectionData(SECTION_POINT_LIGHTS, sizeof(PointLightRecord), count);
+    useArena(point_lights, arena, count);
+    point_lights.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        point_lights[i] = {nextString(), points[i].position, points[i].intensity};
+
+    const TriangularLightRecord *triangles = (const TriangularLightRecord *)sectionData(SECTION_TRIANGULAR_LIGHTS, sizeof(TriangularLightRecord), count);
+    useArena(triangular_lights, arena, count);
+    triangular_lights.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        triangular_lights[i] = {nextString(), triangles[i].vertex1, triangles[i].vertex2, triangles[i].vertex3, triangles[i].intensity};
+
+    const MaterialRecord *records = (const MaterialRecord *)sectionData(SECTION_MATERIALS, sizeof(MaterialRecord), count);
+    useArena(materials, arena, count);
+    materials.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const MaterialRecord &record = records[i];
+        materials[i] = {nextString(), record.ambient, record.diffuse, record.specular, record.mirror_reflactance,
+                        record.phong_exponent, record.texture_factor};
+    }
+
+    array(SECTION_VERTICES, vertex_data);
+    array(SECTION_TEXCOORDS, texture_data);
+    array(SECTION_NORMALS, normal_data);
+
+    uint64_t faceCount;
+    const MeshRecord *meshRecords = (const MeshRecord *)sectionData(SECTION_MESHES, sizeof(MeshRecord), count);
+    const Face *faces = (const Face *)sectionData(SECTION_FACES, sizeof(Face), faceCount);
+    useArena(meshes, arena, count);
+    meshes.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (meshRecords[i].faceCount > faceCount)
+            throw std::runtime_error("Error: " + filepath + " has more faces in its meshes than stored.");
+        meshes[i].id = nextString();
+        meshes[i].material_id = meshRecords[i].material_id;
+        meshes[i].faces.assign(std::vector<Face>(faces, faces + meshRecords[i].faceCount), &arena);
+        faces += meshRecords[i].faceCount;
+        faceCount -= meshRecords[i].faceCount;
+    }
+}
@@ -0,0 +1,528 @@
+#include "server.hpp"
+#include "render.hpp"
+#include "kernels.hpp"
+#include "net.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+using namespace parser;
+
+
+namespace
+{
+    // A loaded scene with the camera and lights of its file, which every
+    // render starts from.
+    struct Resident
+    {
+        std::string path;
+        Scene scene;
+        CompiledScene compiled;
+        Camera camera;
+        Vec3f ambient;
+        std::vector<PointLight> lights;
+        std::string output;
+    };
+
+    // What one render job changes, filled in from the resident defaults.
+    struct RenderSettings
+    {
+        Camera camera;
+        Vec3f ambient;
+        std::vector<PointLight> lights;
+        std::string output;
+        bool hybrid;
+    };
+
+    enum JobState { JOB_QUEUED, JOB_RUNNING, JOB_FINISHED };
+
+    struct Job
+    {
+        int id = 0;
+        int priority = 0;
+        std::string description;                    // the request, for status
+        std::function<std::string(Job &)> run;      // returns the final reply
+        std::atomic<bool> cancel;
+        JobState state = JOB_QUEUED;
+        std::string reply;
+
+        Job() : cancel(false) {}
+    };
+
+    class Server
+    {
+    public:
+        Server(ThreadPool &pool, const ServerOptions &options) : pool(pool), options(options) {}
+        int run(const std::string &socketPath);
+
+    private:
+        void dispatch();
+        void serveConnection(int fd);
+        std::string handle(const std::string &line, int fd);
+        std::string submit(int priority, const std::string &description, const std::function<std::string(Job &)> &run, int fd);
+
+        std::string load(const std::vector<std::string> &words, const std::string &line, int fd);
+        std::string render(const std::vector<std::string> &words, const std::string &line, int fd);
+        std::string cancel(const std::vector<std::string> &words);
+        std::string status();
+        std::string unload(const std::vector<std::string> &words);
+        std::string shutdown();
+
+        std::string loadJob(Job &job, const std::string &name, const std::string &path, bool compact);
+        std::string renderJob(Job &job, Resident &resident, const RenderSettings &settings);
+
+        ThreadPool &pool;
+        ServerOptions options;
+        int listener = -1;
+
+        std::mutex mutex;                           // guards everything below
+        std::condition_variable changed;            // job queued or finished, connection closed
+        std::map<std::string, std::shared_ptr<Resident> > scenes;
+        std::vector<std::shared_ptr<Job> > queue;
+        std::map<int, std::shared_ptr<Job> > jobs;  // queued and running
+        int nextJob = 1;
+        int connections = 0;
+        std::set<int> sockets;
+        bool stopping = false;
+    };
+}
+
+static bool parseInt(const std::string &text, int &value)
+{
+    char *end;
+    errno = 0;
+    long parsed = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end || errno || parsed < -2147483647 || parsed > 2147483647)
+        return false;
+    value = (int)parsed;
+    return true;
+}
+
+// count comma separated floats
+static bool parseFloats(const std::string &text, int count, float *values)
+{
+    const char *p = text.c_str();
+    for (int i = 0; i < count; ++i) {
+        char *end;
+        values[i] = std::strtof(p, &end);
+        if (end == p || *end != (i + 1 < count ? ',' : '\0'))
+            return false;
+        p = end + 1;
+    }
+    return true;
+}
+
+static bool parseVector(const std::string &text, Vec3f &value)
+{
+    float values[3];
+    if (!parseFloats(text, 3, values))
+        return false;
+    value = Vec3f{values[0], values[1], values[2]};
+    return true;
+}
+
+static std::string milliseconds(std::chrono::steady_clock::time_point start)
+{
+    std::ostringstream text;
+    text << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms";
+    return text.str();
+}
+
+int Server::run(const std::string &socketPath)
+{
+    std::string bound, error;
+    listener = listenOn(socketPath, bound, error);
+    if (listener < 0) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    std::cout << "Render server listening on " << bound << " with " << pool.size() << " threads" << std::endl;
+
+    std::thread dispatcher(&Server::dispatch, this);
+    int status = 0;
+    while (true) {
+        int fd = accept(listener, 0, 0);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!stopping) {
+                perror("Error: accept failed");
+                status = 1;
+            }
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ++connections;
+        sockets.insert(fd);
+        std::thread(&Server::serveConnection, this, fd).detach();
+    }
+
+    // no new jobs from here on; the dispatcher drains the queue and stops
+    shutdown();
+    dispatcher.join();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (int fd : sockets)
+            ::shutdown(fd, SHUT_RD);
+        changed.wait(lock, [&] { return connections == 0; });
+    }
+    closeListener(listener, socketPath);
+    std::cout << "Render server stopped" << std::endl;
+    return status;
+}
+
+void Server::dispatch()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty())
+            break;
+        std::vector<std::shared_ptr<Job> >::iterator best = queue.begin();
+        for (std::vector<std::shared_ptr<Job> >::iterator it = queue.begin(); it != queue.end(); ++it)
+            if ((*it)->priority > (*best)->priority)
+                best = it;
+        std::shared_ptr<Job> job = *best;
+        queue.erase(best);
+        job->state = JOB_RUNNING;
+        lock.unlock();
+
+        std::string reply;
+        try {
+            reply = job->run(*job);
+        } catch (const std::exception &e) {
+            reply = "error " + std::to_string(job->id) + " " + e.what();
+        }
+        std::cout << "Job " << job->id << " (" << job->description << "): " << reply << std::endl;
+
+        lock.lock();
+        job->reply = reply;
+        job->state = JOB_FINISHED;
+        jobs.erase(job->id);
+        changed.notify_all();
+    }
+}
+
+void Server::serveConnection(int fd)
+{
+    SocketReader reader(fd);
+    std::string line;
+    while (reader.readLine(line)) {
+        if (line.find_first_not_of(" \t") != std::string::npos && !sendLine(fd, handle(line, fd)))
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    sockets.erase(fd);
+    close(fd);
+    --connections;
+    changed.notify_all();
+}
+
+std::string Server::handle(const std::string &line, int fd)
+{
+    std::istringstream stream(line);
+    std::vector<std::string> words;
+    for (std::string word; stream >> word;)
+        words.push_back(word);
+
+    const std::string &request = words[0];
+    if (request == "load")
+        return load(words, line, fd);
+    if (request == "render")
+        return render(words, line, fd);
+    if (request == "cancel")
+        return cancel(words);
+    if (request == "status")
+        return status();
+    if (request == "unload")
+        return unload(words);
+    if (request == "shutdown")
+        return shutdown();
+    return "error unknown request '" + request + "'";
+}
+
+// Queues run, tells the client its job id and waits for the final reply.
+std::string Server::submit(int priority, const std::string &description, const std::function<std::string(Job &)> &run, int fd)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->priority = priority;
+    job->description = description;
+    job->run = run;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            return "error the server is shutting down";
+        job->id = nextJob++;
+        jobs[job->id] = job;
+        queue.push_back(job);
+    }
+    changed.notify_all();
+    sendLine(fd, "queued " + std::to_string(job->id));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return job->state == JOB_FINISHED; });
+    return job->reply;
+}
+
+std::string Server::load(const std::vector<std::string> &words, const std::string &line, int fd)
+{
+    if (words.size() < 3)
+        return "error usage: load <scene> <path> [priority=N] [compact=0|1]";
+    int priority = 0;
+    bool compact = options.compact;
+    for (size_t i = 3; i < words.size(); ++i) {
+        const std::string &word = words[i];
+        if (word.compare(0, 9, "priority=") == 0 && parseInt(word.substr(9), priority))
+            continue;
+        if (word == "compact=0" || word == "compact=1") {
+            compact = word == "compact=1";
+            continue;
+        }
+        return "error bad load option '" + word + "'";
+    }
+    std::string name = words[1], path = words[2];
+    return submit(priority, line, [this, name, path, compact](Job &job) { return loadJob(job, name, path, compact); }, fd);
+}
+
+std::string Server::loadJob(Job &job, const std::string &name, const std::string &path, bool compact)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<Resident> resident = std::make_shared<Resident>();
+    Scene &scene = resident->scene;
+    if (isBinaryScene(path))
+        scene.loadFromBinary(path);
+    else
+        scene.loadFromXml(path, &pool);
+    if (compact)
+        scene.compactGeometry();
+    compileScene(scene, resident->compiled, options.bvhCache ? path + ".bvh" : "");
+
+    resident->path = path;
+    resident->camera = scene.camera;
+    resident->ambient = scene.ambient_light;
+    resident->lights.assign(scene.point_lights.begin(), scene.point_lights.end());
+    resident->output = scene.texture_image;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        scenes[name] = resident;
+    }
+    return "done " + std::to_string(job.id) + " loaded " + name + ": " + std::to_string(resident->compiled.triangleCount) +
+           " triangles in " + milliseconds(start);
+}
+
+std::string Server::render(const std::vector<std::string> &words, const std::string &line, int fd)
+{
+    if (words.size() < 2)
+        return "error usage: render <scene> [key=value ...]";
+    std::shared_ptr<Resident> resident;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, std::shared_ptr<Resident> >::iterator found = scenes.find(words[1]);
+        if (found != scenes.end())
+            resident = found->second;
+    }
+    if (!resident)
+        return "error no scene '" + words[1] + "' is loaded";
+
+    std::shared_ptr<RenderSettings> settings = std::make_shared<RenderSettings>();
+    settings->camera = resident->camera;
+    settings->ambient = resident->ambient;
+    settings->lights = resident->lights;
+    settings->output = resident->output;
+    settings->hybrid = options.hybrid;
+    int priority = 0;
+    Camera &camera = settings->camera;
+    for (size_t i = 2; i < words.size(); ++i) {
+        size_t equals = words[i].find('=');
+        std::string key = words[i].substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : words[i].substr(equals + 1);
+        bool valid = equals != std::string::npos;
+        if (key == "priority") {
+            valid = valid && parseInt(value, priority);
+        } else if (key == "output") {
+            valid = valid && !value.empty();
+            settings->output = value;
+        } else if (key == "width" || key == "height") {
+            int &size = key == "width" ? camera.image_width : camera.image_height;
+            valid = valid && parseInt(value, size) && size > 0;
+        } else if (key == "position") {
+            valid = valid && parseVector(value, camera.position);
+        } else if (key == "gaze") {
+            valid = valid && parseVector(value, camera.gaze);
+        } else if (key == "up") {
+            valid = valid && parseVector(value, camera.up);
+        } else if (key == "near_plane") {
+            float plane[4];
+            valid = valid && parseFloats(value, 4, plane);
+            camera.near_plane = Vec4f{plane[0], plane[1], plane[2], plane[3]};
+        } else if (key == "near_distance") {
+            valid = valid && parseFloats(value, 1, &camera.near_distance);
+        } else if (key == "ambient") {
+            valid = valid && parseVector(value, settings->ambient);
+        } else if (key == "hybrid") {
+            valid = valid && (value == "0" || value == "1");
+            settings->hybrid = value == "1";
+        } else if (key.compare(0, 6, "light.") == 0) {
+            // light.<id>.position or light.<id>.intensity; ids may contain dots
+            size_t dot = key.rfind('.');
+            std::string id = key.substr(6, dot - 6), attribute = key.substr(dot + 1);
+            std::vector<PointLight>::iterator light = settings->lights.begin();
+            while (light != settings->lights.end() && light->id != id)
+                ++light;
+            valid = valid && light != settings->lights.end() && dot > 6 &&
+                    ((attribute == "position" && parseVector(value, light->position)) ||
+                     (attribute == "intensity" && parseVector(value, light->intensity)));
+        } else {
+            valid = false;
+        }
+        if (!valid)
+            return "error bad render option '" + words[i] + "'";
+    }
+    if ((long)camera.image_width * camera.image_height > (1L << 28))
+        return "error resolution too large";
+
+    return submit(priority, line, [this, resident, settings](Job &job) { return renderJob(job, *resident, *settings); }, fd);
+}
+
+// Runs on the dispatcher, the only thread touching resident scenes, so the
+// overrides are written into the scene for the length of the job.
+std::string Server::renderJob(Job &job, Resident &resident, const RenderSettings &settings)
+{
+    Scene &scene = resident.scene;
+    scene.camera = settings.camera;
+    scene.ambient_light = settings.ambient;
+    for (size_t i = 0; i < settings.lights.size(); ++i)
+        scene.point_lights[i] = settings.lights[i];
+    compileLights(scene, resident.compiled);
+
+    auto start = std::chrono::steady_clock::now();
+    int width = scene.camera.image_width, height = scene.camera.image_height;
+    std::vector<unsigned char> image((size_t)width * height * 3);
+    RenderStats stats = renderImage(scene, resident.compiled, pool, settings.hybrid, &image[0], &job.cancel);
+    if (stats.cancelled)
+        return "cancelled " + std::to_string(job.id);
+    std::string traced = milliseconds(start);
+    writePpm(settings.output, &image[0], width, height);
+    return "done " + std::to_string(job.id) + " " + settings.output + " " + std::to_string(width) + "x" +
+           std::to_string(height) + " in " + traced;
+}
+
+std::string Server::cancel(const std::vector<std::string> &words)
+{
+    int id;
+    if (words.size() != 2 || !parseInt(words[1], id))
+        return "error usage: cancel <job>";
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<int, std::shared_ptr<Job> >::iterator found = jobs.find(id);
+        if (found == jobs.end())
+            return "error no job " + words[1] + " is queued or running";
+        std::shared_ptr<Job> job = found->second;
+        job->cancel = true;
+        if (job->state == JOB_QUEUED) {
+            queue.erase(std::find(queue.begin(), queue.end(), job));
+            jobs.erase(found);
+            job->reply = "cancelled " + words[1];
+            job->state = JOB_FINISHED;
+        }
+    }
+    changed.notify_all();
+    return "ok cancelled " + words[1];
+}
+
+std::string Server::status()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string lines;
+    for (const std::pair<const std::string, std::shared_ptr<Resident> > &entry : scenes)
+        lines += "scene " + entry.first + " " + entry.second->path + " " + std::to_string(entry.second->compiled.triangleCount) + " triangles\n";
+    for (const std::pair<const int, std::shared_ptr<Job> > &entry : jobs) {
+        const Job &job = *entry.second;
+        lines += "job " + std::to_string(job.id) + (job.state == JOB_RUNNING ? " running" : " queued") + " priority " +
+                 std::to_string(job.priority) + ": " + job.description + "\n";
+    }
+    return lines + "ok " + std::to_string(scenes.size()) + " scenes, " + std::to_string(jobs.size()) + " jobs";
+}
+
+// Jobs already holding the scene still finish with it.
+std::string Server::unload(const std::vector<std::string> &words)
+{
+    if (words.size() != 2)
+        return "error usage: unload <scene>";
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!scenes.erase(words[1]))
+        return "error no scene '" + words[1] + "' is loaded";
+    return "ok unloaded " + words[1];
+}
+
+// Cancels every job and stops accepting connections; run() then waits for
+// the running job and the open connections.
+std::string Server::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!stopping) {
+            stopping = true;
+            for (const std::shared_ptr<Job> &job : queue) {
+                job->reply = "cancelled " + std::to_string(job->id);
+                job->state = JOB_FINISHED;
+                jobs.erase(job->id);
+            }
+            queue.clear();
+            for (const std::pair<const int, std::shared_ptr<Job> > &entry : jobs)
+                entry.second->cancel = true;
+            ::shutdown(listener, SHUT_RDWR);
+        }
+    }
+    changed.notify_all();
+    return "ok shutting down";
+}
+
+int runServer(const std::string &socketPath, ThreadPool &pool, const ServerOptions &options)
+{
+    Server server(pool, options);
+    return server.run(socketPath);
+}
+
+int sendRequest(const std::string &socketPath, const std::string &request)
+{
+    std::string error;
+    int fd = connectTo(socketPath, error);
+    if (fd < 0) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    // the server answers the request before it notices the end of input
+    if (!sendLine(fd, request) || ::shutdown(fd, SHUT_WR) != 0) {
+        perror("Error: cannot send the request");
+        close(fd);
+        return 1;
+    }
+
+    SocketReader reader(fd);
+    std::string line, last;
+    while (reader.readLine(line)) {
+        std::cout << line << std::endl;
+        last = line;
+    }
+    close(fd);
+    return last.compare(0, 3, "ok ") == 0 || last.compare(0, 5, "done ") == 0 ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "threadpool.hpp"
+#include <string>
+
+// Render server ("program serve"). Scenes are loaded once, with their BVH,
+// and stay resident; render jobs then only pay for tracing. Clients connect
+// to a UNIX-domain stream socket (or TCP, see net.hpp) and send one request
+// per line:
+//
+//   load <scene> <path> [priority=N] [compact=0|1]
+//   render <scene> [priority=N] [output=path] [width=W] [height=H]
+//          [position=x,y,z] [gaze=x,y,z] [up=x,y,z] [near_plane=l,r,b,t]
+//          [near_distance=d] [ambient=r,g,b] [hybrid=0|1]
+//          [light.<id>.position=x,y,z] [light.<id>.intensity=r,g,b]
+//   cancel <job>
+//   status
+//   unload <scene>
+//   shutdown
+//
+// Loads and renders are jobs: the server answers "queued <job>" at once and
+// "done <job> ...", "cancelled <job>" or "error <job> ..." when the job has
+// finished. Jobs run one at a time on the shared pool, highest priority
+// first and in arrival order within a priority; a cancelled render stops
+// after the tiles it has started. Other requests answer "ok ..." or
+// "error ...". Overrides apply to that render only; everything else comes
+// from the scene file (the output defaults to its image name).
+struct ServerOptions
+{
+    bool hybrid = false;        // default for renders
+    bool compact = false;       // default for loads
+    bool bvhCache = true;       // loads keep the BVH next to the scene file
+};
+
+// Serves until a shutdown request; returns the exit status.
+int runServer(const std::string &socketPath, ThreadPool &pool, const ServerOptions &options);
+
+// Sends one request, prints every reply line and returns 0 if the last one
+// was "ok" or "done".
+int sendRequest(const std::string &socketPath, const std::string &request);
+
+#endif
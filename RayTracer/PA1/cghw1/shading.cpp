@@ -0,0 +1,186 @@
+#include "shading.hpp"
+#include <algorithm>
+#include <cmath>
+using namespace std;
+using namespace parser;
+
+
+void resizeGBuffer(GBuffer &gbuffer, int capacity, int lightCount)
+{
+    // keep the kernel free of a remainder loop
+    capacity = (capacity + SHADE_BATCH - 1) / SHADE_BATCH * SHADE_BATCH;
+
+    gbuffer.count = 0;
+    gbuffer.capacity = capacity;
+    gbuffer.lightCount = lightCount;
+    gbuffer.channels.assign((size_t)(GB_LIT + lightCount) * capacity, 0.0f);
+    gbuffer.material.assign(capacity, 0);
+    gbuffer.pixel.assign(capacity, 0);
+}
+
+// Fills entry i of a bin with everything the class needs; channels the
+// class never reads (specular, phong, texture blend inputs) are skipped.
+template <int Features>
+static void writeHit(const Scene &scene, const CompiledScene &compiled, const Ray &ray, float t,
+                     int meshIndex, int faceIndex, int pixel, GBuffer &gbuffer)
+{
+    const RenderKernels &kernels = activeKernels();
+    KernelScene view = compiled.view();
+    const Mesh &mesh = scene.meshes[meshIndex];
+    Face face = mesh.faces[faceIndex];
+    const Material &material = scene.materials[mesh.material_id - 1];
+
+    Hit hit;
+    hit.intersectionPoint = ray.origin + ray.direction * t;
+    hit.normal = faceNormal(scene, face, ray);
+    Vec3f diffuse = material.diffuse;
+    if (Features & MATERIAL_TEXTURED)
+        diffuse = diffuse * (1 - material.texture_factor) + faceTextureColor(scene, face) * material.texture_factor;
+    Vec3f ambient = material.ambient * scene.ambient_light;
+
+    int i = gbuffer.count++;
+    float values[GB_SR] = {
+        hit.intersectionPoint.x, hit.intersectionPoint.y, hit.intersectionPoint.z,
+        hit.normal.x, hit.normal.y, hit.normal.z,
+        ray.origin.x, ray.origin.y, ray.origin.z,
+        ray.direction.x, ray.direction.y, ray.direction.z,
+        diffuse.x, diffuse.y, diffuse.z};
+    for (int c = 0; c < GB_SR; ++c)
+        gbuffer.channel(c)[i] = values[c];
+    if (Features & MATERIAL_SPECULAR) {
+        gbuffer.channel(GB_SR)[i] = material.specular.x;
+        gbuffer.channel(GB_SG)[i] = material.specular.y;
+        gbuffer.channel(GB_SB)[i] = material.specular.z;
+        gbuffer.channel(GB_PHONG)[i] = material.phong_exponent;
+    }
+    gbuffer.channel(GB_R)[i] = ambient.x;
+    gbuffer.channel(GB_G)[i] = ambient.y;
+    gbuffer.channel(GB_B)[i] = ambient.z;
+    gbuffer.material[i] = mesh.material_id - 1;
+    gbuffer.pixel[i] = pixel;
+
+    // shadow rays are resolved here so the shading kernel never intersects
+    for (int l = 0; l < gbuffer.lightCount; ++l) {
+        float lightDistance;
+        Ray shadow = generateShadowRay(scene.point_lights[l], hit.intersectionPoint, hit, lightDistance);
+        gbuffer.channel(GB_LIT + l)[i] = kernels.occluded(view, shadow, lightDistance) ? 0.0f : 1.0f;
+    }
+}
+
+typedef void (*HitWriter)(const Scene &, const CompiledScene &, const Ray &, float, int, int, int, GBuffer &);
+static const HitWriter hitWriters[MATERIAL_CLASS_COUNT] = {
+    writeHit<0>, writeHit<1>, writeHit<2>, writeHit<3>,
+    writeHit<4>, writeHit<5>, writeHit<6>, writeHit<7>,
+};
+
+void appendHit(const Scene &scene, const CompiledScene &compiled, const Ray &ray, float t, int triangle, int pixel, TileBuffers &buffers)
+{
+    int meshIndex = compiled.triangleMesh[triangle];
+    int faceIndex = compiled.triangleFace[triangle];
+    int materialClass = compiled.materialClass[scene.meshes[meshIndex].material_id - 1];
+
+    GBuffer &gbuffer = buffers.byClass[materialClass];
+    if (gbuffer.capacity < buffers.capacity || gbuffer.lightCount != buffers.lightCount)
+        resizeGBuffer(gbuffer, buffers.capacity, buffers.lightCount);
+    hitWriters[materialClass](scene, compiled, ray, t, meshIndex, faceIndex, pixel, gbuffer);
+}
+
+bool traceToGBuffer(const Scene &scene, const CompiledScene &compiled, const Ray &ray, int pixel, TileBuffers &buffers)
+{
+    int triangle;
+    float t = activeKernels().closestHit(compiled.view(), ray, triangle);
+    if (t < 0)
+        return false;
+    appendHit(scene, compiled, ray, t, triangle, pixel, buffers);
+    return true;
+}
+
+void shadeGBuffer(const CompiledScene &compiled, int materialClass, GBuffer &gbuffer)
+{
+    if (gbuffer.count > 0)
+        activeKernels().shade[materialClass](compiled.view(), &gbuffer.channels[0], gbuffer.capacity, gbuffer.count);
+}
+
+template <bool Mirror>
+static void resolveHits(const Scene &scene, int recursion_number, GBuffer &gbuffer, unsigned char *image)
+{
+    for (int i = 0; i < gbuffer.count; ++i) {
+        Vec3f color = {gbuffer.channel(GB_R)[i], gbuffer.channel(GB_G)[i], gbuffer.channel(GB_B)[i]};
+
+        if (Mirror && recursion_number < scene.maxraytracedepth) {
+            const Material &material = scene.materials[gbuffer.material[i]];
+            Ray ray;
+            ray.origin = Vec3f{gbuffer.channel(GB_OX)[i], gbuffer.channel(GB_OY)[i], gbuffer.channel(GB_OZ)[i]};
+            ray.direction = Vec3f{gbuffer.channel(GB_DX)[i], gbuffer.channel(GB_DY)[i], gbuffer.channel(GB_DZ)[i]};
+            Hit hit;
+            hit.intersectionPoint = Vec3f{gbuffer.channel(GB_PX)[i], gbuffer.channel(GB_PY)[i], gbuffer.channel(GB_PZ)[i]};
+            hit.normal = Vec3f{gbuffer.channel(GB_NX)[i], gbuffer.channel(GB_NY)[i], gbuffer.channel(GB_NZ)[i]};
+
+            Ray mirrorRay = detectMirror(scene, ray, hit);
+            Hit mirrorHit = sendRayToObjects(recursion_number + 1, scene, mirrorRay);
+            color = color + mirrorHit.pixel * material.mirror_reflactance;
+        }
+
+        int index = gbuffer.pixel[i] * 3;
+        image[index] = static_cast<unsigned char>(std::min(std::max(color.x, 0.0f), 255.0f));
+        image[index + 1] = static_cast<unsigned char>(std::min(std::max(color.y, 0.0f), 255.0f));
+        image[index + 2] = static_cast<unsigned char>(std::min(std::max(color.z, 0.0f), 255.0f));
+    }
+}
+
+void resolveGBuffer(const Scene &scene, int recursion_number, int materialClass, GBuffer &gbuffer, unsigned char *image)
+{
+    if (materialClass & MATERIAL_MIRROR)
+        resolveHits<true>(scene, recursion_number, gbuffer, image);
+    else
+        resolveHits<false>(scene, recursion_number, gbuffer, image);
+}
+
+void beginTile(const Scene &scene, int capacity, TileBuffers &buffers)
+{
+    buffers.capacity = capacity;
+    buffers.lightCount = (int)scene.point_lights.size();
+    for (GBuffer &gbuffer : buffers.byClass)
+        gbuffer.count = 0;
+}
+
+void finishTile(const Scene &scene, const CompiledScene &compiled, unsigned char *image, TileBuffers &buffers)
+{
+    for (int c = 0; c < MATERIAL_CLASS_COUNT; ++c) {
+        shadeGBuffer(compiled, c, buffers.byClass[c]);
+        resolveGBuffer(scene, scene.maxraytracedepth, c, buffers.byClass[c], image);
+    }
+}
+
+void writeBackground(const Scene &scene, int pixel, unsigned char *image)
+{
+    image[pixel * 3] = static_cast<unsigned char>(std::min(std::max(scene.background_color.x, 0), 255));
+    image[pixel * 3 + 1] = static_cast<unsigned char>(std::min(std::max(scene.background_color.y, 0), 255));
+    image[pixel * 3 + 2] = static_cast<unsigned char>(std::min(std::max(scene.background_color.z, 0), 255));
+}
+
+void renderTile(const Scene &scene, const CompiledScene &compiled, int x0, int y0, int x1, int y1, const ImageWindow &window, TileBuffers &buffers)
+{
+    const Camera &cam = scene.camera;
+    beginTile(scene, (x1 - x0) * (y1 - y0), buffers);
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            int pixel = window.index(x, y);
+            Ray ray = generateRay(cam, x, y);
+            if (!traceToGBuffer(scene, compiled, ray, pixel, buffers))
+                writeBackground(scene, pixel, window.image);
+        }
+    }
+
+    finishTile(scene, compiled, window.image, buffers);
+}
+
+void renderRays(const Scene &scene, const CompiledScene &compiled, const Ray *rays, int count, unsigned char *colors, TileBuffers &buffers)
+{
+    beginTile(scene, count, buffers);
+    for (int i = 0; i < count; ++i)
+        if (!traceToGBuffer(scene, compiled, rays[i], i, buffers))
+            writeBackground(scene, i, colors);
+    finishTile(scene, compiled, colors, buffers);
+}
@@ -0,0 +1,60 @@
+#ifndef SHADING_HPP
+#define SHADING_HPP
+
+#include "parser.hpp"
+#include "raytracer.hpp"
+#include "kernels.hpp"
+#include <vector>
+
+const int TILE_SIZE = KERNEL_TILE_SIZE;
+const int SHADE_BATCH = 16;
+
+// Primary hits of one tile, stored structure-of-arrays so that the shading
+// kernel can run Blinn-Phong on SHADE_BATCH hits at a time (one AVX-512
+// register, two AVX or four SSE registers). Channel c of hit i lives at
+// channels[c * capacity + i], see GBufferChannel in kernels.hpp.
+struct GBuffer {
+    int count = 0;
+    int capacity = 0;
+    int lightCount = 0;
+
+    std::vector<float> channels;
+    std::vector<int> material;          // index into scene.materials
+    std::vector<int> pixel;             // index into the output image
+
+    float *channel(int c) { return &channels[(size_t)c * capacity]; }
+};
+
+// Hits of one tile binned by material class (see MaterialFeature), so every
+// bin goes through the pipeline instantiated for exactly its features.
+// Bins are allocated the first time a tile produces a hit of their class.
+struct TileBuffers {
+    int capacity = 0;
+    int lightCount = 0;
+    GBuffer byClass[MATERIAL_CLASS_COUNT];
+};
+
+// Rectangle [x0, x1) x [y0, y1) of the camera image, whose pixels are
+// stored row by row in image; the whole image is the window from 0, 0.
+struct ImageWindow {
+    unsigned char *image;
+    int x0, y0, x1, y1;
+
+    int index(int x, int y) const { return (y - y0) * (x1 - x0) + (x - x0); }
+};
+
+void resizeGBuffer(GBuffer &gbuffer, int capacity, int lightCount);
+// adds a primary hit on a compiled triangle to the bin of its material class
+void appendHit(const parser::Scene &scene, const CompiledScene &compiled, const Ray &ray, float t, int triangle, int pixel, TileBuffers &buffers);
+bool traceToGBuffer(const parser::Scene &scene, const CompiledScene &compiled, const Ray &ray, int pixel, TileBuffers &buffers);
+void shadeGBuffer(const CompiledScene &compiled, int materialClass, GBuffer &gbuffer);
+void resolveGBuffer(const parser::Scene &scene, int recursion_number, int materialClass, GBuffer &gbuffer, unsigned char *image);
+void beginTile(const parser::Scene &scene, int capacity, TileBuffers &buffers);
+void finishTile(const parser::Scene &scene, const CompiledScene &compiled, unsigned char *image, TileBuffers &buffers);
+void writeBackground(const parser::Scene &scene, int pixel, unsigned char *image);
+// renders pixels [x0, x1) x [y0, y1), which must lie inside window
+void renderTile(const parser::Scene &scene, const CompiledScene &compiled, int x0, int y0, int x1, int y1, const ImageWindow &window, TileBuffers &buffers);
+// traces rays[0, count) and writes the color of ray i to colors[i * 3]
+void renderRays(const parser::Scene &scene, const CompiledScene &compiled, const Ray *rays, int count, unsigned char *colors, TileBuffers &buffers);
+
+#endif
@@ -0,0 +1,74 @@
+#include "threadpool.hpp"
+
+
+ThreadPool::ThreadPool(int threads) : next(0)
+{
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    for (int i = 1; i < threads; ++i)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::runIndices()
+{
+    for (int i = next++; i < count; i = next++)
+        (*body)(i);
+}
+
+void ThreadPool::workerLoop()
+{
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        runIndices();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &body)
+{
+    if (count <= 0)
+        return;
+    if (workers.empty() || count == 1) {
+        for (int i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        this->count = count;
+        next = 0;
+        busy = (int)workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    runIndices();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return busy == 0; });
+    this->body = 0;
+}
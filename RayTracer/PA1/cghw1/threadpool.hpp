@@ -0,0 +1,44 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run parallel loops. The calling thread
+// takes part in every loop, so a pool of size 1 has no workers at all.
+class ThreadPool
+{
+public:
+    // threads <= 0 uses one thread per hardware thread
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    int size() const { return (int)workers.size() + 1; }
+
+    // Runs body(i) for every i in [0, count) and returns when all are done.
+    // Indices are handed out one at a time, so uneven work balances itself.
+    // Not reentrant: body must not call parallelFor on the same pool.
+    void parallelFor(int count, const std::function<void(int)> &body);
+
+private:
+    void workerLoop();
+    void runIndices();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+    unsigned generation = 0;            // bumped for every loop
+    int busy = 0;                       // workers still inside the current loop
+
+    const std::function<void(int)> *body = 0;
+    int count = 0;
+    std::atomic<int> next;
+};
+
+#endif
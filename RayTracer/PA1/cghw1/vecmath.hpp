@@ -0,0 +1,539 @@
+#ifndef VECMATH_HPP
+#define VECMATH_HPP
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Everything here is force-inlined: kernels.cpp is compiled once per ISA and
+// an out-of-line copy built for AVX-512 must never be picked by the linker
+// for code running on an older CPU.
+#if defined(__GNUC__)
+#define VECMATH_INLINE inline __attribute__((always_inline))
+#else
+#define VECMATH_INLINE inline
+#endif
+
+// Small vector library shared by the parser, the scalar ray tracer and the
+// SIMD kernels. Vec3<T>/Vec4<T> are plain aggregates; T is either a scalar
+// (float, int) or a VecN lane type, so the same source such as normalize()
+// works on one ray or on a batch of rays laid out structure-of-arrays.
+namespace vecmath
+{
+    template <typename T>
+    struct NonDeduced
+    {
+        typedef T type;
+    };
+
+    template <typename T>
+    struct Vec3
+    {
+        T x, y, z;
+    };
+
+    template <typename T>
+    struct Vec4
+    {
+        T x, y, z, w;
+    };
+
+    /*
+     * Scalar lane operations. The lane types below provide the same set, so
+     * generic code calls these unqualified.
+     */
+    template <typename T>
+    VECMATH_INLINE typename std::enable_if<std::is_arithmetic<T>::value, T>::type sqrt(T a) { return std::sqrt(a); }
+    template <typename T>
+    VECMATH_INLINE typename std::enable_if<std::is_arithmetic<T>::value, T>::type rsqrt(T a) { return T(1) / std::sqrt(a); }
+    template <typename T>
+    VECMATH_INLINE typename std::enable_if<std::is_arithmetic<T>::value, T>::type min(T a, T b) { return a < b ? a : b; }
+    template <typename T>
+    VECMATH_INLINE typename std::enable_if<std::is_arithmetic<T>::value, T>::type max(T a, T b) { return a > b ? a : b; }
+    template <typename T>
+    VECMATH_INLINE typename std::enable_if<std::is_arithmetic<T>::value, T>::type abs(T a) { return a < 0 ? -a : a; }
+    template <typename T>
+    VECMATH_INLINE typename std::enable_if<std::is_arithmetic<T>::value, T>::type select(bool mask, T a, T b) { return mask ? a : b; }
+    VECMATH_INLINE bool anyTrue(bool mask) { return mask; }
+
+    // mantissa in [1, 2), exponent returned as float
+    VECMATH_INLINE float splitExponent(float x, float &exponent)
+    {
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        exponent = (float)((int)((bits >> 23) & 0xff) - 127);
+        bits = (bits & 0x007fffff) | 0x3f800000;
+        float m;
+        memcpy(&m, &bits, sizeof(bits));
+        return m;
+    }
+
+    // 2^n for an integral n in [-126, 127]
+    VECMATH_INLINE float exp2Int(float n)
+    {
+        uint32_t bits = (uint32_t)((int)n + 127) << 23;
+        float result;
+        memcpy(&result, &bits, sizeof(bits));
+        return result;
+    }
+
+    VECMATH_INLINE float roundAway(float a) { return (float)(int)(a + (a >= 0 ? 0.5f : -0.5f)); }
+
+    /*
+     * VecN<T, Lanes>: one value per lane. The generic version is a plain
+     * array; float x 4/8/16 are backed by SSE/AVX/AVX-512 registers when the
+     * translation unit is compiled for them. Comparisons return VecN::Mask.
+     */
+    template <int Lanes>
+    struct MaskN
+    {
+        bool m[Lanes];
+    };
+
+    template <typename T, int Lanes>
+    struct VecN
+    {
+        static const int Width = Lanes;
+        typedef MaskN<Lanes> Mask;
+        T v[Lanes];
+
+        VECMATH_INLINE VecN() {}
+        VECMATH_INLINE VecN(T s)
+        {
+            for (int i = 0; i < Lanes; ++i)
+                v[i] = s;
+        }
+        static VECMATH_INLINE VecN load(const T *p)
+        {
+            VecN r;
+            for (int i = 0; i < Lanes; ++i)
+                r.v[i] = p[i];
+            return r;
+        }
+        VECMATH_INLINE void store(T *p) const
+        {
+            for (int i = 0; i < Lanes; ++i)
+                p[i] = v[i];
+        }
+    };
+
+#define VECMATH_GENERIC_BINARY(name, expr)                                          \
+    template <typename T, int N>                                                    \
+    VECMATH_INLINE VecN<T, N> name(const VecN<T, N> &a, const VecN<T, N> &b)        \
+    {                                                                               \
+        VecN<T, N> r;                                                               \
+        for (int i = 0; i < N; ++i)                                                 \
+            r.v[i] = expr;                                                          \
+        return r;                                                                   \
+    }
+    VECMATH_GENERIC_BINARY(operator+, a.v[i] + b.v[i])
+    VECMATH_GENERIC_BINARY(operator-, a.v[i] - b.v[i])
+    VECMATH_GENERIC_BINARY(operator*, a.v[i] * b.v[i])
+    VECMATH_GENERIC_BINARY(operator/, a.v[i] / b.v[i])
+    VECMATH_GENERIC_BINARY(min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+    VECMATH_GENERIC_BINARY(max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef VECMATH_GENERIC_BINARY
+
+#define VECMATH_GENERIC_COMPARE(name, op)                                           \
+    template <typename T, int N>                                                    \
+    VECMATH_INLINE MaskN<N> name(const VecN<T, N> &a, const VecN<T, N> &b)          \
+    {                                                                               \
+        MaskN<N> r;                                                                 \
+        for (int i = 0; i < N; ++i)                                                 \
+            r.m[i] = a.v[i] op b.v[i];                                              \
+        return r;                                                                   \
+    }
+    VECMATH_GENERIC_COMPARE(operator<, <)
+    VECMATH_GENERIC_COMPARE(operator>, >)
+    VECMATH_GENERIC_COMPARE(operator<=, <=)
+    VECMATH_GENERIC_COMPARE(operator>=, >=)
+    VECMATH_GENERIC_COMPARE(operator==, ==)
+    VECMATH_GENERIC_COMPARE(operator!=, !=)
+#undef VECMATH_GENERIC_COMPARE
+
+#define VECMATH_GENERIC_UNARY(name, expr)                                           \
+    template <typename T, int N>                                                    \
+    VECMATH_INLINE VecN<T, N> name(const VecN<T, N> &a)                             \
+    {                                                                               \
+        VecN<T, N> r;                                                               \
+        for (int i = 0; i < N; ++i)                                                 \
+            r.v[i] = expr;                                                          \
+        return r;                                                                   \
+    }
+    VECMATH_GENERIC_UNARY(operator-, -a.v[i])
+    VECMATH_GENERIC_UNARY(abs, vecmath::abs(a.v[i]))
+    VECMATH_GENERIC_UNARY(sqrt, vecmath::sqrt(a.v[i]))
+    VECMATH_GENERIC_UNARY(rsqrt, vecmath::rsqrt(a.v[i]))
+    VECMATH_GENERIC_UNARY(exp2Int, vecmath::exp2Int(a.v[i]))
+    VECMATH_GENERIC_UNARY(roundAway, vecmath::roundAway(a.v[i]))
+#undef VECMATH_GENERIC_UNARY
+
+    template <int N>
+    VECMATH_INLINE MaskN<N> operator|(const MaskN<N> &a, const MaskN<N> &b)
+    {
+        MaskN<N> r;
+        for (int i = 0; i < N; ++i)
+            r.m[i] = a.m[i] || b.m[i];
+        return r;
+    }
+
+    template <int N>
+    VECMATH_INLINE MaskN<N> operator&(const MaskN<N> &a, const MaskN<N> &b)
+    {
+        MaskN<N> r;
+        for (int i = 0; i < N; ++i)
+            r.m[i] = a.m[i] && b.m[i];
+        return r;
+    }
+
+    template <int N>
+    VECMATH_INLINE bool anyTrue(const MaskN<N> &mask)
+    {
+        for (int i = 0; i < N; ++i)
+            if (mask.m[i])
+                return true;
+        return false;
+    }
+
+    template <typename T, int N>
+    VECMATH_INLINE VecN<T, N> select(const MaskN<N> &mask, const VecN<T, N> &a, const VecN<T, N> &b)
+    {
+        VecN<T, N> r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = mask.m[i] ? a.v[i] : b.v[i];
+        return r;
+    }
+
+    template <typename T, int N>
+    VECMATH_INLINE VecN<T, N> splitExponent(const VecN<T, N> &x, VecN<T, N> &exponent)
+    {
+        VecN<T, N> r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = vecmath::splitExponent(x.v[i], exponent.v[i]);
+        return r;
+    }
+
+#if defined(__SSE2__)
+    template <>
+    struct VecN<float, 4>
+    {
+        static const int Width = 4;
+        typedef VecN Mask;
+        __m128 v;
+
+        VECMATH_INLINE VecN() {}
+        VECMATH_INLINE VecN(__m128 m) : v(m) {}
+        VECMATH_INLINE VecN(float s) : v(_mm_set1_ps(s)) {}
+        static VECMATH_INLINE VecN load(const float *p) { return _mm_loadu_ps(p); }
+        VECMATH_INLINE void store(float *p) const { _mm_storeu_ps(p, v); }
+    };
+    typedef VecN<float, 4> Float4;
+
+    VECMATH_INLINE Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator-(Float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+    VECMATH_INLINE Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator>(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator<=(Float4 a, Float4 b) { return _mm_cmple_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator>=(Float4 a, Float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator==(Float4 a, Float4 b) { return _mm_cmpeq_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator!=(Float4 a, Float4 b) { return _mm_cmpneq_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 select(Float4 mask, Float4 a, Float4 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+    }
+    VECMATH_INLINE Float4 operator|(Float4 a, Float4 b) { return _mm_or_ps(a.v, b.v); }
+    VECMATH_INLINE Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+    VECMATH_INLINE bool anyTrue(Float4 mask) { return _mm_movemask_ps(mask.v) != 0; }
+    VECMATH_INLINE Float4 abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+    VECMATH_INLINE Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+    // hardware estimate refined by one Newton-Raphson step (~23 bits)
+    VECMATH_INLINE Float4 rsqrt(Float4 a)
+    {
+        __m128 y = _mm_rsqrt_ps(a.v);
+        __m128 yyx = _mm_mul_ps(_mm_mul_ps(y, y), a.v);
+        return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), yyx));
+    }
+    VECMATH_INLINE Float4 splitExponent(Float4 x, Float4 &exponent)
+    {
+        __m128i bits = _mm_castps_si128(x.v);
+        __m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)), _mm_set1_epi32(127));
+        exponent = _mm_cvtepi32_ps(e);
+        bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000));
+        return _mm_castsi128_ps(bits);
+    }
+    VECMATH_INLINE Float4 exp2Int(Float4 n)
+    {
+        return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127)), 23));
+    }
+    VECMATH_INLINE Float4 roundAway(Float4 a)
+    {
+        __m128 half = _mm_or_ps(_mm_and_ps(a.v, _mm_set1_ps(-0.0f)), _mm_set1_ps(0.5f));
+        return _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_add_ps(a.v, half)));
+    }
+#endif
+
+#if defined(__AVX2__)
+    template <>
+    struct VecN<float, 8>
+    {
+        static const int Width = 8;
+        typedef VecN Mask;
+        __m256 v;
+
+        VECMATH_INLINE VecN() {}
+        VECMATH_INLINE VecN(__m256 m) : v(m) {}
+        VECMATH_INLINE VecN(float s) : v(_mm256_set1_ps(s)) {}
+        static VECMATH_INLINE VecN load(const float *p) { return _mm256_loadu_ps(p); }
+        VECMATH_INLINE void store(float *p) const { _mm256_storeu_ps(p, v); }
+    };
+    typedef VecN<float, 8> Float8;
+
+    VECMATH_INLINE Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 operator-(Float8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+    VECMATH_INLINE Float8 min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 operator<(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    VECMATH_INLINE Float8 operator>(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    VECMATH_INLINE Float8 operator<=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    VECMATH_INLINE Float8 operator>=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    VECMATH_INLINE Float8 operator==(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+    VECMATH_INLINE Float8 operator!=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+    VECMATH_INLINE Float8 select(Float8 mask, Float8 a, Float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    VECMATH_INLINE Float8 operator|(Float8 a, Float8 b) { return _mm256_or_ps(a.v, b.v); }
+    VECMATH_INLINE Float8 operator&(Float8 a, Float8 b) { return _mm256_and_ps(a.v, b.v); }
+    VECMATH_INLINE bool anyTrue(Float8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+    VECMATH_INLINE Float8 abs(Float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    VECMATH_INLINE Float8 sqrt(Float8 a) { return _mm256_sqrt_ps(a.v); }
+    VECMATH_INLINE Float8 rsqrt(Float8 a)
+    {
+        __m256 y = _mm256_rsqrt_ps(a.v);
+        __m256 yyx = _mm256_mul_ps(_mm256_mul_ps(y, y), a.v);
+        return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y), _mm256_sub_ps(_mm256_set1_ps(3.0f), yyx));
+    }
+    VECMATH_INLINE Float8 splitExponent(Float8 x, Float8 &exponent)
+    {
+        __m256i bits = _mm256_castps_si256(x.v);
+        __m256i e = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)), _mm256_set1_epi32(127));
+        exponent = _mm256_cvtepi32_ps(e);
+        bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000));
+        return _mm256_castsi256_ps(bits);
+    }
+    VECMATH_INLINE Float8 exp2Int(Float8 n)
+    {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127)), 23));
+    }
+    VECMATH_INLINE Float8 roundAway(Float8 a)
+    {
+        __m256 half = _mm256_or_ps(_mm256_and_ps(a.v, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(0.5f));
+        return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_add_ps(a.v, half)));
+    }
+#endif
+
+#if defined(__AVX512F__)
+    struct Mask16
+    {
+        __mmask16 m;
+        VECMATH_INLINE Mask16(__mmask16 k) : m(k) {}
+    };
+
+    template <>
+    struct VecN<float, 16>
+    {
+        static const int Width = 16;
+        typedef Mask16 Mask;
+        __m512 v;
+
+        VECMATH_INLINE VecN() {}
+        VECMATH_INLINE VecN(__m512 m) : v(m) {}
+        VECMATH_INLINE VecN(float s) : v(_mm512_set1_ps(s)) {}
+        static VECMATH_INLINE VecN load(const float *p) { return _mm512_loadu_ps(p); }
+        VECMATH_INLINE void store(float *p) const { _mm512_storeu_ps(p, v); }
+    };
+    typedef VecN<float, 16> Float16;
+
+    VECMATH_INLINE Float16 operator+(Float16 a, Float16 b) { return _mm512_add_ps(a.v, b.v); }
+    VECMATH_INLINE Float16 operator-(Float16 a, Float16 b) { return _mm512_sub_ps(a.v, b.v); }
+    VECMATH_INLINE Float16 operator*(Float16 a, Float16 b) { return _mm512_mul_ps(a.v, b.v); }
+    VECMATH_INLINE Float16 operator/(Float16 a, Float16 b) { return _mm512_div_ps(a.v, b.v); }
+    VECMATH_INLINE Float16 operator-(Float16 a) { return _mm512_sub_ps(_mm512_setzero_ps(), a.v); }
+    VECMATH_INLINE Float16 min(Float16 a, Float16 b) { return _mm512_min_ps(a.v, b.v); }
+    VECMATH_INLINE Float16 max(Float16 a, Float16 b) { return _mm512_max_ps(a.v, b.v); }
+    VECMATH_INLINE Mask16 operator<(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+    VECMATH_INLINE Mask16 operator>(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+    VECMATH_INLINE Mask16 operator<=(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ); }
+    VECMATH_INLINE Mask16 operator>=(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ); }
+    VECMATH_INLINE Mask16 operator==(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ); }
+    VECMATH_INLINE Mask16 operator!=(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_NEQ_UQ); }
+    VECMATH_INLINE Float16 select(Mask16 mask, Float16 a, Float16 b) { return _mm512_mask_blend_ps(mask.m, b.v, a.v); }
+    VECMATH_INLINE Mask16 operator|(Mask16 a, Mask16 b) { return (__mmask16)(a.m | b.m); }
+    VECMATH_INLINE Mask16 operator&(Mask16 a, Mask16 b) { return (__mmask16)(a.m & b.m); }
+    VECMATH_INLINE bool anyTrue(Mask16 mask) { return mask.m != 0; }
+    VECMATH_INLINE Float16 abs(Float16 a) { return _mm512_abs_ps(a.v); }
+    VECMATH_INLINE Float16 sqrt(Float16 a) { return _mm512_sqrt_ps(a.v); }
+    VECMATH_INLINE Float16 rsqrt(Float16 a)
+    {
+        // 14-bit estimate plus one Newton-Raphson step
+        __m512 y = _mm512_rsqrt14_ps(a.v);
+        __m512 yyx = _mm512_mul_ps(_mm512_mul_ps(y, y), a.v);
+        return _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), y), _mm512_sub_ps(_mm512_set1_ps(3.0f), yyx));
+    }
+    VECMATH_INLINE Float16 splitExponent(Float16 x, Float16 &exponent)
+    {
+        __m512i bits = _mm512_castps_si512(x.v);
+        __m512i e = _mm512_sub_epi32(_mm512_and_si512(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(0xff)), _mm512_set1_epi32(127));
+        exponent = _mm512_cvtepi32_ps(e);
+        bits = _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)), _mm512_set1_epi32(0x3f800000));
+        return _mm512_castsi512_ps(bits);
+    }
+    VECMATH_INLINE Float16 exp2Int(Float16 n)
+    {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(n.v), _mm512_set1_epi32(127)), 23));
+    }
+    VECMATH_INLINE Float16 roundAway(Float16 a)
+    {
+        __m512 half = _mm512_castsi512_ps(_mm512_or_si512(
+            _mm512_and_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32((int)0x80000000)),
+            _mm512_castps_si512(_mm512_set1_ps(0.5f))));
+        return _mm512_cvtepi32_ps(_mm512_cvttps_epi32(_mm512_add_ps(a.v, half)));
+    }
+#endif
+
+    // widest float lane type the translation unit is compiled for
+#if defined(__AVX512F__)
+    typedef VecN<float, 16> NativeFloat;
+#elif defined(__AVX2__)
+    typedef VecN<float, 8> NativeFloat;
+#elif defined(__SSE2__)
+    typedef VecN<float, 4> NativeFloat;
+#else
+    typedef VecN<float, 1> NativeFloat;
+#endif
+
+    /*
+     * Vec3 / Vec4 arithmetic.
+     */
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> operator+(const Vec3<T> &a, const Vec3<T> &b) { return Vec3<T>{a.x + b.x, a.y + b.y, a.z + b.z}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> operator-(const Vec3<T> &a, const Vec3<T> &b) { return Vec3<T>{a.x - b.x, a.y - b.y, a.z - b.z}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> operator-(const Vec3<T> &a) { return Vec3<T>{-a.x, -a.y, -a.z}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> operator*(const Vec3<T> &a, const typename NonDeduced<T>::type &s) { return Vec3<T>{a.x * s, a.y * s, a.z * s}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> operator*(const typename NonDeduced<T>::type &s, const Vec3<T> &a) { return Vec3<T>{s * a.x, s * a.y, s * a.z}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> operator/(const Vec3<T> &a, const typename NonDeduced<T>::type &s) { return Vec3<T>{a.x / s, a.y / s, a.z / s}; }
+
+    // component-wise; mixed element types promote (Vec3<int> * Vec3<float> is Vec3<float>)
+    template <typename A, typename B>
+    VECMATH_INLINE constexpr Vec3<decltype(std::declval<A>() * std::declval<B>())> operator*(const Vec3<A> &a, const Vec3<B> &b)
+    {
+        return Vec3<decltype(std::declval<A>() * std::declval<B>())>{a.x * b.x, a.y * b.y, a.z * b.z};
+    }
+
+    template <typename T>
+    VECMATH_INLINE constexpr Vec4<T> operator+(const Vec4<T> &a, const Vec4<T> &b) { return Vec4<T>{a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec4<T> operator-(const Vec4<T> &a, const Vec4<T> &b) { return Vec4<T>{a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec4<T> operator*(const Vec4<T> &a, const typename NonDeduced<T>::type &s) { return Vec4<T>{a.x * s, a.y * s, a.z * s, a.w * s}; }
+    template <typename T>
+    VECMATH_INLINE constexpr Vec4<T> operator/(const Vec4<T> &a, const typename NonDeduced<T>::type &s) { return Vec4<T>{a.x / s, a.y / s, a.z / s, a.w / s}; }
+
+    template <typename T>
+    VECMATH_INLINE constexpr T dot(const Vec3<T> &a, const Vec3<T> &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    template <typename T>
+    VECMATH_INLINE constexpr T dot(const Vec4<T> &a, const Vec4<T> &b) { return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+
+    template <typename T>
+    VECMATH_INLINE constexpr Vec3<T> cross(const Vec3<T> &a, const Vec3<T> &b)
+    {
+        return Vec3<T>{a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+    }
+
+    template <typename T>
+    VECMATH_INLINE T length(const Vec3<T> &v) { return sqrt(dot(v, v)); }
+
+    // 1/|v|, or 0 for the zero vector so that normalize() leaves it at zero
+    template <typename T>
+    VECMATH_INLINE T inverseLength(const T &lengthSquared)
+    {
+        return select(lengthSquared != T(0), rsqrt(select(lengthSquared != T(0), lengthSquared, T(1))), T(0));
+    }
+
+    template <typename T>
+    VECMATH_INLINE Vec3<T> normalize(const Vec3<T> &v) { return v * inverseLength(dot(v, v)); }
+
+    // scalar vector replicated into every lane of a wide one
+    template <typename T, typename S>
+    VECMATH_INLINE constexpr Vec3<T> broadcast(const Vec3<S> &v) { return Vec3<T>{T(v.x), T(v.y), T(v.z)}; }
+
+    template <typename T>
+    VECMATH_INLINE Vec3<T> load3(const float *x, const float *y, const float *z) { return Vec3<T>{T::load(x), T::load(y), T::load(z)}; }
+
+    /*
+     * Fast transcendental functions for lane types (and float).
+     */
+
+    // log2(x) for x > 0. The mantissa is brought to [sqrt(0.5), sqrt(2))
+    // where the atanh series for ln(m) converges quickly; five terms are
+    // well below float precision.
+    template <typename T>
+    VECMATH_INLINE T fastLog2(const T &x)
+    {
+        T exponent;
+        T m = splitExponent(x, exponent);
+
+        T big = select(m > T(1.41421356f), T(1.0f), T(0.0f));
+        m = m * (T(1.0f) - big * T(0.5f));
+        exponent = exponent + big;
+
+        T t = (m - T(1.0f)) / (m + T(1.0f));
+        T t2 = t * t;
+        T ln = t * (T(2.0f) + t2 * (T(0.666666667f) + t2 * (T(0.4f) + t2 * (T(0.285714286f) + t2 * T(0.222222222f)))));
+        return exponent + ln * T(1.44269504f);
+    }
+
+    // 2^y, split into 2^n * 2^f with f in [-0.5, 0.5]; 2^f is a degree 6
+    // Taylor polynomial (relative error ~1e-7).
+    template <typename T>
+    VECMATH_INLINE T fastExp2(T y)
+    {
+        y = min(max(y, T(-125.0f)), T(127.0f));
+        T n = roundAway(y);
+        T f = y - n;
+
+        T p = T(1.0f) + f * (T(0.693147181f) + f * (T(0.240226507f) + f * (T(0.0555041087f) +
+              f * (T(0.00961812911f) + f * (T(0.00133335581f) + f * T(0.000154035304f))))));
+        return p * exp2Int(n);
+    }
+
+    // x^e for x >= 0, with pow's convention 0^0 = 1
+    template <typename T>
+    VECMATH_INLINE T fastPow(const T &x, const T &e)
+    {
+        T result = fastExp2(e * fastLog2(select(x > T(0.0f), x, T(1.0f))));
+        T atZero = select(e != T(0.0f), T(0.0f), T(1.0f));
+        return select(x > T(0.0f), result, atZero);
+    }
+}
+
+#endif
@@ -0,0 +1,431 @@
+#include "xmlreader.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    const size_t MIN_BUFFER_BYTES = 1 << 16;
+
+    inline bool isSpace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+    }
+
+    void appendUtf8(std::string &text, unsigned long code)
+    {
+        if (code < 0x80) {
+            text += (char)code;
+        } else if (code < 0x800) {
+            text += (char)(0xC0 | (code >> 6));
+            text += (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            text += (char)(0xE0 | (code >> 12));
+            text += (char)(0x80 | ((code >> 6) & 0x3F));
+            text += (char)(0x80 | (code & 0x3F));
+        } else {
+            text += (char)(0xF0 | (code >> 18));
+            text += (char)(0x80 | ((code >> 12) & 0x3F));
+            text += (char)(0x80 | ((code >> 6) & 0x3F));
+            text += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    void unexpectedEnd()
+    {
+        throw std::runtime_error("Error: Unexpected end of the xml file.");
+    }
+}
+
+parser::XmlReader::XmlReader(const std::string &path)
+{
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("Error: The xml file cannot be loaded.");
+    }
+
+    // Regular files are mapped and parsed in place; the kernel reads ahead
+    // and a file already in the page cache is not copied at all.
+    struct stat info;
+    if (fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+            mapped = info.st_size;
+            data = (const char *)mapping;
+            end = mapped;
+            eof = true;
+        }
+    }
+
+    if (!mapped) {
+        // small files get a buffer that just fits
+        size_t size = XML_BUFFER_BYTES;
+        if (fseek(file, 0, SEEK_END) == 0) {
+            long length = ftell(file);
+            if (length >= 0 && (size_t)length < size)
+                size = (size_t)length + 1;
+            fseek(file, 0, SEEK_SET);
+        }
+        buffer.resize(std::max(size, MIN_BUFFER_BYTES));
+        data = &buffer[0];
+    }
+
+    if (startsWith("\xEF\xBB\xBF"))
+        pos += 3;
+}
+
+parser::XmlReader::~XmlReader()
+{
+    if (mapped)
+        munmap((void *)data, mapped);
+    fclose(file);
+}
+
+// Moves the unread bytes to the front and reads more after them. Returns
+// false when nothing could be added, always for a mapped file.
+bool parser::XmlReader::fill()
+{
+    if (mapped)
+        return false;
+    if (pos > 0) {
+        memmove(&buffer[0], &buffer[pos], end - pos);
+        end -= pos;
+        pos = 0;
+    }
+    if (eof || end == buffer.size())
+        return false;
+    size_t count = fread(&buffer[end], 1, buffer.size() - end, file);
+    end += count;
+    if (count == 0)
+        eof = true;
+    return count > 0;
+}
+
+bool parser::XmlReader::ensure(size_t count)
+{
+    while (end - pos < count)
+        if (!fill())
+            return false;
+    return true;
+}
+
+bool parser::XmlReader::startsWith(const char *text)
+{
+    size_t length = strlen(text);
+    return ensure(length) && memcmp(&data[pos], text, length) == 0;
+}
+
+void parser::XmlReader::skipPast(const char *terminator)
+{
+    size_t length = strlen(terminator);
+    for (;;) {
+        const char *begin = data + pos, *stop = data + end;
+        const char *found = std::search(begin, stop, terminator, terminator + length);
+        if (found != stop) {
+            pos = found - data + length;
+            return;
+        }
+        // keep a possible partial terminator at the end
+        pos = std::max(pos, end >= length - 1 ? end - (length - 1) : 0);
+        if (!fill())
+            unexpectedEnd();
+    }
+}
+
+// comments, CDATA, processing instructions and DOCTYPE
+void parser::XmlReader::skipMarkup()
+{
+    if (startsWith("<!--"))
+        skipPast("-->");
+    else if (startsWith("<![CDATA["))
+        skipPast("]]>");
+    else if (startsWith("<?"))
+        skipPast("?>");
+    else
+        skipPast(">");
+}
+
+void parser::XmlReader::appendEntity(std::string &text)
+{
+    static const char *names[] = {"&lt;", "&gt;", "&amp;", "&quot;", "&apos;"};
+    static const char values[] = {'<', '>', '&', '"', '\''};
+
+    for (int i = 0; i < 5; ++i) {
+        if (startsWith(names[i])) {
+            text += values[i];
+            pos += strlen(names[i]);
+            return;
+        }
+    }
+    if (startsWith("&#")) {
+        ensure(16);
+        size_t i = pos + 2;
+        bool hex = i < end && data[i] == 'x';
+        if (hex)
+            ++i;
+        size_t digits = i;
+        unsigned long code = 0;
+        for (; i < end && i < pos + 16; ++i) {
+            char c = data[i];
+            int digit = c >= '0' && c <= '9' ? c - '0'
+                      : hex && c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : hex && c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0)
+                break;
+            code = code * (hex ? 16 : 10) + digit;
+        }
+        if (i > digits && i < end && data[i] == ';') {
+            appendUtf8(text, code);
+            pos = i + 1;
+            return;
+        }
+    }
+    // not an entity, kept as is
+    text += '&';
+    ++pos;
+}
+
+void parser::XmlReader::readStartTag()
+{
+    ++pos;
+    elementName.clear();
+    attributes.clear();
+    empty = false;
+
+    for (;;) {
+        if (!ensure(1))
+            unexpectedEnd();
+        char c = data[pos];
+        if (isSpace(c) || c == '/' || c == '>')
+            break;
+        elementName += c;
+        ++pos;
+    }
+
+    for (;;) {
+        if (!ensure(1))
+            unexpectedEnd();
+        char c = data[pos];
+        if (isSpace(c)) {
+            ++pos;
+        } else if (c == '>') {
+            ++pos;
+            return;
+        } else if (c == '/') {
+            if (!startsWith("/>"))
+                throw std::runtime_error("Error: Malformed tag <" + elementName + "> in the xml file.");
+            pos += 2;
+            empty = true;
+            return;
+        } else {
+            std::string name, value;
+            while (ensure(1) && data[pos] != '=' && !isSpace(data[pos]) && data[pos] != '>')
+                name += data[pos++];
+            while (ensure(1) && isSpace(data[pos]))
+                ++pos;
+            if (!ensure(1) || data[pos] != '=')
+                throw std::runtime_error("Error: Malformed attribute in <" + elementName + "> in the xml file.");
+            ++pos;
+            while (ensure(1) && isSpace(data[pos]))
+                ++pos;
+            if (!ensure(1) || (data[pos] != '"' && data[pos] != '\''))
+                throw std::runtime_error("Error: Malformed attribute in <" + elementName + "> in the xml file.");
+            char quote = data[pos++];
+            for (;;) {
+                if (!ensure(1))
+                    unexpectedEnd();
+                if (data[pos] == quote)
+                    break;
+                if (data[pos] == '&')
+                    appendEntity(value);
+                else
+                    value += data[pos++];
+            }
+            ++pos;
+            attributes.push_back(std::make_pair(name, value));
+        }
+    }
+}
+
+// Skips text up to the next '<'; false at the end of the file.
+bool parser::XmlReader::skipToTag()
+{
+    for (;;) {
+        const char *found = (const char *)memchr(data + pos, '<', end - pos);
+        if (found) {
+            pos = found - data;
+            return true;
+        }
+        pos = end;
+        if (!fill())
+            return false;
+    }
+}
+
+void parser::XmlReader::readEndTag()
+{
+    skipPast(">");
+}
+
+bool parser::XmlReader::nextElement()
+{
+    if (enteredEmpty) {
+        enteredEmpty = false;
+        return false;
+    }
+    if (pending)
+        skip();
+
+    for (;;) {
+        // text between elements is ignored
+        if (!skipToTag()) {
+            if (depth == 0)
+                return false;
+            unexpectedEnd();
+        }
+
+        if (startsWith("</")) {
+            readEndTag();
+            --depth;
+            return false;
+        }
+        if (startsWith("<!") || startsWith("<?")) {
+            skipMarkup();
+            continue;
+        }
+        readStartTag();
+        pending = true;
+        return true;
+    }
+}
+
+std::string parser::XmlReader::attribute(const char *name) const
+{
+    for (const auto &attribute : attributes)
+        if (attribute.first == name)
+            return attribute.second;
+    return "";
+}
+
+void parser::XmlReader::enter()
+{
+    pending = false;
+    if (empty)
+        enteredEmpty = true;
+    else
+        ++depth;
+}
+
+void parser::XmlReader::skip()
+{
+    pending = false;
+    if (empty)
+        return;
+
+    int level = 1;
+    while (level > 0) {
+        if (!skipToTag())
+            unexpectedEnd();
+        if (startsWith("</")) {
+            readEndTag();
+            --level;
+        } else if (startsWith("<!") || startsWith("<?")) {
+            skipMarkup();
+        } else {
+            readStartTag();
+            if (!empty)
+                ++level;
+        }
+    }
+}
+
+std::string parser::XmlReader::readText()
+{
+    pending = false;
+    std::string text;
+    if (empty)
+        return text;
+
+    for (;;) {
+        if (!ensure(1))
+            unexpectedEnd();
+        char c = data[pos];
+        if (c == '<') {
+            if (startsWith("</")) {
+                readEndTag();
+                return text;
+            }
+            if (startsWith("<![CDATA[")) {
+                pos += 9;
+                while (!startsWith("]]>")) {
+                    if (!ensure(1))
+                        unexpectedEnd();
+                    text += data[pos++];
+                }
+                pos += 3;
+            } else if (startsWith("<!") || startsWith("<?")) {
+                skipMarkup();
+            } else {
+                readStartTag();
+                skip();
+            }
+        } else if (c == '&') {
+            appendEntity(text);
+        } else if (c == '\r') {
+            // line endings are normalized to \n
+            text += '\n';
+            ++pos;
+            if (ensure(1) && data[pos] == '\n')
+                ++pos;
+        } else {
+            text += c;
+            ++pos;
+        }
+    }
+}
+
+void parser::XmlReader::streamText(const std::function<void(const char *, const char *)> &consume)
+{
+    pending = false;
+    if (empty)
+        return;
+
+    for (;;) {
+        const char *begin = data + pos;
+        const char *found = (const char *)memchr(begin, '<', end - pos);
+        if (found) {
+            if (found > begin)
+                consume(begin, found);
+            pos = found - data;
+            if (startsWith("</")) {
+                readEndTag();
+                return;
+            }
+            if (startsWith("<!") || startsWith("<?")) {
+                skipMarkup();
+            } else {
+                readStartTag();
+                skip();
+            }
+            continue;
+        }
+
+        // hand out everything up to the last whitespace, keep the partial token
+        const char *stop = data + end;
+        const char *split = stop;
+        while (split > begin && !isSpace(split[-1]))
+            --split;
+        if (split > begin) {
+            consume(begin, split);
+            pos = split - data;
+        }
+        if (!fill()) {
+            if (eof)
+                unexpectedEnd();
+            throw std::runtime_error("Error: Token longer than the xml buffer.");
+        }
+    }
+}
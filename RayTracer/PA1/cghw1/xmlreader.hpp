@@ -0,0 +1,78 @@
+#ifndef __HW1__XMLREADER__
+#define __HW1__XMLREADER__
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace parser
+{
+    // Size of the window XmlReader keeps of a file it cannot map (a pipe,
+    // for example); large text blocks are then handed out in pieces of
+    // about this size.
+    const size_t XML_BUFFER_BYTES = 16 << 20;
+
+    // Pull reader for scene files. Regular files are memory-mapped read-only
+    // and parsed in place; anything else is read through a bounded buffer.
+    // It understands elements, attributes, text with the standard
+    // entities, comments, CDATA, processing instructions and DOCTYPE, which
+    // is all the scene format uses. Errors throw std::runtime_error.
+    //
+    // nextElement() moves to the next child element of the current one and
+    // returns false at the current element's end tag. The element it stops
+    // at is then consumed with enter(), skip(), readText() or streamText();
+    // calling nextElement() again without doing so skips it.
+    class XmlReader
+    {
+    public:
+        explicit XmlReader(const std::string &path);
+        ~XmlReader();
+
+        bool nextElement();
+        const std::string &name() const { return elementName; }
+        // "" when the element has no such attribute
+        std::string attribute(const char *name) const;
+
+        // makes the element's children visible to nextElement()
+        void enter();
+        void skip();
+        // text content with entities decoded, child elements left out
+        std::string readText();
+        // Raw text content in pieces that end at whitespace or at the end of
+        // the text, straight from the buffer. Meant for the numeric blocks,
+        // so entities are not decoded.
+        void streamText(const std::function<void(const char *, const char *)> &consume);
+
+    private:
+        XmlReader(const XmlReader &);
+        XmlReader &operator=(const XmlReader &);
+
+        bool fill();
+        bool ensure(size_t count);
+        bool startsWith(const char *text);
+        void skipPast(const char *terminator);
+        bool skipToTag();
+        void skipMarkup();
+        void readStartTag();
+        void readEndTag();
+        void appendEntity(std::string &text);
+
+        FILE *file;
+        size_t mapped = 0;                  // length of the mapping, 0 when buffered
+        std::vector<char> buffer;
+        const char *data = 0;               // the mapping or buffer
+        size_t pos = 0, end = 0;            // unread bytes are data[pos, end)
+        bool eof = false;
+        int depth = 0;                      // elements entered and not yet closed
+
+        std::string elementName;
+        std::vector<std::pair<std::string, std::string> > attributes;
+        bool empty = false;                 // element is <name ... />
+        bool pending = false;               // element not consumed yet
+        bool enteredEmpty = false;          // entered an empty element
+    };
+}
+
+#endif